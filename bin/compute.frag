@@ -15,13 +15,37 @@ uniform sampler2D originalVelocityTex;
 uniform int step;
 uniform int numParticles;
 
+// IMPLICIT_ID is defined by the engine: with state below 32 bits the
+// particle id would be rounded in the position w, it comes from the
+// texel index instead
+#if IMPLICIT_ID
+uniform int texWidth; // state texture width in texels
+#endif
+
+// SDF is defined by the engine: the particles collide with a mesh
+// through its signed distance field
+#if SDF
+uniform sampler3D sdfTex; // distance to the mesh, negative inside
+uniform vec3 sdfMin, sdfMax; // box of the field
+uniform vec3 sdfStep; // distance between samples
+
+float sdf(vec3 p) {
+	return texture3D( sdfTex, (p - sdfMin) / (sdfMax - sdfMin) ).r;
+}
+#endif
+
 
 void main(void) {
 
 	// retrieve data from textures
 	vec3 position = texture2D( positionTex, gl_TexCoord[0].st ).xyz;
 	vec3 velocity = texture2D( velocityTex, gl_TexCoord[0].st ).xyz;
+#if IMPLICIT_ID
+	int index = int(gl_FragCoord.y)*texWidth + int(gl_FragCoord.x);
+	float particleId = float(index) / float(numParticles);
+#else
 	float particleId = texture2D( positionTex, gl_TexCoord[0].st ).w;
+#endif
 
 	// update particle
 	velocity.xyz = velocity.xyz + gravity.xyz*time_step;
@@ -37,12 +61,27 @@ void main(void) {
 	if (position.z == -1 || position.z == 1.0)
 	  velocity.z = 0;
 
+#if SDF
+	// inside the mesh: out along the field gradient, losing the
+	// velocity into it as at the walls
+	float d = sdf(position);
+	if (d < 0.0) {
+		vec3 n = vec3( sdf(position + vec3(sdfStep.x, 0.0, 0.0)) - sdf(position - vec3(sdfStep.x, 0.0, 0.0)),
+			       sdf(position + vec3(0.0, sdfStep.y, 0.0)) - sdf(position - vec3(0.0, sdfStep.y, 0.0)),
+			       sdf(position + vec3(0.0, 0.0, sdfStep.z)) - sdf(position - vec3(0.0, 0.0, sdfStep.z)) );
+		if (dot(n, n) > 0.0) {
+			n = normalize(n);
+			position = clamp (position - d*n, -1.0, 1.0);
+			velocity = velocity - min(dot(velocity, n), 0.0)*n;
+		}
+	}
+#endif
+
 	// reset particle
 	if (int(particleId*float(numParticles)) > step)
 		{
 			position = vec3(0.0);
 			velocity = texture2D( originalVelocityTex, gl_TexCoord[0].st ).xyz;
-			velocity =  vec3(gl_ModelViewMatrixInverse * vec4 (velocity, 1.0));
 		}
 
 	// write output to two textures
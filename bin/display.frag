@@ -0,0 +1,12 @@
+/**
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  Fragment Shader -- Particle display
+ *
+ **/
+
+void main(void) {
+
+	gl_FragColor = gl_Color;
+
+}
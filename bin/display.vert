@@ -0,0 +1,29 @@
+/**
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  Vertex Shader -- Particle display from the state texture
+ *
+ **/
+#version 120
+
+uniform sampler2D positionTex;
+uniform sampler2D previousPositionTex; // step before
+uniform float alpha; // blend from the step before (0) to the current one (1)
+
+void main(void) {
+
+	// gl_Vertex holds the particle texel center (xy) and index (z)
+	vec4 position = texture2DLod( positionTex, gl_Vertex.xy, 0.0 );
+	vec4 previous = texture2DLod( previousPositionTex, gl_Vertex.xy, 0.0 );
+
+	// particles reset in the last step jump to the origin, no blending
+	if (position.xyz != vec3(0.0))
+		position.xyz = mix( previous.xyz, position.xyz, alpha );
+
+	// same red, green, blue cycle as the CPU loop
+	float c = mod( gl_Vertex.z, 3.0 );
+	gl_FrontColor = vec4( float(c < 0.5), float(c > 0.5 && c < 1.5), float(c > 1.5), 1.0 );
+
+	gl_Position = gl_ModelViewProjectionMatrix * vec4( position.xyz, 1.0 );
+
+}
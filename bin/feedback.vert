@@ -0,0 +1,84 @@
+/**
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  Vertex Shader -- Particle update captured by transform feedback,
+ *  the same update as compute.frag
+ *
+ *  SDF is defined by the engine: the particles collide with a mesh
+ *  through its signed distance field
+ *
+ **/
+#version 120
+
+attribute vec4 position; // position and particle id
+attribute vec4 velocity;
+attribute vec4 originalVelocity;
+
+uniform float time_step;
+uniform vec3 gravity;
+uniform int step;
+uniform int numParticles;
+
+varying vec4 outPosition;
+varying vec4 outVelocity;
+
+#if SDF
+uniform sampler3D sdfTex; // distance to the mesh, negative inside
+uniform vec3 sdfMin, sdfMax; // box of the field
+uniform vec3 sdfStep; // distance between samples
+
+float sdf(vec3 p) {
+	return texture3DLod( sdfTex, (p - sdfMin) / (sdfMax - sdfMin), 0.0 ).r;
+}
+#endif
+
+void main(void) {
+
+	vec3 p = position.xyz;
+	vec3 v = velocity.xyz;
+	float particleId = position.w;
+
+	// update particle
+	v = v + gravity*time_step;
+
+	p = p + v*time_step;
+
+	p = clamp (p, -1.0, 1.0);
+
+	if (p.x == -1.0 || p.x == 1.0)
+	  v.x = 0.0;
+	if (p.y == -1.0 || p.y == 1.0)
+	  v.y = 0.0;
+	if (p.z == -1.0 || p.z == 1.0)
+	  v.z = 0.0;
+
+#if SDF
+	// inside the mesh: out along the field gradient, losing the
+	// velocity into it as at the walls
+	float d = sdf(p);
+	if (d < 0.0) {
+		vec3 n = vec3( sdf(p + vec3(sdfStep.x, 0.0, 0.0)) - sdf(p - vec3(sdfStep.x, 0.0, 0.0)),
+			       sdf(p + vec3(0.0, sdfStep.y, 0.0)) - sdf(p - vec3(0.0, sdfStep.y, 0.0)),
+			       sdf(p + vec3(0.0, 0.0, sdfStep.z)) - sdf(p - vec3(0.0, 0.0, sdfStep.z)) );
+		if (dot(n, n) > 0.0) {
+			n = normalize(n);
+			p = clamp (p - d*n, -1.0, 1.0);
+			v = v - min(dot(v, n), 0.0)*n;
+		}
+	}
+#endif
+
+	// reset particle
+	if (int(particleId*float(numParticles)) > step)
+		{
+			p = vec3(0.0);
+			v = originalVelocity.xyz;
+		}
+
+	outPosition = vec4( p, particleId );
+	outVelocity = vec4( v, 1.0 );
+
+	// nothing is rasterized
+	gl_Position = vec4( 0.0 );
+
+}
@@ -0,0 +1,36 @@
+/**
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  Vertex Shader -- Particle display from a state buffer
+ *
+ **/
+#version 120
+
+uniform int numParticles;
+uniform float alpha; // blend from the step before (0) to the current one (1)
+
+attribute vec4 previousPosition; // step before
+
+void main(void) {
+
+	// gl_Vertex holds the particle position (xyz) and id (w); with
+	// emitters w holds the emitter index, and is negative when dead
+	if (gl_Vertex.w < 0.0) {
+		gl_Position = vec4( 2.0, 2.0, 2.0, 1.0 ); // clipped
+		return;
+	}
+
+	float index = floor( gl_Vertex.w * float(numParticles) + 0.5 );
+
+	// same red, green, blue cycle as the CPU loop
+	float c = mod( index, 3.0 );
+	gl_FrontColor = vec4( float(c < 0.5), float(c > 0.5 && c < 1.5), float(c > 1.5), 1.0 );
+
+	// particles reset in the last step jump to the origin, no blending
+	vec3 position = gl_Vertex.xyz;
+	if (position != vec3(0.0))
+		position = mix( previousPosition.xyz, position, alpha );
+
+	gl_Position = gl_ModelViewProjectionMatrix * vec4( position, 1.0 );
+
+}
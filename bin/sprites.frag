@@ -0,0 +1,41 @@
+/**
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  Fragment Shader -- Particle sprites, round with a soft edge, in
+ *  premultiplied alpha
+ *
+ **/
+#version 120
+
+uniform float softness; // eye distance over which sprites fade into the scene, 0 for none
+uniform sampler2D depthTex; // scene depth, with softness
+uniform vec2 viewport; // viewport size in pixels
+
+varying vec2 offset; // position inside the sprite, -1 to 1
+
+// distance from the eye (clip w) along the view axis of a window depth;
+// the projection may hold a view translation, as set up by reshape
+float eyeDistance(float depth) {
+	mat4 P = gl_ProjectionMatrix;
+	float ndc = 2.0*depth - 1.0;
+	float z = (ndc*P[3][3] - P[3][2]) / (P[2][2] - ndc*P[2][3]);
+	return P[2][3]*z + P[3][3];
+}
+
+void main(void) {
+
+	float r2 = dot( offset, offset );
+	if (r2 > 1.0)
+		discard;
+
+	float a = gl_Color.a * (1.0 - r2);
+
+	// soft particles fade where they cross the scene instead of being cut
+	if (softness > 0.0) {
+		float scene = eyeDistance( texture2D( depthTex, gl_FragCoord.xy / viewport ).r );
+		a *= clamp( (scene - eyeDistance( gl_FragCoord.z )) / softness, 0.0, 1.0 );
+	}
+
+	gl_FragColor = vec4( gl_Color.rgb * a, a );
+
+}
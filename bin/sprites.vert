@@ -0,0 +1,70 @@
+/**
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  Vertex Shader -- Particle sprites, one instance per particle
+ *
+ *  TEXTURES is defined by the renderer: the state comes from the
+ *  textures of the texture engine, fetched by instance, instead of
+ *  per instance attributes from the state buffer
+ *
+ **/
+#version 120
+#extension GL_ARB_draw_instanced : require
+
+uniform int numParticles;
+uniform float alpha; // blend from the step before (0) to the current one (1)
+uniform float size; // sprite half size
+uniform float fade; // life over which sprites of emitters fade out
+
+attribute vec2 corner; // quad corner, -1 to 1
+
+#if TEXTURES
+uniform sampler2D positionTex;
+uniform sampler2D previousPositionTex; // step before
+uniform sampler2D velocityTex;
+uniform vec2 texSize; // state texture size in texels
+#else
+attribute vec4 position; // position and particle id
+attribute vec4 velocity; // velocity and remaining life
+attribute vec4 previousPosition; // step before
+#endif
+
+varying vec2 offset; // position inside the sprite, -1 to 1
+
+void main(void) {
+
+#if TEXTURES
+	float i = float(gl_InstanceIDARB);
+	vec2 texel = (vec2(mod(i, texSize.x), floor(i / texSize.x)) + 0.5) / texSize;
+	vec4 position = texture2DLod( positionTex, texel, 0.0 );
+	vec4 previousPosition = texture2DLod( previousPositionTex, texel, 0.0 );
+	vec4 velocity = texture2DLod( velocityTex, texel, 0.0 );
+#endif
+
+	// dead particles of the emitters are clipped, as in points.vert
+	if (position.w < 0.0) {
+		gl_Position = vec4( 2.0, 2.0, 2.0, 1.0 );
+		return;
+	}
+
+	// same red, green, blue cycle as the points
+	float c = mod( floor( position.w * float(numParticles) + 0.5 ), 3.0 );
+
+	// the velocity w is the remaining life with emitters, 1 otherwise:
+	// sprites shrink and fade out at the end of their life
+	float age = clamp( velocity.w / fade, 0.0, 1.0 );
+	gl_FrontColor = vec4( float(c < 0.5), float(c > 0.5 && c < 1.5), float(c > 1.5), age );
+
+	// particles reset in the last step jump to the origin, no blending
+	vec3 center = position.xyz;
+	if (center != vec3(0.0))
+		center = mix( previousPosition.xyz, center, alpha );
+
+	// the quad faces the camera: the corner is offset in eye space
+	vec4 eye = gl_ModelViewMatrix * vec4( center, 1.0 );
+	eye.xy += corner * size * (0.5 + 0.5*age);
+
+	offset = corner;
+	gl_Position = gl_ProjectionMatrix * eye;
+
+}
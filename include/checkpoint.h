@@ -0,0 +1,79 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  checkpoint.h -- Particle state saved to and resumed from a file
+ *
+ **/
+
+#ifndef __CHECKPOINT__
+#define __CHECKPOINT__
+
+#include <stddef.h>
+#include <stdint.h>
+
+///
+/// Checkpoint file of a particle run: a header page with the step
+/// counters, time step and gravity, then the position, velocity and
+/// original velocity arrays in the texture layout of the engines, each
+/// on its own page. Resuming maps the file, so the arrays are handed to
+/// set_state without being read or copied first
+///
+class particleCheckpoint {
+
+public:
+
+	/// Header, in the byte order of the writer
+	struct header {
+		char magic[4]; ///< "PCKP"
+		uint32_t version; ///< 1
+		uint32_t numParticles;
+		int32_t step; ///< Reset step of the next update
+		uint64_t totalSteps; ///< Steps run so far
+		float time_step;
+		float gravity[3]; ///< Gravity of the last update
+		uint64_t offsets[3]; ///< File offsets of the position, velocity and original velocity arrays
+	};
+
+	particleCheckpoint( void ) : data(0), length(0) { }
+
+	/// Destructor unmaps the file
+	~particleCheckpoint() { close(); }
+
+	/// Writes a checkpoint
+	/// @arg filename output file
+	/// @arg h counters, time step and gravity; the rest is filled in
+	/// @arg pos, vel, orig_vel state, 4 floats per particle
+	/// @return false if the file cannot be written
+	static bool write( const char *filename, header h, const float *pos, const float *vel,
+			   const float *orig_vel );
+
+	/// Maps a checkpoint
+	/// @arg filename input file
+	/// @return false if it is not a checkpoint of this version
+	bool open( const char *filename );
+
+	/// Unmaps the file, invalidating the arrays
+	void close( void );
+
+	/// Header of the mapped checkpoint
+	const header& info( void ) const { return *(const header*)data; }
+
+	/// Mapped arrays, 4 floats per particle
+	const float* positions( void ) const { return array(0); }
+	const float* velocities( void ) const { return array(1); }
+	const float* original_velocities( void ) const { return array(2); }
+
+private:
+
+	particleCheckpoint( const particleCheckpoint& );
+	particleCheckpoint& operator = ( const particleCheckpoint& );
+
+	const float* array( int k ) const { return (const float*)(data + info().offsets[k]); }
+
+	const unsigned char *data; ///< Mapped file
+	size_t length; ///< File bytes
+
+};
+
+#endif
@@ -0,0 +1,84 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  meshCache.h -- Models of the shaders examples kept in buffer objects
+ *
+ **/
+
+#ifndef __MESH__CACHE__
+#define __MESH__CACHE__
+
+#include <vector>
+
+#include "glslKernel.h"
+
+///
+/// Models drawn by the shaders examples, tessellated once on the CPU
+/// into an interleaved vertex buffer and an index buffer each, so a
+/// frame draws a model with one glDrawElements instead of sending its
+/// vertices again through immediate mode. The vertices feed the fixed
+/// attributes the shaders read: position, normal, texture coordinates
+/// in unit 0, and the tangent of the normal map in unit 1, the
+/// handedness of the bitangent in its w
+///
+class meshCache {
+
+public:
+
+	/// Models, in the order of the model key of the shaders examples
+	enum model { SPHERE, TEAPOT, QUAD, NUM_MODELS };
+
+	meshCache ();
+
+	/// Tessellates the models and uploads them, the context being current
+	void build (void);
+
+	/// Tells whether the models are uploaded
+	bool built (void) const { return meshes[0].vbo != 0; }
+
+	/// Draws a model
+	/// @arg m model to draw
+	void draw (int m) const;
+
+	/// Number of triangles of a model
+	/// @arg m model
+	GLuint triangles (int m) const { return meshes[m].count / 3; }
+
+	/// Deletes the buffers
+	void clear (void);
+
+private:
+
+	/// Interleaved vertex
+	struct vertex {
+		GLfloat position[3], normal[3], texCoord[2], tangent[4];
+	};
+
+	/// Buffers of a model and its number of indices
+	struct mesh {
+		GLuint vbo, ibo;
+		GLsizei count;
+	};
+
+	/// Sphere of radius 1 around z, as gluSphere with slices x stacks
+	static void sphere (GLuint slices, GLuint stacks, std::vector< vertex >& vertices, std::vector< GLuint >& indices);
+
+	/// Newell teapot of size 1, as glutSolidTeapot, grid x grid quads a patch
+	static void teapot (GLuint grid, std::vector< vertex >& vertices, std::vector< GLuint >& indices);
+
+	/// Unit square on the z = 0 plane facing +z
+	static void quad (std::vector< vertex >& vertices, std::vector< GLuint >& indices);
+
+	/// Two counterclockwise triangles a quad of a grid of rows of
+	/// columns + 1 vertices from first
+	static void grid (GLuint first, GLuint columns, GLuint rows, std::vector< GLuint >& indices);
+
+	/// Uploads a model
+	void upload (int m, const std::vector< vertex >& vertices, const std::vector< GLuint >& indices);
+
+	mesh meshes[NUM_MODELS];
+
+};
+
+#endif
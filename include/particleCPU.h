@@ -0,0 +1,81 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleCPU.h -- CPU reference implementation of compute.frag
+ *
+ **/
+
+#ifndef __PARTICLE__CPU__
+#define __PARTICLE__CPU__
+
+#include <vector>
+
+#include "threadPool.h"
+#include "particleStats.h"
+
+///
+/// Particle update of compute.frag on the CPU: the state is kept as
+/// structure-of-arrays float buffers, updated with AVX2 or SSE2 when the
+/// compiler targets them, and split across a thread pool
+///
+class particleCPU {
+
+public:
+
+	/// Constructor
+	/// @arg threads number of threads (0 for one per core)
+	particleCPU( unsigned threads = 0 ) : pool(threads), numParticles(0) { }
+
+	/// Number of particles
+	size_t size( void ) const { return numParticles; }
+
+	/// Number of threads used by compute
+	unsigned threads( void ) const { return pool.size(); }
+
+	/// Instruction set used by compute ("avx2", "sse2" or "scalar")
+	static const char* simd_name( void );
+
+	/// Sets the state from the texture layout: 4 floats per particle,
+	/// position with the particle id in w and velocity with 1 in w
+	/// @arg n number of particles
+	/// @arg pos, vel current position and velocity
+	/// @arg orig_vel velocities given on reset
+	void set_state( size_t n, const float *pos, const float *vel, const float *orig_vel );
+
+	/// Gets the state in the texture layout of set_state
+	/// @arg pos, vel output, 4 floats per particle
+	/// @arg orig_vel output of the original velocities, or 0 to skip
+	void get_state( float *pos, float *vel, float *orig_vel = 0 ) const;
+
+	/// Runs one step, the same as one compute pass of compute.frag with
+	/// an identity modelview
+	/// @arg time_step integration step
+	/// @arg step particles with an index above step are reset
+	/// @arg gravity gravity vector
+	void compute( float time_step, int step, const float gravity[3] );
+
+	/// Reduces the state to its statistics, as reduce.comp does on the
+	/// GPU, with the instruction set of compute
+	/// @arg stats output
+	void reduce( particleStats& stats ) const;
+
+private:
+
+	friend class particleGridCPU;
+
+	/// Runs one step over particles [begin,end)
+	void compute_range( size_t begin, size_t end, float time_step,
+			    int step, const float gravity[3] );
+
+	threadPool pool;
+
+	size_t numParticles;
+
+	std::vector< float > px, py, pz, id; ///< Positions and particle ids
+	std::vector< float > vx, vy, vz; ///< Velocities
+	std::vector< float > ox, oy, oz; ///< Original velocities
+
+};
+
+#endif
@@ -0,0 +1,140 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleCompute.h -- Compute shader particle engine
+ *
+ **/
+
+#ifndef __PARTICLE__COMPUTE__
+#define __PARTICLE__COMPUTE__
+
+#include "particleEngine.h"
+#include "particleReduction.h"
+#include "particleGridGPU.h"
+#include "particleEmitters.h"
+#include "particleSystems.h"
+
+///
+/// Particle engine keeping the state in shader storage buffers: each step
+/// is one dispatch of particles.comp, one invocation per particle, doing
+/// the update, collision and reset of compute.frag. Optionally close
+/// particles push each other apart, found either by walking all particles
+/// in tiles staged through the shared memory of the work group, or by a
+/// neighbour grid rebuilt before each update. With emitters, particles
+/// are born and die instead of being reset. With systems, the particles
+/// are split between independent effects advanced in the same dispatch.
+/// The integrator is selectable, and the energy drift it causes can be
+/// summed on the GPU. Needs OpenGL 4.3
+///
+class particleCompute : public particleEngine {
+
+public:
+
+	particleCompute ();
+
+	const char* name (void) const { return "compute"; }
+
+	bool install (bool debug);
+
+	void set_state (GLuint n, const GLfloat *pos, const GLfloat *vel, const GLfloat *orig_vel);
+
+	void get_state (GLfloat *pos, GLfloat *vel, GLfloat *orig_vel);
+
+	void clear (void);
+
+	void compute_steps (GLfloat time_step, GLint step, const GLfloat gravity[3], GLuint count);
+
+	void draw (GLfloat alpha);
+
+	void draw_sprites (particleSprites& sprites, GLfloat alpha);
+
+	void copy_positions (GLuint buffer);
+
+	GLuint positions_stride (void) const { return 8; }
+
+	GLuint velocities_offset (void) const { return 4; }
+
+	/// One invocation per particle, in the work groups of one dispatch
+	GLuint max_particles (void) const;
+
+	/// Sets the work group size, which is also the neighbour tile size,
+	/// applied on install and clamped to the board limits
+	/// @arg size invocations per work group
+	void set_group_size (GLuint size) { groupSize = size; }
+
+	/// Work group size
+	GLuint group_size (void) const { return groupSize; }
+
+	/// Neighbour search of the particle collisions
+	enum neighbourMode { NEIGHBOURS_NONE, NEIGHBOURS_TILES, NEIGHBOURS_GRID };
+
+	/// Sets the neighbour search, applied on install
+	/// @arg mode none, all pairs in shared memory tiles or grid
+	void set_neighbours (neighbourMode mode) { neighbours = mode; }
+
+	/// Sets the collision parameters
+	/// @arg r particles closer than r push each other
+	/// @arg k push stiffness
+	void set_neighbour_params (GLfloat r, GLfloat k) { radius = r; stiffness = k; grid.set_params(r, k); }
+
+	/// Sets the emitters giving birth to the particles, applied on install;
+	/// the state then marks the dead particles with a negative position w
+	/// @arg e emitters, or 0 for the reset of compute.frag
+	void set_emitters (particleEmitters *e) { emitters = e; }
+
+	/// Sets the systems the particles are split between, applied on
+	/// install; they run without emitters or collisions
+	/// @arg s systems, or 0 for one system filling the box
+	void set_systems (particleSystems *s) { systems = s; }
+
+	/// Integrators of particles.comp: explicit Euler, the symplectic Euler
+	/// of compute.frag, velocity Verlet and RK4
+	enum integrator { INTEGRATOR_EULER, INTEGRATOR_SYMPLECTIC, INTEGRATOR_VERLET, INTEGRATOR_RK4,
+			  NUM_INTEGRATORS };
+
+	/// Sets the integrator, applied on install; systems have their own
+	/// @arg method integrator of the particles
+	void set_integrator (integrator method) { integratorMode = method; }
+
+	/// Sets the energy drift diagnostic, applied on install
+	/// @arg on sums the energy change of the particles in flight
+	void set_energy_check (bool on) { energyCheck = on; }
+
+	/// Energy drift since the last call, summed on the GPU over the
+	/// particles: the energy the integrator gained in flight, away from
+	/// the walls and resets. 0 without the diagnostic
+	GLdouble energy_drift (void);
+
+	/// Neighbour grid over the current state, built with NEIGHBOURS_GRID
+	particleGrid& neighbour_grid (void) { grid.bind_state(ssbo_state[curr], numParticles); return grid; }
+
+private:
+
+	glslKernel computeShader; ///< Particle update, particles.comp
+	glslKernel displayShader; ///< Points from the state buffer
+
+	/// State is double-buffered: each step reads buffer [curr] and writes
+	/// buffer [1-curr], then the buffers swap. Particles are interleaved,
+	/// position (id in w) then velocity, 8 floats each as in the feedback
+	/// engine, so the state buffer is also drawn as a vertex array
+	GLuint ssbo_state[2]; ///< Ping-pong state buffers
+	GLuint ssbo_originalVelocity; ///< Read-only initial velocities, 4 floats each
+	int curr; ///< State buffer holding the current step
+
+	GLuint groupSize; ///< Invocations per work group
+	GLuint maxGroups; ///< Work groups of a dispatch, queried on install
+	neighbourMode neighbours; ///< Neighbour search
+	GLfloat radius, stiffness; ///< Collision parameters
+	particleGridGPU grid; ///< Neighbour grid with NEIGHBOURS_GRID
+	particleEmitters *emitters; ///< Emitters, 0 to reset the particles
+	particleSystems *systems; ///< Systems, 0 for one system
+	integrator integratorMode; ///< Integrator without systems
+	bool energyCheck; ///< Energy drift diagnostic
+
+	GLuint ssbo_energy; ///< Energy change of each particle in flight, with the diagnostic
+	particleReduction energySum; ///< Sum of the energy changes
+
+};
+
+#endif
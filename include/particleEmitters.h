@@ -0,0 +1,114 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleEmitters.h -- Particle emitters of the compute shader engine
+ *
+ **/
+
+#ifndef __PARTICLE__EMITTERS__
+#define __PARTICLE__EMITTERS__
+
+#include <vector>
+
+#include "glslKernel.h"
+
+///
+/// Emitters giving birth to the particles of the compute engine, which
+/// then live for a while instead of looping through the reset of
+/// compute.frag. Dead particles have a position w of -1 and their index
+/// in a dead list kept on the GPU: the update pushes the particles that
+/// die with an atomic counter, and the spawn pass of emitters.comp pops
+/// the particles born in a step from its top. The CPU only turns the
+/// emitter rates into a number of births per step.
+///
+/// Live particles keep the emitter index over the number of particles
+/// in the position w, so the display colors them by emitter, and their
+/// remaining life in the velocity w
+///
+class particleEmitters {
+
+public:
+
+	/// Shape the particles are born on
+	enum shape { EMITTER_POINT, EMITTER_SPHERE, EMITTER_MESH };
+
+	/// Emitter description. A particle is born with velocity + speed
+	/// along the normal of its birth point + spread in a random
+	/// direction; the normal of a point emitter is a random direction
+	struct emitter {
+		shape type;
+		GLfloat center[3]; ///< Point, sphere center or mesh offset
+		GLfloat radius; ///< Sphere radius
+		GLfloat velocity[3]; ///< Mean velocity
+		GLfloat speed; ///< Speed along the normal
+		GLfloat spread; ///< Speed in a random direction
+		GLfloat rate; ///< Births per second of simulation
+		GLfloat life; ///< Seconds a particle lives
+		GLuint firstTriangle, numTriangles; ///< Mesh triangles
+	};
+
+	particleEmitters ();
+
+	/// Adds an emitter; meshes are added with add_mesh
+	/// @arg e emitter description
+	/// @return emitter index
+	int add (const emitter& e);
+
+	/// Adds a mesh surface emitter, particles are spread evenly over the
+	/// surface area
+	/// @arg e emitter description, the triangle range is filled in
+	/// @arg vertices 3 floats per vertex
+	/// @arg indices 3 vertex indices per triangle
+	/// @arg num_triangles number of triangles
+	/// @return emitter index
+	int add_mesh (emitter e, const GLfloat *vertices, const GLuint *indices, GLuint num_triangles);
+
+	/// Number of emitters
+	GLuint size (void) const { return emitters.size(); }
+
+	/// Builds the passes of emitters.comp and uploads the emitters
+	/// @arg debug flags the debug information output
+	/// @arg group_size invocations per work group
+	void install (bool debug, GLuint group_size);
+
+	/// Rebuilds the dead list from a state, the particles with a negative
+	/// position w being dead
+	/// @arg n number of particles
+	/// @arg pos positions, 4 floats per particle
+	void set_state (GLuint n, const GLfloat *pos);
+
+	/// Gives birth to the particles of one step in a state buffer
+	/// @arg state state buffer of the compute engine
+	/// @arg time_step integration step
+	void spawn (GLuint state, GLfloat time_step);
+
+	/// Binds the dead list for the update of particles.comp
+	void bind_dead_list (void);
+
+	/// Deletes the emitter buffers
+	void clear (void);
+
+private:
+
+	/// Passes of emitters.comp, by PASS define
+	enum { PASS_SPAWN, PASS_COMMIT, NUM_PASSES };
+
+	glslKernel passes[NUM_PASSES];
+
+	GLuint groupSize; ///< Invocations per work group
+
+	std::vector< emitter > emitters;
+	std::vector< GLfloat > due; ///< Births owed to each emitter, fractional
+
+	/// Mesh triangles, 3 vertices of 4 floats each, the w of the first
+	/// one being the share of the mesh area up to the triangle
+	std::vector< GLfloat > triangles;
+
+	GLuint numParticles; ///< Particles of the dead list
+	GLuint serial; ///< Births so far, seeds the random numbers
+	GLuint ssbo_emitters, ssbo_triangles, ssbo_dead;
+
+};
+
+#endif
@@ -0,0 +1,123 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleEngine.h -- Interface of the GPU particle engines
+ *
+ **/
+
+#ifndef __PARTICLE__ENGINE__
+#define __PARTICLE__ENGINE__
+
+#include "glslKernel.h"
+#include "particleSprites.h"
+
+class particleSDF;
+
+///
+/// A GPU particle engine keeps the particle state in its own OpenGL
+/// objects and runs the update of compute.frag on it. The state crosses
+/// engines in the texture layout: 4 floats per particle, position with
+/// the particle id (index over count) in w and velocity with 1 in w.
+///
+class particleEngine {
+
+public:
+
+	particleEngine () : numParticles(0), sdf(0) { }
+
+	virtual ~particleEngine () { }
+
+	/// Engine name
+	virtual const char* name (void) const = 0;
+
+	/// Builds the shaders of the engine
+	/// @arg debug flags the debug information output
+	/// @return false if the engine cannot run in the current context
+	virtual bool install (bool debug) = 0;
+
+	/// Number of particles
+	GLuint size (void) const { return numParticles; }
+
+	/// Sets the mesh the particles collide with, applied on install; its
+	/// field must be baked before the first step
+	/// @arg s signed distance field, or 0 for the box only
+	void set_sdf (particleSDF *s) { sdf = s; }
+
+	/// Replaces the state, reallocating the engine objects
+	/// @arg n number of particles
+	/// @arg pos, vel current position and velocity
+	/// @arg orig_vel velocities given on reset
+	virtual void set_state (GLuint n, const GLfloat *pos, const GLfloat *vel,
+				const GLfloat *orig_vel) = 0;
+
+	/// Reads the state back in the layout of set_state
+	/// @arg pos, vel, orig_vel output, or 0 to skip
+	virtual void get_state (GLfloat *pos, GLfloat *vel, GLfloat *orig_vel) = 0;
+
+	/// Deletes the engine objects
+	virtual void clear (void) = 0;
+
+	/// Runs one step
+	/// @arg time_step integration step
+	/// @arg step particles with an index above step are reset
+	/// @arg gravity gravity vector
+	void compute (GLfloat time_step, GLint step, const GLfloat gravity[3]) {
+		compute_steps(time_step, step, gravity, 1);
+	}
+
+	/// Runs several steps in one submission, setting the pipeline up once
+	/// @arg time_step integration step
+	/// @arg step step of the first one, the next ones count up from it
+	/// wrapping at the number of particles
+	/// @arg gravity gravity vector
+	/// @arg count number of steps
+	virtual void compute_steps (GLfloat time_step, GLint step, const GLfloat gravity[3],
+				    GLuint count) = 0;
+
+	/// Draws the particles as points straight from the engine state, with
+	/// the current matrices and point size. The state of the step before
+	/// is kept by the ping-pong buffers, so positions are blended between
+	/// both; particles reset in the last step are drawn where they are
+	/// @arg alpha 0 draws the step before, 1 the current step
+	virtual void draw (GLfloat alpha) = 0;
+
+	/// Draws the particles as sprites straight from the engine state, in
+	/// one instanced draw, blended between the steps as in draw
+	/// @arg sprites sprite renderer
+	/// @arg alpha 0 draws the step before, 1 the current step
+	virtual void draw_sprites (particleSprites& sprites, GLfloat alpha) = 0;
+
+	/// Queues a copy of the current positions and velocities into a
+	/// buffer object, on the GPU and without waiting for it
+	/// @arg buffer destination, at least copy_floats() floats
+	virtual void copy_positions (GLuint buffer) = 0;
+
+	/// Floats from one particle to the next in copy_positions, the first
+	/// 4 being the position with the particle id in w
+	virtual GLuint positions_stride (void) const { return 4; }
+
+	/// Floats from the start of the copy to the velocity of the first
+	/// particle, the velocities being as far apart as the positions; by
+	/// default they follow all the positions
+	virtual GLuint velocities_offset (void) const { return 4*numParticles; }
+
+	/// Floats written by copy_positions
+	GLuint copy_floats (void) const { return 8*numParticles; }
+
+	/// Bytes of state kept per particle: position, velocity and original
+	/// velocity, 4 floats each
+	virtual GLuint state_bytes (void) const { return 48; }
+
+	/// Largest number of particles set_state takes, known after install;
+	/// by default the state must fit in 2GB
+	virtual GLuint max_particles (void) const { return 0x7fffffffu / state_bytes(); }
+
+protected:
+
+	GLuint numParticles; ///< Number of particles
+	particleSDF *sdf; ///< Mesh to collide with, 0 for none
+
+};
+
+#endif
@@ -0,0 +1,62 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleFeedback.h -- Transform feedback particle engine
+ *
+ **/
+
+#ifndef __PARTICLE__FEEDBACK__
+#define __PARTICLE__FEEDBACK__
+
+#include "particleEngine.h"
+
+///
+/// Particle engine keeping the state in vertex buffers: each step draws
+/// the particles as points through feedback.vert with rasterization off,
+/// capturing position and velocity into the other buffer of a ping-pong
+/// pair, which is then drawn directly as a point buffer
+///
+class particleFeedback : public particleEngine {
+
+public:
+
+	particleFeedback ();
+
+	const char* name (void) const { return "feedback"; }
+
+	bool install (bool debug);
+
+	void set_state (GLuint n, const GLfloat *pos, const GLfloat *vel, const GLfloat *orig_vel);
+
+	void get_state (GLfloat *pos, GLfloat *vel, GLfloat *orig_vel);
+
+	void clear (void);
+
+	void compute_steps (GLfloat time_step, GLint step, const GLfloat gravity[3], GLuint count);
+
+	void draw (GLfloat alpha);
+
+	void draw_sprites (particleSprites& sprites, GLfloat alpha);
+
+	void copy_positions (GLuint buffer);
+
+	GLuint positions_stride (void) const { return 8; }
+
+	GLuint velocities_offset (void) const { return 4; }
+
+private:
+
+	glslKernel computeShader; ///< Particle update captured by transform feedback
+	glslKernel displayShader; ///< Points from the state buffer
+
+	/// State is double-buffered: each step reads buffer [curr] and
+	/// captures into buffer [1-curr], then the buffers swap. Particles
+	/// are interleaved, position (id in w) then velocity, 8 floats each
+	GLuint vbo_state[2]; ///< Ping-pong state buffers
+	GLuint vbo_originalVelocity; ///< Read-only initial velocities, 4 floats each
+	int curr; ///< State buffer holding the current step
+
+};
+
+#endif
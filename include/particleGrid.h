@@ -0,0 +1,98 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleGrid.h -- Interface of the particle neighbour grids
+ *
+ **/
+
+#ifndef __PARTICLE__GRID__
+#define __PARTICLE__GRID__
+
+///
+/// Uniform grid over the [-1,1]^3 box for particle-particle collisions,
+/// rebuilt each step by a counting sort of the particles by cell. Cells
+/// are at least the interaction radius wide, so the neighbours of a
+/// particle are in the 27 cells around its own. Cells are hashed into a
+/// power of two table of about one bucket per particle, with the start
+/// and end of each bucket in the sorted order; a bucket may hold several
+/// cells, told apart by the cell key kept for each sorted particle. Only
+/// the row (y and z) is hashed and x is added to it, so the three cells of
+/// a row around a particle are consecutive buckets, one sorted range.
+///
+/// Particles waiting to be reset (index above step) sit at the origin,
+/// they are left out of the grid and collide with nothing.
+///
+class particleGrid {
+
+public:
+
+	particleGrid () : radius(0.02f), stiffness(1.0f), side(1), tableSize(0) { }
+
+	virtual ~particleGrid () { }
+
+	/// Grid name
+	virtual const char* name (void) const = 0;
+
+	/// Sets the collision parameters
+	/// @arg r particles closer than r push each other, also the cell size
+	/// @arg k push stiffness
+	void set_params (float r, float k) { radius = r; stiffness = k; }
+
+	/// Interaction radius
+	float interaction_radius (void) const { return radius; }
+
+	/// Rebuilds the grid from the current positions
+	/// @arg step particles with an index above step are left out
+	virtual void build (int step) = 0;
+
+	/// Pushes the particles closer than the radius apart, adding
+	/// stiffness*push*time_step to the velocities, where the push sums
+	/// d/r*(1-r/radius)^2 over the neighbours at distance r along d
+	/// @arg time_step integration step
+	virtual void collide (float time_step) = 0;
+
+	/// Cells per side of the grid
+	unsigned cells_per_side (void) const { return side; }
+
+	/// Number of buckets of the hash table
+	unsigned table_size (void) const { return tableSize; }
+
+protected:
+
+	/// Sets the grid size for the radius and n particles
+	void resize (unsigned n) {
+
+		side = (unsigned)(2.0f / radius);
+		if (side < 1) side = 1;
+		if (side > 1024) side = 1024;
+
+		for (tableSize = 64; tableSize < n; tableSize *= 2) ;
+
+	}
+
+	/// Cell coordinate of a position coordinate
+	unsigned cell (float p) const {
+
+		int c = (int)((p + 1.0f) * 0.5f * side);
+		return c < 0 ? 0 : (c >= (int)side ? side - 1 : c);
+
+	}
+
+	/// Key of a cell, unique over the grid
+	unsigned cell_key (unsigned x, unsigned y, unsigned z) const { return x + side*(y + side*z); }
+
+	/// Bucket of a cell, the same hash as grid.comp
+	unsigned bucket (unsigned x, unsigned y, unsigned z) const {
+
+		return (((y*19349663u) ^ (z*83492791u)) + x) & (tableSize - 1);
+
+	}
+
+	float radius, stiffness; ///< Collision parameters
+	unsigned side; ///< Cells per side
+	unsigned tableSize; ///< Hash table buckets, a power of two
+
+};
+
+#endif
@@ -0,0 +1,55 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleGridCPU.h -- Neighbour grid of the CPU particle backend
+ *
+ **/
+
+#ifndef __PARTICLE__GRID__CPU__
+#define __PARTICLE__GRID__CPU__
+
+#include <vector>
+
+#include "particleGrid.h"
+#include "particleCPU.h"
+
+///
+/// Neighbour grid over the state of a particleCPU, on its thread pool.
+/// The counting sort gives each thread a slice of the particles with its
+/// own bucket counts, so the sorted order is the same for any number of
+/// threads; the sorted positions are copied out with their cell keys, so
+/// each neighbour candidate of the collision scan is one cache line
+///
+class particleGridCPU : public particleGrid {
+
+public:
+
+	/// Constructor
+	/// @arg cpu particles of the grid
+	particleGridCPU( particleCPU& cpu ) : particles(cpu) { }
+
+	const char* name( void ) const { return "cpu"; }
+
+	void build( int step );
+
+	void collide( float time_step );
+
+private:
+
+	particleCPU& particles;
+
+	static const unsigned INACTIVE = ~0u; ///< Key of the particles left out
+
+	std::vector< unsigned > key, slot; ///< Cell key and bucket of each particle
+	std::vector< unsigned > counts; ///< Bucket counts of each thread slice, then their offsets
+	std::vector< unsigned > cellRange; ///< Sorted range of each bucket, start and end side by side
+	/// Position and cell key of a sorted particle
+	struct sortedParticle { float x, y, z; unsigned key; };
+
+	std::vector< sortedParticle > sorted; ///< Particles in bucket order
+	std::vector< unsigned > sortedIndex; ///< Index of each sorted particle
+
+};
+
+#endif
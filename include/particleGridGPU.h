@@ -0,0 +1,71 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleGridGPU.h -- Neighbour grid of the compute shader engine
+ *
+ **/
+
+#ifndef __PARTICLE__GRID__GPU__
+#define __PARTICLE__GRID__GPU__
+
+#include "glslKernel.h"
+#include "particleGrid.h"
+
+///
+/// Neighbour grid over a state buffer of the compute engine, built by
+/// the passes of grid.comp: clear the bucket counts, count with atomics,
+/// scan the counts in one work group and scatter the particle indices.
+/// The order inside a bucket follows the atomics, so sums over the
+/// neighbours may differ in the last bits from run to run
+///
+class particleGridGPU : public particleGrid {
+
+public:
+
+	particleGridGPU ();
+
+	const char* name (void) const { return "gpu"; }
+
+	/// Builds the passes of grid.comp
+	/// @arg debug flags the debug information output
+	/// @arg group_size invocations per work group
+	/// @arg emitters leaves the dead particles of the emitters out of the
+	/// grid, instead of the particles waiting to be reset
+	void install (bool debug, GLuint group_size, bool emitters = false);
+
+	/// Sets the state buffer the grid works on, in the layout of
+	/// particleCompute, before build and collide
+	/// @arg buffer state buffer
+	/// @arg n number of particles
+	void bind_state (GLuint buffer, GLuint n) { stateBuffer = buffer; numParticles = n; }
+
+	void build (int step);
+
+	void collide (float time_step);
+
+	/// Deletes the grid buffers
+	void clear (void);
+
+private:
+
+	/// Dispatches one pass over count items
+	void dispatch (glslKernel& pass, GLuint count);
+
+	/// Passes of grid.comp, by PASS define
+	enum { PASS_CLEAR, PASS_COUNT, PASS_SCAN, PASS_SCATTER, PASS_COLLIDE, NUM_PASSES };
+
+	glslKernel passes[NUM_PASSES];
+
+	GLuint groupSize; ///< Invocations per work group
+	bool emitterMode; ///< Particles of emitters
+
+	GLuint stateBuffer, numParticles; ///< Particles of the grid
+
+	/// Grid buffers, sized for capacity particles and capacityTable buckets
+	GLuint ssbo_key, ssbo_sorted, ssbo_cellStart, ssbo_cellEnd;
+	GLuint capacity, capacityTable;
+
+};
+
+#endif
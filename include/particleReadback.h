@@ -0,0 +1,103 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleReadback.h -- Asynchronous readback of the particle positions
+ *
+ **/
+
+#ifndef __PARTICLE__READBACK__
+#define __PARTICLE__READBACK__
+
+#include <vector>
+#include <functional>
+
+#include "particleEngine.h"
+
+///
+/// Reads the positions of a particle engine back to the CPU without
+/// stalling: each frame the positions are copied on the GPU into the next
+/// buffer of a ring, behind a fence, and the frames whose fence has
+/// passed are mapped and handed to the consumers. With the default ring
+/// of 3 buffers the positions of frame N are consumed at frame N+2; the
+/// CPU only waits when the GPU falls more frames behind than the ring
+///
+class particleReadback {
+
+public:
+
+	/// Positions of one frame straight from the mapped buffer, valid only
+	/// while the consumer runs
+	struct view {
+		const GLfloat *positions; ///< Particle i at positions[i*stride], id in w
+		const GLfloat *velocities; ///< Particle i at velocities[i*stride]
+		GLuint count; ///< Number of particles
+		GLuint stride; ///< Floats from one particle to the next
+		GLuint frame; ///< Frame the positions were queued in
+	};
+
+	typedef std::function< void (const view&) > consumer;
+
+	/// Constructor
+	/// @arg depth buffers in the ring, frames in flight
+	particleReadback (GLuint depth = 3);
+
+	/// Tells whether the current context has fences and buffer copies
+	static bool supported (void);
+
+	/// Registers a consumer of the positions
+	/// @arg c called with each frame read back, in frame order
+	/// @return id for remove_consumer
+	int add_consumer (const consumer& c);
+
+	/// Unregisters a consumer
+	/// @arg id returned by add_consumer
+	void remove_consumer (int id);
+
+	/// Queues the current positions of the engine, after handing the
+	/// frames already read back to the consumers
+	/// @arg engine particles to read
+	void queue (particleEngine& engine);
+
+	/// Hands the frames read back so far to the consumers, oldest first
+	/// @arg wait waits for all the queued frames
+	void poll (bool wait = false);
+
+	/// Frames queued and not yet consumed
+	GLuint pending (void) const { return numPending; }
+
+	/// Times queue had to wait for a full ring
+	GLuint stalls (void) const { return numStalls; }
+
+	/// Frames lost because their buffer could not be mapped
+	GLuint dropped (void) const { return numDropped; }
+
+	/// Frames queued so far, the frame of the next one queued
+	GLuint frames (void) const { return numFrames; }
+
+	/// Drops the queued frames and deletes the buffers
+	void clear (void);
+
+private:
+
+	/// Buffer of the ring with the frame copied into it
+	struct slot {
+		GLuint buffer; ///< Buffer object
+		GLsizeiptr capacity; ///< Bytes allocated
+		GLsync fence; ///< Signaled when the copy is done
+		GLuint count, stride, offset, frame; ///< Frame in the buffer, velocities at offset
+	};
+
+	/// Maps the oldest queued frame, hands it to the consumers and frees it
+	void consume (void);
+
+	std::vector< slot > ring; ///< Ring of buffers
+	GLuint head, numPending; ///< Next slot to write, frames in flight
+	GLuint numFrames, numStalls, numDropped; ///< Frames queued, waits on a full ring, frames lost
+
+	std::vector< std::pair< int, consumer > > consumers; ///< Consumers by id
+	int nextId; ///< Id of the next consumer
+
+};
+
+#endif
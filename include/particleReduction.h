@@ -0,0 +1,93 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleReduction.h -- Particle statistics reduced on the GPU
+ *
+ **/
+
+#ifndef __PARTICLE__REDUCTION__
+#define __PARTICLE__REDUCTION__
+
+#include "particleEngine.h"
+#include "particleStats.h"
+
+///
+/// Reduces the state of a particle engine to its statistics on the GPU,
+/// whatever the engine: the positions and velocities are copied as for
+/// the readback, then the passes of reduce.comp combine them in a tree,
+/// each work group leaving one result for the next pass. Only the last result,
+/// 64 bytes, reaches the CPU, copied behind a fence and read once the
+/// GPU is done, so the CPU does not wait. The same tree also sums plain
+/// values, as the energy changes of the compute engine. Needs OpenGL 4.3
+///
+class particleReduction {
+
+public:
+
+	particleReduction ();
+
+	/// Tells whether the current context has compute shaders, fences
+	/// and buffer copies
+	static bool supported (void);
+
+	/// Builds the passes of reduce.comp
+	/// @arg debug flags the debug information output
+	/// @arg group_size invocations per work group, clamped to the board
+	void install (bool debug, GLuint group_size);
+
+	/// Queues the reduction of the current state of an engine, unless
+	/// the one before is still in flight
+	/// @arg engine particles to reduce
+	/// @return false when skipped
+	bool queue (particleEngine& engine);
+
+	/// Reads the result of the queued reduction when the GPU is done
+	/// @arg wait waits for it
+	/// @return true when a new result was read
+	bool poll (bool wait = false);
+
+	/// Sums values on the GPU, reading the sum right away, and clears
+	/// them to zero in the same pass
+	/// @arg buffer storage buffer of n floats
+	/// @arg n number of values
+	GLfloat sum_and_clear (GLuint buffer, GLuint n);
+
+	/// Last result read
+	const particleStats& stats (void) const { return latest; }
+
+	/// Deletes the buffers
+	void clear (void);
+
+private:
+
+	/// Passes of reduce.comp, by PASS define
+	enum { PASS_PARTICLES, PASS_RESULTS, PASS_VALUES, NUM_PASSES };
+
+	/// Grows the results of the groups for n values
+	void reserve (GLuint n);
+
+	/// Runs the passes of the tree until one result is left
+	/// @arg from buffer of the first pass
+	/// @arg n values in it
+	/// @arg pass first pass, reading the particles or values
+	/// @return buffer holding the result first
+	GLuint reduce (GLuint from, GLuint n, int pass);
+
+	glslKernel passes[NUM_PASSES];
+
+	GLuint groupSize; ///< Invocations per work group
+	GLuint maxGroups; ///< Work groups of a dispatch, queried on install
+
+	/// Positions copied from the engine, the ping-pong results of the
+	/// groups and the result read back, sized for capacity particles
+	GLuint buffer_state, ssbo_results[2], buffer_result;
+	GLuint capacity, stateCapacity;
+
+	GLsync fence; ///< Signaled when the result is copied, 0 when none is queued
+
+	particleStats latest;
+
+};
+
+#endif
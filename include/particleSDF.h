@@ -0,0 +1,121 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleSDF.h -- Signed distance field of a mesh the particles collide with
+ *
+ **/
+
+#ifndef __PARTICLE__SDF__
+#define __PARTICLE__SDF__
+
+#include <vector>
+
+#include "glslKernel.h"
+#include "threadPool.h"
+
+///
+/// Triangle mesh baked on the CPU into a signed distance field, sampled
+/// by the update of the GPU engines as a 3D texture: particles inside
+/// the mesh are pushed out along the field gradient, and lose their
+/// velocity into it as at the walls of the box.
+///
+/// The field is sampled at the cell centers of a grid over a box, each
+/// sample taking the distance to the closest triangle through a
+/// bounding volume hierarchy; the sign comes from the parity of the
+/// triangles crossed by rays out of the point, the majority of seven
+/// rays deciding, so the holes of meshes that are not closed (the gap
+/// around the lid and the open spout of the teapot) do not flip it. The rows
+/// of the grid are split between the threads of a pool
+///
+class particleSDF {
+
+public:
+
+	particleSDF ();
+
+	/// Reads the triangles of a Wavefront OBJ file: the v and f lines,
+	/// faces of more than three vertices split in fans
+	/// @arg filename mesh file
+	/// @return false if the file cannot be read or has no triangles
+	bool load_obj (const char *filename);
+
+	/// Replaces the mesh
+	/// @arg vertices 3 floats per vertex
+	/// @arg num_vertices number of vertices
+	/// @arg indices 3 vertex indices per triangle
+	/// @arg num_triangles number of triangles
+	void set_mesh (const GLfloat *vertices, GLuint num_vertices, const GLuint *indices, GLuint num_triangles);
+
+	/// Scales and moves the mesh to the largest size fitting a box,
+	/// centered in it
+	/// @arg lo, hi box corners
+	void fit (const GLfloat lo[3], const GLfloat hi[3]);
+
+	/// Number of triangles
+	GLuint triangles (void) const { return indices.size() / 3; }
+
+	/// Samples the field over a box and uploads it as a 3D texture, the
+	/// mesh being set
+	/// @arg resolution samples along each axis
+	/// @arg lo, hi box corners
+	/// @arg pool threads sharing the samples
+	void bake (GLuint resolution, const GLfloat lo[3], const GLfloat hi[3], threadPool& pool);
+
+	/// Milliseconds taken by the last bake
+	double bake_time (void) const { return bakeTime; }
+
+	/// Samples along each axis, 0 before the bake
+	GLuint size (void) const { return resolution; }
+
+	/// Signed distance at a sample, negative inside the mesh
+	/// @arg x, y, z sample index along each axis
+	GLfloat distance (GLuint x, GLuint y, GLuint z) const { return field[(z*resolution + y)*resolution + x]; }
+
+	/// Binds the field to the sdfTex sampler of a kernel in use, with its
+	/// box in the sdfMin and sdfMax uniforms
+	/// @arg kernel update of an engine, built with SDF defined
+	void bind (glslKernel& kernel);
+
+	/// Deletes the texture
+	void clear (void);
+
+private:
+
+	/// Node of the hierarchy: the box of its triangles, and either two
+	/// children at first and first + 1 (count 0) or count triangles of
+	/// the order from first
+	struct node {
+		GLfloat lo[3], hi[3];
+		GLuint first, count;
+	};
+
+	/// Builds a node over order[begin,end) and its children
+	void build (GLuint index, GLuint begin, GLuint end);
+
+	/// Squared distance from a point to the closest triangle
+	GLfloat closest (const GLfloat p[3]) const;
+
+	/// Number of triangles a ray crosses
+	/// @arg p ray origin
+	/// @arg d ray direction
+	GLuint crossings (const GLfloat p[3], const GLfloat d[3]) const;
+
+	/// Signed distance at a point
+	GLfloat signed_distance (const GLfloat p[3]) const;
+
+	std::vector< GLfloat > vertices; ///< 3 floats per vertex
+	std::vector< GLuint > indices; ///< 3 vertex indices per triangle
+	std::vector< GLuint > order; ///< Triangles in the order of the leaves
+	std::vector< node > nodes; ///< Hierarchy, root first
+
+	std::vector< GLfloat > field; ///< Samples, x fastest
+	GLuint resolution; ///< Samples along each axis
+	GLfloat boxMin[3], boxMax[3]; ///< Box of the field
+	double bakeTime; ///< Milliseconds of the last bake
+
+	GLuint tex_field; ///< 3D texture of the field
+
+};
+
+#endif
@@ -0,0 +1,130 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleSprites.h -- Particle sprites drawn by instancing
+ *
+ **/
+
+#ifndef __PARTICLE__SPRITES__
+#define __PARTICLE__SPRITES__
+
+#include "glslKernel.h"
+#include "radixSort.h"
+
+///
+/// Draws the particles as round camera-facing quads, one instance per
+/// particle in a single instanced draw, so the CPU cost does not grow
+/// with the particles. The engines hand over their state: the state
+/// buffers become per instance attributes, the state textures are
+/// fetched by instance. Color comes from the particle id, size and
+/// opacity from the remaining life of the emitters; sprites are blended
+/// in premultiplied alpha and, when soft, fade where they cross the
+/// scene depth captured before. With compute shaders the sprites can be
+/// drawn back to front: the particle indices are radix sorted by view
+/// depth and the state gathered in that order before the draw
+///
+class particleSprites {
+
+public:
+
+	particleSprites ();
+
+	/// Builds the sprite shaders
+	/// @arg debug flags the debug information output
+	/// @return false without instancing
+	bool install (bool debug);
+
+	/// Sets the sprite half size, in eye space units
+	void set_size (GLfloat s) { spriteSize = s; }
+
+	/// Sets the soft particle fade
+	/// @arg s eye distance over which sprites fade into the scene, 0 for none
+	void set_softness (GLfloat s) { softness = s; }
+
+	/// Soft particle fade distance
+	GLfloat get_softness (void) const { return softness; }
+
+	/// Sorts the sprites back to front, when the sort is supported
+	void set_sorted (bool s) { sortDepth = s; }
+
+	/// Tells whether the sprites are sorted
+	bool sorted (void) const { return sortDepth && sortReady; }
+
+	/// Tells whether the depth sort can run, needs compute shaders
+	bool sort_support (void) const { return sortReady; }
+
+	/// Copies the depth buffer of the viewport for the soft particles,
+	/// after the scene is drawn and before the sprites
+	void capture_depth (void);
+
+	/// Draws sprites from an interleaved state buffer, position then
+	/// velocity, as in the feedback and compute engines
+	/// @arg state current state buffer
+	/// @arg previous state buffer of the step before
+	/// @arg stride bytes per particle
+	/// @arg n number of particles
+	/// @arg alpha 0 draws the step before, 1 the current step
+	void draw_buffers (GLuint state, GLuint previous, GLsizei stride, GLuint n, GLfloat alpha);
+
+	/// Draws sprites from the state textures of the texture engine
+	/// @arg position, previous, velocity state textures
+	/// @arg width, height texture size in texels
+	/// @arg n number of particles
+	/// @arg alpha 0 draws the step before, 1 the current step
+	void draw_textures (GLuint position, GLuint previous, GLuint velocity,
+			    GLuint width, GLuint height, GLuint n, GLfloat alpha);
+
+	/// Deletes the quad, depth texture and sort buffers
+	void clear (void);
+
+private:
+
+	/// Sets the uniforms and blending shared by both sources
+	void begin (glslKernel& shader, GLuint n, GLfloat alpha);
+
+	/// Draws the instances and restores the state
+	void end (GLuint n);
+
+	/// Draws sprites from per instance attributes
+	/// @arg state buffer of the positions and velocities
+	/// @arg previous buffer of the previous positions
+	/// @arg stride bytes per particle in both
+	/// @arg previous_offset offset of the previous positions
+	void draw_instances (GLuint state, GLuint previous, GLsizei stride, GLsizei previous_offset,
+			     GLuint n, GLfloat alpha);
+
+	/// Writes the depth keys of the current view with one pass of
+	/// depthsort.comp, its sources bound, and sorts them
+	void sort_keys (glslKernel& pass, GLuint n);
+
+	/// Gathers the state in depth order with the other pass, its sources
+	/// bound, into the sorted buffer
+	void gather (glslKernel& pass, GLuint n);
+
+	glslKernel bufferShader; ///< Per instance attributes
+	glslKernel textureShader; ///< Texture fetch by instance
+
+	/// Passes of depthsort.comp, by PASS define, for each source
+	enum { PASS_KEYS, PASS_GATHER, NUM_SORT_PASSES };
+	glslKernel bufferSort[NUM_SORT_PASSES], textureSort[NUM_SORT_PASSES];
+
+	radixSort sorter; ///< Sort of the depth keys
+	GLuint groupSize; ///< Invocations per work group of the sort
+
+	/// Depth keys, particle order and state gathered in that order,
+	/// position, velocity and previous position of each, sized for
+	/// sortCapacity particles
+	GLuint ssbo_keys, ssbo_order, ssbo_sorted;
+	GLuint sortCapacity;
+	bool sortDepth, sortReady;
+
+	GLuint vbo_corners; ///< Quad corners, a triangle strip
+	GLuint tex_depth; ///< Scene depth of the soft particles
+	GLint depthWidth, depthHeight; ///< Captured viewport size
+
+	GLfloat spriteSize, softness;
+
+};
+
+#endif
@@ -0,0 +1,36 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleStats.h -- Aggregate statistics of the particles
+ *
+ **/
+
+#ifndef __PARTICLE__STATS__
+#define __PARTICLE__STATS__
+
+///
+/// Minimum, maximum, sum and counts over the live particles, as reduced
+/// by reduce.comp on the GPU or particleCPU::reduce. The layout is the
+/// one of reduce.comp, 4 vectors of 4 floats. Velocities are unknown to
+/// the positions of the texture engine, their terms are 0 then
+///
+struct particleStats {
+
+	float minimum[4]; ///< Bounding box corner, lowest speed in w
+	float maximum[4]; ///< Opposite corner, highest speed in w
+	float sum[4]; ///< Sum of the positions, kinetic energy in w
+	float count[4]; ///< Live particles, particles at a wall of the box
+
+	/// Statistics of no particles: an empty box and zero sums
+	void clear( void ) {
+		for (int c = 0; c < 4; ++c) {
+			minimum[c] = 1e30f;
+			maximum[c] = -1e30f;
+			sum[c] = count[c] = 0.0f;
+		}
+	}
+
+};
+
+#endif
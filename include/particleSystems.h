@@ -0,0 +1,92 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleSystems.h -- Particle systems batched in the compute engine
+ *
+ **/
+
+#ifndef __PARTICLE__SYSTEMS__
+#define __PARTICLE__SYSTEMS__
+
+#include <vector>
+
+#include "glslKernel.h"
+
+///
+/// Independent particle systems sharing the state buffers of the compute
+/// engine: each system owns a consecutive range of the particles and a
+/// row of a parameter table on the GPU, with its gravity, time step,
+/// bounds, reset and integrator. One dispatch of particles.comp advances all the
+/// systems, each invocation finding its system in the table, so adding
+/// effects adds table rows, not passes.
+///
+/// The particles of each system are reset in turn as in compute.frag,
+/// the step counting up within the system
+///
+class particleSystems {
+
+public:
+
+	/// System description
+	struct system {
+		GLfloat share; ///< Relative number of particles
+		GLfloat gravity; ///< Scale of the gravity of the view
+		GLfloat time_scale; ///< Scale of the time step
+		GLfloat boundsMin[3], boundsMax[3]; ///< Box the particles bounce in
+		GLfloat origin[3]; ///< Position the particles are reset to
+		int integrator; ///< Integrator, particleCompute::integrator
+	};
+
+	particleSystems ();
+
+	/// Adds a system
+	/// @arg s system description
+	/// @return system index
+	int add (const system& s);
+
+	/// Number of systems
+	GLuint size (void) const { return systems.size(); }
+
+	/// System description
+	const system& get (int s) const { return systems[s]; }
+
+	/// First particle of a system, the systems splitting n particles by
+	/// their share
+	/// @arg s system index, size() gives n
+	/// @arg n number of particles
+	GLuint first (GLuint s, GLuint n) const;
+
+	/// System of a particle
+	/// @arg i particle index
+	/// @arg n number of particles
+	GLuint system_of (GLuint i, GLuint n) const;
+
+	/// Splits the particles between the systems and uploads the table
+	/// @arg n number of particles
+	void set_state (GLuint n);
+
+	/// Binds the table for the update of particles.comp
+	void bind_table (void);
+
+	/// Advances the reset step of every system after a batch of steps
+	/// @arg count number of steps run
+	void advance (GLuint count);
+
+	/// Deletes the table
+	void clear (void);
+
+private:
+
+	/// Uploads the table, 16 words per system as in particles.comp
+	void upload (void);
+
+	std::vector< system > systems;
+	std::vector< GLuint > steps; ///< Reset step of each system
+
+	GLuint numParticles; ///< Particles split between the systems
+	GLuint ssbo_systems;
+
+};
+
+#endif
@@ -0,0 +1,105 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleTexture.h -- Render-to-texture particle engine
+ *
+ **/
+
+#ifndef __PARTICLE__TEXTURE__
+#define __PARTICLE__TEXTURE__
+
+#include "particleEngine.h"
+
+///
+/// Particle engine keeping the state in float textures: each step draws
+/// a quad over the particle texels with compute.frag writing position
+/// and velocity through a framebuffer. The state can be kept in half
+/// the bytes, see set_precision
+///
+class particleTexture : public particleEngine {
+
+public:
+
+	particleTexture ();
+
+	const char* name (void) const { return "texture"; }
+
+	bool install (bool debug);
+
+	void set_state (GLuint n, const GLfloat *pos, const GLfloat *vel, const GLfloat *orig_vel);
+
+	void get_state (GLfloat *pos, GLfloat *vel, GLfloat *orig_vel);
+
+	void clear (void);
+
+	void compute_steps (GLfloat time_step, GLint step, const GLfloat gravity[3], GLuint count);
+
+	void draw (GLfloat alpha);
+
+	void draw_sprites (particleSprites& sprites, GLfloat alpha);
+
+	void copy_positions (GLuint buffer);
+
+	GLuint state_bytes (void) const;
+
+	/// As many as texels in the largest texture
+	GLuint max_particles (void) const;
+
+	/// Storage of the state textures: 32 bit floats, 16 bit floats, or
+	/// positions in 16 bit normalized integers over the box [-1,1], its
+	/// bounds, with 16 bit float velocities. Below 32 bits the particle
+	/// id is the texel index, no channel holds it
+	enum precision { PRECISION_FLOAT32, PRECISION_FLOAT16, PRECISION_PACKED, NUM_PRECISIONS };
+
+	/// Sets the storage of the state, applied on install
+	/// @arg p precision of the state textures
+	void set_precision (precision p) { statePrecision = p; }
+
+	/// Tells whether the context renders to the state textures of the
+	/// precision set: 16 bit normalized textures need not be renderable
+	bool renderable (void);
+
+	/// Sets the framebuffer bound again after the engine renders to its
+	/// own, the one the caller draws to, so no binding is queried per step
+	/// @arg fb framebuffer of the caller, 0 for the window
+	void set_framebuffer (GLuint fb) { callerFbo = fb; }
+
+	/// State texture width in texels
+	GLuint width (void) const { return tex_width; }
+
+	/// State texture height in texels
+	GLuint height (void) const { return tex_height; }
+
+private:
+
+	/// Creates a state texture
+	GLuint create_texture (const GLfloat *data, GLenum format);
+
+	/// Reads a state texture back, keeping the first numParticles texels
+	void read_texture (GLuint tex, GLfloat *data);
+
+	/// Emits a quad covering texels [x0,x1) x [y0,y1)
+	void draw_quad (GLuint x0, GLuint y0, GLuint x1, GLuint y1);
+
+	glslKernel computeShader; ///< Particle update
+	glslKernel displayShader; ///< Points fetching the position texture
+
+	/// State is double-buffered: each step reads set [curr] and writes
+	/// set [1-curr] through its framebuffer, then the sets swap
+	GLuint tex_position[2], tex_velocity[2], fbo[2]; ///< Ping-pong state sets
+	GLuint tex_originalVelocity; ///< Read-only initial velocities
+	GLuint callerFbo; ///< Framebuffer the caller draws to
+	int curr; ///< State set holding the current step
+	GLuint vbo_particles; ///< Texel center and index of each particle
+
+	/// State textures are tex_width x tex_height texels (any size, not
+	/// only powers of two); the last row is only partially used
+	GLuint tex_width, tex_height;
+	GLint maxTextureSize; ///< Largest side of a state texture
+
+	precision statePrecision; ///< Storage of the state textures
+
+};
+
+#endif
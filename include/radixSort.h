@@ -0,0 +1,58 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  radixSort.h -- Key/value radix sort of storage buffers
+ *
+ **/
+
+#ifndef __RADIX__SORT__
+#define __RADIX__SORT__
+
+#include "glslKernel.h"
+
+///
+/// Sorts storage buffers of 32 bit keys and values by key on the GPU,
+/// with the passes of radixsort.comp: per digit, the digits of each
+/// block of keys are counted, the counts scanned in one work group and
+/// the keys and values scattered, ping-ponging with buffers of the sort.
+/// The sort is stable, so keys of fewer bits take fewer passes: depth
+/// keys of the sprites, cell keys of a neighbour grid. Needs OpenGL 4.3
+///
+class radixSort {
+
+public:
+
+	radixSort ();
+
+	/// Builds the passes of radixsort.comp
+	/// @arg debug flags the debug information output
+	/// @arg group_size invocations per work group
+	void install (bool debug, GLuint group_size);
+
+	/// Sorts keys and values in place
+	/// @arg keys storage buffer of n keys
+	/// @arg values storage buffer of n values, moved with their keys
+	/// @arg n number of keys
+	/// @arg bits bits of the keys, which must be below 2^bits
+	void sort (GLuint keys, GLuint values, GLuint n, GLuint bits = 32);
+
+	/// Deletes the sort buffers
+	void clear (void);
+
+private:
+
+	/// Passes of radixsort.comp, by PASS define
+	enum { PASS_COUNT, PASS_SCAN, PASS_SCATTER, NUM_PASSES };
+
+	glslKernel passes[NUM_PASSES];
+
+	GLuint groupSize; ///< Invocations per work group
+
+	/// Ping-pong keys and values and the digit counts, sized for capacity keys
+	GLuint ssbo_keys, ssbo_values, ssbo_counts;
+	GLuint capacity;
+
+};
+
+#endif
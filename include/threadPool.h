@@ -0,0 +1,69 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  threadPool.h -- Fixed set of worker threads splitting index ranges
+ *
+ **/
+
+#ifndef __THREAD__POOL__
+#define __THREAD__POOL__
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///
+/// Thread pool running one range function over [0,n) split in equal
+/// chunks, one per thread; the calling thread takes the first chunk
+///
+class threadPool {
+
+public:
+
+	/// Range function called as fn(begin, end)
+	typedef std::function< void (size_t, size_t) > rangeFunction;
+
+	/// Constructor
+	/// @arg threads total number of threads (0 for one per core)
+	threadPool( unsigned threads = 0 );
+
+	/// Destructor joins the workers
+	~threadPool();
+
+	/// Number of threads, including the caller
+	unsigned size( void ) const { return numThreads; }
+
+	/// Runs fn over [0,n) and returns when every chunk is done
+	/// @arg n range size
+	/// @arg fn range function
+	/// @arg align chunk boundaries are multiples of align
+	void run( size_t n, const rangeFunction& fn, size_t align = 1 );
+
+private:
+
+	threadPool( const threadPool& );
+	threadPool& operator = ( const threadPool& );
+
+	void worker( unsigned k );
+
+	/// Chunk k of [0,n)
+	void chunk( unsigned k, size_t& begin, size_t& end ) const;
+
+	unsigned numThreads;
+	std::vector< std::thread > workers;
+
+	std::mutex lock;
+	std::condition_variable start, done;
+
+	const rangeFunction* job; ///< Current range function
+	size_t jobSize, jobAlign; ///< Current range and chunk alignment
+	unsigned generation; ///< Incremented for each job
+	unsigned pending; ///< Workers still running the current job
+	bool quit;
+
+};
+
+#endif
@@ -0,0 +1,220 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  trajectory.h -- Particle trajectories recorded to a chunked binary file
+ *
+ **/
+
+#ifndef __TRAJECTORY__
+#define __TRAJECTORY__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///
+/// Layout of a trajectory file, all fields in the byte order of the
+/// writer: a file header, one chunk per snapshot (chunk header then
+/// payload), then the chunk index and a footer pointing at it. The
+/// payload holds position then velocity xyz of each particle, as floats
+/// or halves, byte-shuffled and optionally compressed
+///
+namespace trajectory {
+
+	enum { FLAG_HALF = 1, FLAG_COMPRESSED = 2 }; ///< File and chunk flags
+
+	/// File header
+	struct fileHeader {
+		char magic[4]; ///< "PTRJ"
+		uint32_t version; ///< 1
+		uint32_t flags; ///< Flags asked on record
+		uint32_t interval; ///< Steps between snapshots
+	};
+
+	/// Chunk header, followed by storedSize bytes of payload
+	struct chunkHeader {
+		char magic[4]; ///< "PCHK"
+		uint32_t flags; ///< Flags of this payload, compression is dropped when it does not pay
+		uint64_t step; ///< Steps run before the snapshot
+		uint32_t count; ///< Number of particles
+		uint32_t rawSize; ///< Payload bytes before compression
+		uint32_t storedSize; ///< Payload bytes in the file
+		uint32_t reserved;
+	};
+
+	/// Index entry of a chunk
+	struct indexEntry {
+		uint64_t step; ///< Step of the chunk
+		uint64_t offset; ///< File offset of the chunk header
+	};
+
+	/// Footer, the last bytes of the file
+	struct fileFooter {
+		char magic[4]; ///< "PIDX"
+		uint32_t numChunks; ///< Entries in the index
+		uint64_t indexOffset; ///< File offset of the index
+	};
+
+}
+
+///
+/// Records particle snapshots to a trajectory file. record copies the
+/// state and returns; quantization, compression and writing happen on a
+/// writer thread, so the simulation only waits when the writer falls
+/// several snapshots behind. The writer stops at the first write that
+/// falls short, as on a full disk, and close reports it
+///
+class trajectoryRecorder {
+
+public:
+
+	trajectoryRecorder( void );
+
+	/// Destructor closes the file
+	~trajectoryRecorder();
+
+	/// Creates a trajectory file and starts the writer
+	/// @arg filename output file
+	/// @arg interval steps between snapshots
+	/// @arg half stores halves instead of floats
+	/// @arg compress compresses each chunk
+	/// @return false if the file cannot be created
+	bool open( const char *filename, unsigned interval, bool half, bool compress );
+
+	/// Tells whether a file is being recorded
+	bool is_open( void ) const { return file != 0; }
+
+	/// Steps between snapshots
+	unsigned interval( void ) const { return every; }
+
+	/// Queues a snapshot in the texture layout of the engines, or
+	/// interleaved as read back
+	/// @arg step steps run so far
+	/// @arg n number of particles
+	/// @arg pos, vel 4 floats per particle, w is not recorded
+	/// @arg stride floats from one particle to the next
+	void record( uint64_t step, unsigned n, const float *pos, const float *vel, unsigned stride = 4 );
+
+	/// Writes the queued snapshots and the index, and closes the file
+	/// @return false if a write fell short, the file being incomplete
+	bool close( void );
+
+	/// Bytes written so far, headers included
+	uint64_t bytes( void ) const { return offset; }
+
+private:
+
+	trajectoryRecorder( const trajectoryRecorder& );
+	trajectoryRecorder& operator = ( const trajectoryRecorder& );
+
+	/// Snapshot waiting for the writer
+	struct snapshot {
+		uint64_t step;
+		unsigned count;
+		std::vector< float > values; ///< Position then velocity xyz of each particle
+	};
+
+	void writer( void );
+
+	/// Encodes and writes one chunk, on the writer thread
+	/// @return false if a write fell short
+	bool write_chunk( const snapshot& s );
+
+	static const unsigned MAX_QUEUED = 4; ///< Snapshots queued before record waits
+
+	FILE *file;
+	unsigned every; ///< Steps between snapshots
+	uint32_t flags; ///< Flags asked on open
+
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable ready, space;
+	std::deque< snapshot > queue; ///< Snapshots for the writer
+	bool quit;
+	bool failed; ///< A write fell short, nothing more is written
+
+	std::vector< trajectory::indexEntry > index; ///< Chunks written
+	uint64_t offset; ///< Bytes written
+	std::vector< unsigned char > raw, packed; ///< Writer buffers
+
+};
+
+///
+/// Reads a trajectory file mapped in memory. The chunk of any step is
+/// found in constant time from the index when the snapshots are evenly
+/// spaced; a file left without index is scanned chunk by chunk on open
+///
+class trajectoryReader {
+
+public:
+
+	trajectoryReader( void ) : data(0), length(0), every(0) { }
+
+	/// Destructor unmaps the file
+	~trajectoryReader() { close(); }
+
+	/// Maps a trajectory file
+	/// @arg filename input file
+	/// @return false if it is not a trajectory file, or its index points
+	/// outside its chunks
+	bool open( const char *filename );
+
+	/// Unmaps the file
+	void close( void );
+
+	/// Number of chunks
+	size_t size( void ) const { return index.size(); }
+
+	/// Steps between snapshots
+	unsigned interval( void ) const { return every; }
+
+	/// Step of a chunk
+	uint64_t step( size_t chunk ) const { return index[chunk].step; }
+
+	/// Number of particles of a chunk
+	unsigned count( size_t chunk ) const { return header(chunk).count; }
+
+	/// Chunk of the last snapshot at or before a step
+	/// @arg step step to seek
+	/// @return chunk number, or size() if step is before the first one
+	size_t find( uint64_t step ) const;
+
+	/// Decodes a chunk in the texture layout of the engines: the particle
+	/// id is restored in the position w, and 1 in the velocity w
+	/// @arg chunk chunk number
+	/// @arg pos, vel output, 4 floats per particle, or 0 to skip
+	/// @return false if the payload does not decode
+	bool read( size_t chunk, float *pos, float *vel ) const;
+
+private:
+
+	trajectoryReader( const trajectoryReader& );
+	trajectoryReader& operator = ( const trajectoryReader& );
+
+	const trajectory::chunkHeader& header( size_t chunk ) const {
+		return *(const trajectory::chunkHeader*)(data + index[chunk].offset);
+	}
+
+	/// Rebuilds the index walking the chunks
+	void scan( void );
+
+	/// Tells whether a whole chunk lies at a file offset
+	/// @arg at offset of the chunk header
+	/// @arg end offset the payload must end before
+	bool valid( uint64_t at, uint64_t end ) const;
+
+	const unsigned char *data; ///< Mapped file
+	size_t length; ///< File bytes
+	unsigned every; ///< Steps between snapshots
+
+	std::vector< trajectory::indexEntry > index;
+
+};
+
+#endif
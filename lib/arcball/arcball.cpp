@@ -67,6 +67,9 @@ void arcball_setzoom(float radius, vec eye, vec up)
 // affect the arcball's orientation on openGL
 void arcball_rotate() { glMultMatrixf(ab_quat); }
 
+// the arcball's orientation, without touching openGL
+void arcball_matrix(float m[16]) { for(int i = 0; i < 16; ++i) m[i] = ab_quat[i]; }
+
 // convert the quaternion into a rotation matrix
 static void quaternion(GLfloat* q, GLfloat x, GLfloat y, GLfloat z, GLfloat w)
 {
@@ -34,6 +34,8 @@
  *     the current mouse position on the sphere. (Call on mouse move.)
  *   Call arcball_rotate after resetting the modelview matrix in your
  *     drawing code. It will call glRotate with its current rotation.
+ *   Call arcball_matrix to get the current rotation without OpenGL, as
+ *     the column major matrix arcball_rotate multiplies by.
  *   Call arcball_reset if you wish to reset the arcball rotation.
  */
 
@@ -75,6 +77,7 @@ class vec // simple 3D vector class
 
 extern void arcball_setzoom(float radius, vec eye, vec up);
 extern void arcball_rotate();
+extern void arcball_matrix(float m[16]);
 extern void arcball_reset();
 extern void arcball_start(int mx, int my);
 extern void arcball_move(int mx, int my);
@@ -26,12 +26,23 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <map>
+#include <sstream>
+#include <mutex>
+#include <atomic>
 
 #include "glslKernel.h"
 #ifdef __MAC__
 #include <OpenGL/glu.h>
+#include <OpenGL/OpenGL.h>
+#include <dlfcn.h>
 #else
 #include <GL/glu.h>
+#if defined(__EGL__)
+#include <EGL/egl.h>
+#elif !defined(_WIN32)
+#include <GL/glx.h>
+#endif
 #endif
 
 using namespace std;
@@ -60,6 +71,447 @@ bool geom_shader_support () {
 #endif
 }
 
+/// Tells whether graphics board support transform feedback (OpenGL 3.0)
+/// @return true if vertex outputs can be captured into buffers
+bool transform_feedback_support () {
+#ifdef __GLEW__
+	return (GLEW_VERSION_3_0);
+#else
+	return (GLEE_VERSION_3_0);
+#endif
+}
+
+#ifdef __GLSL_ARB_bindless_texture__
+PFNGLGETTEXTUREHANDLEARBPROC pglslGetTextureHandleARB = 0;
+PFNGLMAKETEXTUREHANDLERESIDENTARBPROC pglslMakeTextureHandleResidentARB = 0;
+PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC pglslMakeTextureHandleNonResidentARB = 0;
+PFNGLPROGRAMUNIFORMHANDLEUI64ARBPROC pglslProgramUniformHandleui64ARB = 0;
+#endif
+
+#ifdef __GLSL_ARB_sync__
+PFNGLFENCESYNCPROC pglslFenceSync = 0;
+PFNGLDELETESYNCPROC pglslDeleteSync = 0;
+PFNGLCLIENTWAITSYNCPROC pglslClientWaitSync = 0;
+PFNGLWAITSYNCPROC pglslWaitSync = 0;
+#endif
+
+#ifdef __GLSL_ARB_copy_buffer__
+PFNGLCOPYBUFFERSUBDATAPROC pglslCopyBufferSubData = 0;
+#endif
+
+#ifdef __GLSL_ARB_compute_shader__
+PFNGLDISPATCHCOMPUTEPROC pglslDispatchCompute = 0;
+#endif
+
+#ifdef __GLSL_ARB_shader_image_load_store__
+PFNGLMEMORYBARRIERPROC pglslMemoryBarrier = 0;
+#endif
+
+/// Resolves an OpenGL entry point by name
+/// @arg name name of the OpenGL function
+/// @return function address or 0 if it is not available
+void* glsl_proc_address (const char* name) {
+#if defined(_WIN32)
+	return (void*) wglGetProcAddress (name);
+#elif defined(__MAC__)
+	return dlsym (RTLD_DEFAULT, name);
+#elif defined(__EGL__)
+	return (void*) eglGetProcAddress (name);
+#else
+	return (void*) glXGetProcAddressARB ((const GLubyte*) name);
+#endif
+}
+
+/// Tells whether the OpenGL extension string lists an extension
+/// @arg name extension name
+/// @return true if the extension is supported
+static bool has_extension (const char* name) {
+
+	const char* ext = (const char*) glGetString (GL_EXTENSIONS);
+	if (!ext) return false;
+
+	size_t n = strlen (name);
+
+	for (const char* p = strstr (ext, name); p; p = strstr (p + n, name))
+		if ((p == ext || p[-1] == ' ') && (p[n] == ' ' || p[n] == '\0'))
+			return true;
+
+	return false;
+
+}
+
+/// Tells whether graphics board support fence sync objects
+/// @return true if glFenceSync and friends can be used
+bool sync_support () {
+#ifdef __GLSL_ARB_sync__
+	static int supported = -1;
+
+	if (supported == -1) {
+
+		pglslFenceSync = (PFNGLFENCESYNCPROC) glsl_proc_address ("glFenceSync");
+		pglslDeleteSync = (PFNGLDELETESYNCPROC) glsl_proc_address ("glDeleteSync");
+		pglslClientWaitSync = (PFNGLCLIENTWAITSYNCPROC) glsl_proc_address ("glClientWaitSync");
+		pglslWaitSync = (PFNGLWAITSYNCPROC) glsl_proc_address ("glWaitSync");
+
+		supported = has_extension ("GL_ARB_sync") &&
+			pglslFenceSync && pglslDeleteSync && pglslClientWaitSync && pglslWaitSync;
+
+	}
+
+	return supported == 1;
+#elif defined(__GLEW__)
+	return (GLEW_ARB_sync);
+#else
+	return has_extension ("GL_ARB_sync") &&
+		glsl_proc_address ("glFenceSync") && glsl_proc_address ("glDeleteSync") &&
+		glsl_proc_address ("glClientWaitSync") && glsl_proc_address ("glWaitSync");
+#endif
+}
+
+/// Tells whether graphics board support copies between buffer objects
+/// (OpenGL 3.1)
+/// @return true if glCopyBufferSubData can be used
+bool copy_buffer_support () {
+#ifdef __GLSL_ARB_copy_buffer__
+	static int supported = -1;
+
+	if (supported == -1) {
+
+		pglslCopyBufferSubData = (PFNGLCOPYBUFFERSUBDATAPROC) glsl_proc_address ("glCopyBufferSubData");
+
+		supported = has_extension ("GL_ARB_copy_buffer") && pglslCopyBufferSubData;
+
+	}
+
+	return supported == 1;
+#elif defined(__GLEW__)
+	return (GLEW_ARB_copy_buffer);
+#else
+	return has_extension ("GL_ARB_copy_buffer") && glsl_proc_address ("glCopyBufferSubData");
+#endif
+}
+
+/// Tells whether graphics board support compute shaders over shader
+/// storage buffers (OpenGL 4.3)
+/// @return true if glDispatchCompute and glMemoryBarrier can be used
+bool compute_shader_support () {
+	static int supported = -1;
+
+	if (supported == -1) {
+
+		bool dispatch, barrier;
+
+#ifdef __GLSL_ARB_compute_shader__
+		pglslDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC) glsl_proc_address ("glDispatchCompute");
+		dispatch = (pglslDispatchCompute != 0);
+#elif defined(__GLEW__)
+		dispatch = GLEW_ARB_compute_shader;
+#else
+		dispatch = (glsl_proc_address ("glDispatchCompute") != 0);
+#endif
+#ifdef __GLSL_ARB_shader_image_load_store__
+		pglslMemoryBarrier = (PFNGLMEMORYBARRIERPROC) glsl_proc_address ("glMemoryBarrier");
+		barrier = (pglslMemoryBarrier != 0);
+#elif defined(__GLEW__)
+		barrier = GLEW_ARB_shader_image_load_store;
+#else
+		barrier = (glsl_proc_address ("glMemoryBarrier") != 0);
+#endif
+
+		supported = has_extension ("GL_ARB_compute_shader") &&
+			has_extension ("GL_ARB_shader_storage_buffer_object") &&
+			dispatch && barrier;
+
+	}
+
+	return supported == 1;
+}
+
+/// Tells whether graphics board support instanced draws with per instance
+/// attributes (OpenGL 3.3)
+/// @return true if glDrawArraysInstancedARB and glVertexAttribDivisor can be used
+bool instancing_support () {
+#ifdef __GLEW__
+	return (GLEW_ARB_draw_instanced && GLEW_ARB_instanced_arrays);
+#else
+	return (GLEE_ARB_draw_instanced && GLEE_ARB_instanced_arrays);
+#endif
+}
+
+/// Tells whether graphics board support GPU timer queries
+/// @return true if GL_TIME_ELAPSED queries can be used
+bool timer_query_support () {
+
+	return has_extension ("GL_EXT_timer_query") || has_extension ("GL_ARB_timer_query");
+
+}
+
+/// Gets the OpenGL context current in the calling thread
+/// @return platform context handle or 0 if no context is current
+void* glsl_current_context () {
+#if defined(_WIN32)
+	return (void*) wglGetCurrentContext ();
+#elif defined(__MAC__)
+	return (void*) CGLGetCurrentContext ();
+#elif defined(__EGL__)
+	return (void*) eglGetCurrentContext ();
+#else
+	return (void*) glXGetCurrentContext ();
+#endif
+}
+
+/// Tells whether graphics board support bindless textures
+/// @return true if texture handles can be used instead of texture units
+bool bindless_texture_support () {
+#ifdef __GLSL_ARB_bindless_texture__
+	static int supported = -1;
+
+	if (supported == -1) {
+
+		pglslGetTextureHandleARB = (PFNGLGETTEXTUREHANDLEARBPROC)
+			glsl_proc_address ("glGetTextureHandleARB");
+		pglslMakeTextureHandleResidentARB = (PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)
+			glsl_proc_address ("glMakeTextureHandleResidentARB");
+		pglslMakeTextureHandleNonResidentARB = (PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)
+			glsl_proc_address ("glMakeTextureHandleNonResidentARB");
+		pglslProgramUniformHandleui64ARB = (PFNGLPROGRAMUNIFORMHANDLEUI64ARBPROC)
+			glsl_proc_address ("glProgramUniformHandleui64ARB");
+
+		supported = has_extension ("GL_ARB_bindless_texture") &&
+			pglslGetTextureHandleARB && pglslMakeTextureHandleResidentARB &&
+			pglslMakeTextureHandleNonResidentARB && pglslProgramUniformHandleui64ARB;
+
+	}
+
+	return supported == 1;
+#elif defined(__GLEW__)
+	return (GLEW_ARB_bindless_texture);
+#else
+	return has_extension ("GL_ARB_bindless_texture") &&
+		glsl_proc_address ("glGetTextureHandleARB") && glsl_proc_address ("glMakeTextureHandleResidentARB") &&
+		glsl_proc_address ("glMakeTextureHandleNonResidentARB") && glsl_proc_address ("glProgramUniformHandleui64ARB");
+#endif
+}
+
+/// Texture binding cache entry
+struct textureBinding {
+
+	GLint unit; ///< Texture unit
+	GLenum target; ///< Texture target
+	GLuint texture; ///< Texture last bound to target in unit
+
+};
+
+/// Texture bindings of one context
+struct textureCache {
+
+	std::vector <textureBinding> bound; ///< Cached texture bindings
+	GLint activeUnit; ///< Cached active texture unit (-1 unknown)
+	std::map <GLuint, GLuint64EXT> handles; ///< Resident texture handles
+
+};
+
+/// Local-static variables
+static std::map <void*, textureCache> textureCaches; ///< Texture caches by context
+static std::mutex textureCachesMutex; ///< Guards textureCaches
+static std::atomic <unsigned> textureCachesGeneration (0); ///< Bumped when a cache is released
+
+/// Gets the texture cache of the current context
+/// @return texture cache of the context current in the calling thread
+static textureCache& current_texture_cache (void) {
+
+	static thread_local void* lastContext = 0;
+	static thread_local textureCache* lastCache = 0;
+	static thread_local unsigned lastGeneration = 0;
+
+	void* context = glsl_current_context ();
+	unsigned generation = textureCachesGeneration.load ();
+
+	// a released cache may leave its address to a new context
+	if (!lastCache || context != lastContext || generation != lastGeneration) {
+
+		std::lock_guard<std::mutex> lock (textureCachesMutex);
+
+		std::map <void*, textureCache>::iterator it = textureCaches.find (context);
+
+		if (it == textureCaches.end()) {
+
+			it = textureCaches.insert (make_pair (context, textureCache())).first;
+			it->second.activeUnit = -1;
+
+		}
+
+		lastContext = context;
+		lastCache = &it->second;
+		lastGeneration = generation;
+
+	}
+
+	return *lastCache;
+
+}
+
+/// Binds a texture to a texture unit, skipping the call if the texture
+/// is already bound there (the last binding of each unit is cached)
+/// @arg unit texture unit number
+/// @arg target texture target, e.g. GL_TEXTURE_2D
+/// @arg texture texture object
+void glsl_bind_texture (GLint unit, GLenum target, GLuint texture) {
+
+	textureCache& cache = current_texture_cache ();
+	std::vector <textureBinding>& boundTextures = cache.bound;
+
+	unsigned int i = 0;
+
+	while (i < boundTextures.size() &&
+	       (boundTextures[i].unit != unit || boundTextures[i].target != target))
+		++i;
+
+	if (i == boundTextures.size()) {
+
+		textureBinding b = { unit, target, 0 };
+		boundTextures.push_back (b);
+
+	} else if (boundTextures[i].texture == texture) {
+
+		return;
+
+	}
+
+	if (cache.activeUnit != unit) {
+
+		glActiveTexture (GL_TEXTURE0 + unit);
+		cache.activeUnit = unit;
+
+	}
+
+	glBindTexture (target, texture);
+	boundTextures[i].texture = texture;
+
+}
+
+/// Forgets the cached texture bindings of the current context
+void glsl_reset_texture_cache () {
+
+	textureCache& cache = current_texture_cache ();
+
+	cache.bound.clear();
+	cache.activeUnit = -1;
+
+}
+
+/// Forgets the texture cache of the current context, its bindless
+/// handles made non resident
+void glsl_release_context () {
+
+	void* context = glsl_current_context ();
+
+	std::lock_guard<std::mutex> lock (textureCachesMutex);
+
+	std::map <void*, textureCache>::iterator it = textureCaches.find (context);
+
+	if (it == textureCaches.end())
+		return;
+
+	for (std::map <GLuint, GLuint64EXT>::iterator h = it->second.handles.begin(); h != it->second.handles.end(); ++h)
+		glMakeTextureHandleNonResidentARB (h->second);
+
+	textureCaches.erase (it);
+	++textureCachesGeneration;
+
+}
+
+/// Releases the bindless handle and the cached bindings of a texture
+/// @arg texture texture object
+void glsl_release_texture (GLuint texture) {
+
+	textureCache& cache = current_texture_cache ();
+	std::vector <textureBinding>& boundTextures = cache.bound;
+
+	std::map <GLuint, GLuint64EXT>::iterator it = cache.handles.find (texture);
+
+	if (it != cache.handles.end()) {
+
+		glMakeTextureHandleNonResidentARB (it->second);
+		cache.handles.erase (it);
+
+	}
+
+	for (unsigned int i = 0; i < boundTextures.size(); )
+		if (boundTextures[i].texture == texture)
+			boundTextures.erase (boundTextures.begin() + i);
+		else
+			++i;
+
+}
+
+/// Gets the resident bindless handle of a texture, creating it once
+/// per context (handle residency is per context)
+/// @arg texture texture object
+/// @return texture handle
+static GLuint64EXT texture_handle (GLuint texture) {
+
+	std::map <GLuint, GLuint64EXT>& textureHandles = current_texture_cache().handles;
+	std::map <GLuint, GLuint64EXT>::iterator it = textureHandles.find (texture);
+
+	if (it != textureHandles.end())
+		return it->second;
+
+	GLuint64EXT handle = glGetTextureHandleARB (texture);
+	glMakeTextureHandleResidentARB (handle);
+	textureHandles[texture] = handle;
+
+	return handle;
+
+}
+
+/// Tells whether a shader enables bindless textures, so its samplers
+/// may take texture handles (no handle is created for other shaders)
+/// @arg shader handle for a shader object
+/// @return true if the shader source requests GL_ARB_bindless_texture
+static bool takes_texture_handles (GLuint shader) {
+
+	if (!shader || !bindless_texture_support()) return false;
+
+	GLint length = 0;
+	glGetShaderiv (shader, GL_SHADER_SOURCE_LENGTH, &length);
+	if (length <= 0) return false;
+
+	vector<GLchar> source (length);
+	glGetShaderSource (shader, length, NULL, &source[0]);
+
+	return strstr (&source[0], "GL_ARB_bindless_texture") != NULL;
+
+}
+
+/// Gets the texture target matching a sampler uniform type
+/// @arg type uniform type
+/// @return texture target or 0 if type is not a sampler
+static GLenum sampler_target (GLenum type) {
+
+	switch (type) {
+
+	case GL_SAMPLER_1D: case GL_SAMPLER_1D_SHADOW:
+		return GL_TEXTURE_1D;
+	case GL_SAMPLER_2D: case GL_SAMPLER_2D_SHADOW:
+		return GL_TEXTURE_2D;
+	case GL_SAMPLER_3D:
+		return GL_TEXTURE_3D;
+	case GL_SAMPLER_CUBE:
+		return GL_TEXTURE_CUBE_MAP;
+	case GL_SAMPLER_2D_RECT_ARB: case GL_SAMPLER_2D_RECT_SHADOW_ARB:
+		return GL_TEXTURE_RECTANGLE_ARB;
+	case GL_SAMPLER_2D_ARRAY:
+		return GL_TEXTURE_2D_ARRAY;
+	case GL_SAMPLER_BUFFER_EXT:
+		return GL_TEXTURE_BUFFER_EXT;
+	default:
+		return 0;
+
+	}
+
+}
+
 /// Print out the attribytes information for a GLSL program 
 /// @arg prg handle for a GLSL program
 static void check_attributes (GLuint prg) {
@@ -85,6 +537,54 @@ static void check_attributes (GLuint prg) {
 
 /// Print out the information log for a shader object 
 /// @arg obj handle for a shader object
+/// Sets a shader source, inserting the kernel #define lines right after
+/// the #version line (or first without one), keeping line numbers
+/// @arg shader shader object
+/// @arg text source text
+/// @arg length source length, or -1 for a null-terminated text
+/// @arg defines #define lines
+static void set_shader_source (GLuint shader, const GLchar* text, GLint length,
+			       const std::string& defines) {
+
+	if (length < 0) length = (GLint) strlen (text);
+
+	if (defines.empty()) {
+
+		glShaderSource (shader, 1, &text, &length);
+		return;
+
+	}
+
+	// head ends after the #version line, if any
+	GLint head = 0, line = 1;
+
+	for (GLint i = 0; i + 8 <= length; i++) {
+
+		if (strncmp (text + i, "#version", 8) == 0) {
+
+			head = i;
+			while (head < length && text[head] != '\n') head++;
+			if (head < length) head++;
+			break;
+
+		}
+
+	}
+
+	for (GLint i = 0; i < head; i++)
+		if (text[i] == '\n') line++;
+
+	std::ostringstream lines;
+	lines << defines << "#line " << line << "\n";
+	std::string middle = lines.str();
+
+	const GLchar* parts[3] = { text, middle.c_str(), text + head };
+	GLint lengths[3] = { head, (GLint) middle.size(), length - head };
+
+	glShaderSource (shader, 3, parts, lengths);
+
+}
+
 static void printShaderInfoLog (GLuint obj) {
 
 	GLint infologLength = 0, charsWritten = 0;
@@ -143,43 +643,220 @@ static int error_check (const char* str = NULL) {
 
 }
 
-/// Local-static variables
-static std::vector <char> buffer; ///< Buffer for storing texts for shaders
-static std::vector <char*> line; ///< Points to individual lines inside buffer
+///
+/// GLSL Source Arena class methods
+///
+
+/// Constructor
+/// @arg block_size default size of each memory block in Bytes
+glslSourceArena::glslSourceArena (size_t block_size)
+	: blockSize(block_size), used(0), capacity(0) {
+
+}
 
-/// Utility method for reading a text file one line at a time into array
-/// of strings 'line'. Vector 'buffer' provides storage for the text.
-/// @arg filename name of text file
-static void load_file (const char* filename) {
+/// Destructor
+glslSourceArena::~glslSourceArena () {
+
+	clear();
+
+}
+
+/// Reserves n Bytes in the arena
+/// Sources larger than the default block size get a block of their own
+/// @arg n number of Bytes
+/// @return pointer to the reserved Bytes
+GLchar* glslSourceArena::allocate (size_t n) {
+
+	if (used + n > capacity) {
+
+		capacity = (n > blockSize) ? n : blockSize;
+		blocks.push_back (new GLchar [capacity]);
+		used = 0;
+
+	}
+
+	GLchar* p = blocks.back() + used;
+	used += n;
+
+	return p;
+
+}
 
-	ifstream f (filename);
-	vector<int> n;
+/// Reads a whole shader source file into the arena
+/// @arg filename name of shader source file
+/// @return view of the file text
+glslSourceView glslSourceArena::load (const char* filename) {
+
+	ifstream f (filename, ios::in | ios::binary);
 	assert (f);
-	char buf [1000];
-	buffer.clear ();
-	line.clear();
 
-	while (!f.eof()) {
+	f.seekg (0, ios::end);
+	size_t n = (size_t) f.tellg();
+	f.seekg (0, ios::beg);
+
+	GLchar* text = allocate (n + 1);
+	f.read (text, n);
+	text[n] = '\0';
+
+	glslSourceView view;
+	view.text = text;
+	view.length = (GLint) n;
+
+	return view;
+
+}
+
+/// Releases all sources, invalidating every view given so far
+void glslSourceArena::clear (void) {
+
+	for (unsigned int i = 0; i < blocks.size(); i++)
+		delete [] blocks[i];
+
+	blocks.clear();
+	used = capacity = 0;
+
+}
+
+///
+/// GLSL Program class methods
+///
+
+/// Constructor
+/// @arg program linked program object to take ownership of (0 for null)
+glslProgram::glslProgram (GLuint program) : obj(0) {
+
+	if (program) {
+
+		obj = new shared;
+		obj->program = program;
+		obj->references = 1;
+		obj->ready = 0;
+
+	}
+
+}
+
+/// Copy constructor
+glslProgram::glslProgram (const glslProgram& other) : obj(other.obj) {
+
+	if (obj) ++obj->references;
+
+}
+
+/// Move constructor
+glslProgram::glslProgram (glslProgram&& other) : obj(other.obj) {
+
+	other.obj = 0;
+
+}
+
+/// Copy assignment
+glslProgram& glslProgram::operator = (const glslProgram& other) {
+
+	if (obj != other.obj) {
+
+		if (other.obj) ++other.obj->references;
+		release();
+		obj = other.obj;
+
+	}
+
+	return *this;
+
+}
+
+/// Move assignment
+glslProgram& glslProgram::operator = (glslProgram&& other) {
+
+	if (this != &other) {
+
+		release();
+		obj = other.obj;
+		other.obj = 0;
+
+	}
+
+	return *this;
+
+}
+
+/// Destructor
+glslProgram::~glslProgram () {
+
+	release();
+
+}
+
+/// Drops this handle reference, deleting the program with the last one
+/// A program still in use by some context is only flagged for deletion
+void glslProgram::release (void) {
 
-		f.getline (buf,1000);
-		n.push_back(strlen(buf));
-		copy (buf, buf+n.back(), back_inserter (buffer));
-		buffer.push_back ('\n');
-		buffer.push_back ('\0');
+	if (obj && --obj->references == 0) {
+
+		if (glsl_current_context()) {
+
+			GLsync fence = obj->ready.exchange (0);
+			if (fence) glDeleteSync (fence);
+
+			glDeleteProgram (obj->program);
+
+		}
+
+		delete obj;
 
 	}
 
-	int length = 0;
+	obj = 0;
+
+}
+
+/// Program object
+/// @return program object or 0 for the null handle
+GLuint glslProgram::id (void) const {
+
+	return obj ? obj->program : 0;
+
+}
+
+/// Number of handles sharing the program
+/// @return reference count
+int glslProgram::references (void) const {
 
-	for (unsigned int i = 0; i < n.size (); i++) {
+	return obj ? obj->references.load() : 0;
 
-		line.push_back (&buffer[length]);
-		length += n[i]+2;
+}
+
+/// Marks the point where the program is ready for other contexts
+/// Without sync objects, it waits until the program is built
+void glslProgram::publish (void) {
+
+	assert (obj);
+
+	if (sync_support()) {
+
+		GLsync fence = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush(); // the fence must reach the GPU before others wait on it
+
+		GLsync old = obj->ready.exchange (fence);
+		if (old) glDeleteSync (old);
+
+	} else {
+
+		glFinish();
 
 	}
 
 }
 
+/// Makes the current context wait until the program is ready
+void glslProgram::wait (void) const {
+
+	GLsync fence = obj ? obj->ready.load() : 0;
+
+	if (fence) glWaitSync (fence, 0, GL_TIMEOUT_IGNORED);
+
+}
+
 ///
 /// GLSL Kernel class methods
 ///
@@ -189,44 +866,66 @@ static void load_file (const char* filename) {
 /// @arg frag_source array of strings containing fragment shader source
 /// @arg vtx_source array of strings containing vertex shader source
 glslKernel::glslKernel (const char ** geom_source, const char ** frag_source, const char ** vtx_source)
-	: programObject (0), geometryShader(0), fragmentShader(0), vertexShader(0),
+	: program(), programReady(false),
 	  geomSource(geom_source), fragSource(frag_source), vtxSource(vtx_source),
 	  geomFileName(0), fragFileName(0), vtxFileName(0),
-	  geomVtxOut(3), geomTypeIn(GL_TRIANGLES), geomTypeOut(GL_TRIANGLE_STRIP) {
+	  geomView(), fragView(), vtxView(), compFileName(0), compView(),
+	  geomVtxOut(3), geomTypeIn(GL_TRIANGLES), geomTypeOut(GL_TRIANGLE_STRIP),
+	  feedbackMode(GL_INTERLEAVED_ATTRIBS) {
 
 }
 
 /// Destructor
+/// Another context may still run the program: the program handle deletes
+/// it only when the last kernel referencing it goes away
 glslKernel::~glslKernel() {
 
-	if (installed()) {
-
-		glUseProgram(0);
-
-		if (geometryShader) {
+}
 
-			glDetachShader(programObject, geometryShader);
-			glDeleteShader(geometryShader);
+/// Gives another kernel running the same program object
+/// @return kernel sharing the program and the sampler units
+glslKernel glslKernel::share (void) const {
 
-		}
+	glslKernel k (geomSource, fragSource, vtxSource);
 
-		if (fragmentShader) {
+	k.geomFileName = geomFileName;
+	k.fragFileName = fragFileName;
+	k.vtxFileName = vtxFileName;
+	k.geomView = geomView;
+	k.fragView = fragView;
+	k.vtxView = vtxView;
+	k.compFileName = compFileName;
+	k.compView = compView;
+	k.defines = defines;
+	k.geomVtxOut = geomVtxOut;
+	k.geomTypeIn = geomTypeIn;
+	k.geomTypeOut = geomTypeOut;
+	k.feedbackVaryings = feedbackVaryings;
+	k.feedbackMode = feedbackMode;
+	k.attribLocations = attribLocations;
+	k.samplers = samplers;
+	k.program = program;
 
-			glDetachShader(programObject, fragmentShader);
-			glDeleteShader(fragmentShader);
+	return k;
 
-		}
+}
 
-		if (vertexShader) {
+/// Gets the program handle of this kernel
+/// @return reference-counted program handle
+const glslProgram& glslKernel::get_program (void) const {
 
-			glDetachShader(programObject, vertexShader);
-			glDeleteShader(vertexShader);
+	return program;
 
-		}
+}
 
-		glDeleteProgram(programObject);
+/// Publishes the installed program for use in other contexts
+/// The kernel may be moved to another context after this, so its next
+/// use waits on the new fence wherever it happens
+void glslKernel::publish (void) {
 
-	}
+	assert (installed());
+	program.publish();
+	programReady = false;
 
 }
 
@@ -234,9 +933,10 @@ glslKernel::~glslKernel() {
 /// @return openGL usage in Bytes
 int glslKernel::size_of(void) {
 
-	return ( ( 4 * sizeof(GLuint) ) + ///< All GLuints
+	return ( sizeof(glslProgram) + sizeof(bool) + ///< Program handle
 		 ( 3 * sizeof(GLint) ) + ///< All GLints
-		 ( 6 * sizeof(int) ) ///< pointers
+		 ( 6 * sizeof(int) ) + ///< pointers
+		 ( 3 * sizeof(glslSourceView) ) ///< source views
 		);
 
 }
@@ -246,6 +946,17 @@ int glslKernel::size_of(void) {
 void glslKernel::geometry_source (const char* filename) {
 
 	geomFileName = filename;
+	geomView.text = 0;
+	geomView.length = 0;
+
+}
+
+/// Sets an already loaded geometry shader source
+/// @arg source view of geometry shader source text
+void glslKernel::geometry_source (const glslSourceView& source) {
+
+	geomView = source;
+	geomFileName = 0;
 
 }
 
@@ -254,6 +965,17 @@ void glslKernel::geometry_source (const char* filename) {
 void glslKernel::fragment_source (const char* filename) {
 
 	fragFileName = filename;
+	fragView.text = 0;
+	fragView.length = 0;
+
+}
+
+/// Sets an already loaded fragment shader source
+/// @arg source view of fragment shader source text
+void glslKernel::fragment_source (const glslSourceView& source) {
+
+	fragView = source;
+	fragFileName = 0;
 
 }
 
@@ -262,6 +984,63 @@ void glslKernel::fragment_source (const char* filename) {
 void glslKernel::vertex_source (const char* filename) {
 
 	vtxFileName = filename;
+	vtxView.text = 0;
+	vtxView.length = 0;
+
+}
+
+/// Sets an already loaded vertex shader source
+/// @arg source view of vertex shader source text
+void glslKernel::vertex_source (const glslSourceView& source) {
+
+	vtxView = source;
+	vtxFileName = 0;
+
+}
+
+/// Sets the name of a compute shader source file
+/// @arg filename name of compute shader source file
+void glslKernel::compute_source (const char* filename) {
+
+	compFileName = filename;
+	compView.text = 0;
+	compView.length = 0;
+
+}
+
+/// Sets an already loaded compute shader source
+/// @arg source view of compute shader source text
+void glslKernel::compute_source (const glslSourceView& source) {
+
+	compView = source;
+	compFileName = 0;
+
+}
+
+/// Defines a preprocessor macro in every shader, applied on install
+/// Defining it again replaces the previous value
+/// @arg name macro name
+/// @arg value macro value
+void glslKernel::set_define (const GLchar* name, GLint value) {
+
+	std::string key = std::string("#define ") + name + " ";
+
+	std::ostringstream line;
+	line << key << value << "\n";
+
+	size_t pos = (defines.compare (0, key.size(), key) == 0) ? 0 : defines.find ("\n" + key);
+	if (pos != std::string::npos && pos != 0) pos++;
+
+	if (pos == std::string::npos) {
+
+		defines += line.str();
+
+	} else {
+
+		size_t end = defines.find ('\n', pos);
+		defines.replace (pos, end + 1 - pos, line.str());
+
+	}
 
 }
 
@@ -269,7 +1048,7 @@ void glslKernel::vertex_source (const char* filename) {
 /// @return true if and only if a program object was built
 bool glslKernel::installed () {
 
-	return programObject != 0;
+	return program.id() != 0;
 
 }
 
@@ -279,16 +1058,18 @@ bool glslKernel::installed () {
 void glslKernel::install (bool debug) {
 
 	assert (vtxSource || fragSource || geomSource ||
-		vtxFileName || fragFileName || geomFileName);
+		vtxView.text || fragView.text || geomView.text || compView.text ||
+		vtxFileName || fragFileName || geomFileName || compFileName);
+
+	glslSourceArena arena; ///< Holds the sources read from files below
 
-	if (programObject != 0)
-		glDeleteProgram( programObject );
+	GLuint geometryShader = 0, fragmentShader = 0, vertexShader = 0, computeShader = 0;
 
-	programObject = glCreateProgram();
+	GLuint programObject = glCreateProgram();
 
 	assert( programObject != 0 );
 
-	if (geomSource || geomFileName) {
+	if (geomSource || geomView.text || geomFileName) {
 
 		geometryShader = glCreateShader (GL_GEOMETRY_SHADER_EXT);
 
@@ -296,12 +1077,16 @@ void glslKernel::install (bool debug) {
 
 		if (geomSource) {
 
-			glShaderSource(geometryShader, 1, geomSource, NULL);
+			set_shader_source (geometryShader, geomSource[0], -1, defines);
+
+		} else if (geomView.text) {
+
+			set_shader_source (geometryShader, geomView.text, geomView.length, defines);
 
 		} else {
 
-			load_file (geomFileName);
-			glShaderSource (geometryShader, line.size(), (const GLchar**) (&line[0]), NULL);
+			glslSourceView source = arena.load (geomFileName);
+			set_shader_source (geometryShader, source.text, source.length, defines);
 
 		}
 
@@ -326,7 +1111,7 @@ void glslKernel::install (bool debug) {
 
 	}
 
-	if (fragSource || fragFileName) {
+	if (fragSource || fragView.text || fragFileName) {
 
 		fragmentShader = glCreateShader (GL_FRAGMENT_SHADER);
 
@@ -334,12 +1119,16 @@ void glslKernel::install (bool debug) {
 
 		if (fragSource) {
 
-			glShaderSource(fragmentShader, 1, fragSource, NULL);
+			set_shader_source (fragmentShader, fragSource[0], -1, defines);
+
+		} else if (fragView.text) {
+
+			set_shader_source (fragmentShader, fragView.text, fragView.length, defines);
 
 		} else {
 
-			load_file (fragFileName);
-			glShaderSource (fragmentShader, line.size(), (const GLchar**) (&line[0]), NULL);
+			glslSourceView source = arena.load (fragFileName);
+			set_shader_source (fragmentShader, source.text, source.length, defines);
 
 		}
 
@@ -358,7 +1147,7 @@ void glslKernel::install (bool debug) {
 		assert (!error_check("Attaching Fragment Shader"));
 	}
 
-	if (vtxSource || vtxFileName) {
+	if (vtxSource || vtxView.text || vtxFileName) {
 
 		vertexShader = glCreateShader (GL_VERTEX_SHADER);
 
@@ -366,12 +1155,16 @@ void glslKernel::install (bool debug) {
 
 		if (vtxSource) {
 
-			glShaderSource(vertexShader, 1, vtxSource, NULL);
+			set_shader_source (vertexShader, vtxSource[0], -1, defines);
+
+		} else if (vtxView.text) {
+
+			set_shader_source (vertexShader, vtxView.text, vtxView.length, defines);
 
 		} else {
 
-			load_file (vtxFileName);
-			glShaderSource (vertexShader, line.size(), (const GLchar**) &line[0], NULL);
+			glslSourceView source = arena.load (vtxFileName);
+			set_shader_source (vertexShader, source.text, source.length, defines);
 
 		}
 
@@ -391,6 +1184,62 @@ void glslKernel::install (bool debug) {
 
 	}
 
+	if (compView.text || compFileName) {
+
+		computeShader = glCreateShader (GL_COMPUTE_SHADER);
+
+		assert(computeShader != 0);
+
+		if (compView.text) {
+
+			set_shader_source (computeShader, compView.text, compView.length, defines);
+
+		} else {
+
+			glslSourceView source = arena.load (compFileName);
+			set_shader_source (computeShader, source.text, source.length, defines);
+
+		}
+
+		assert (!error_check("Creating Compute Shader"));
+
+		glCompileShader (computeShader);
+
+		if (debug) printShaderInfoLog (computeShader);
+		assert (!error_check("Compiling Compute Shader"));
+
+		GLint compileCompute;
+		glGetShaderiv (computeShader, GL_COMPILE_STATUS, &compileCompute);
+		assert (compileCompute == GL_TRUE);
+
+		glAttachShader (programObject, computeShader);
+		assert (!error_check("Attaching Compute Shader"));
+
+	}
+
+	for (unsigned int i = 0; i < attribLocations.size(); i++)
+		glBindAttribLocation (programObject, attribLocations[i].second,
+				      attribLocations[i].first.c_str());
+
+	if (!feedbackVaryings.empty()) {
+
+		std::vector<const GLchar*> names (feedbackVaryings.size());
+		for (unsigned int i = 0; i < names.size(); i++)
+			names[i] = feedbackVaryings[i].c_str();
+
+#ifdef __GLEE_GL_VERSION_3_0
+		// GLee declares the draft signature taking locations, the entry
+		// point itself takes names as in the final OpenGL 3.0
+		glTransformFeedbackVaryings (programObject, (GLsizei) names.size(),
+					     (const GLint*) &names[0], feedbackMode);
+#else
+		glTransformFeedbackVaryings (programObject, (GLsizei) names.size(),
+					     &names[0], feedbackMode);
+#endif
+		assert (!error_check("Setting Transform Feedback Varyings"));
+
+	}
+
 	// Link the shader into a complete GLSL program.
 	glLinkProgram(programObject);
 
@@ -400,28 +1249,159 @@ void glslKernel::install (bool debug) {
 	glGetProgramiv(programObject, GL_LINK_STATUS, &progLinkSuccess);
 	assert (progLinkSuccess);
 
+	// The previous program goes away with its last reference
+	program = glslProgram (programObject);
+	programReady = true;
+
+	reflect_samplers ();
+
+	// Shaders are freed together with the program
+	if (geometryShader) glDeleteShader (geometryShader);
+	if (fragmentShader) glDeleteShader (fragmentShader);
+	if (vertexShader) glDeleteShader (vertexShader);
+	if (computeShader) glDeleteShader (computeShader);
+
 	if (debug) check_attributes (programObject);
 
 	assert (installed ());
 
 }
 
+/// Finds the sampler uniforms and assigns one texture unit to each
+/// (consecutive units for sampler arrays), setting the uniforms once
+void glslKernel::reflect_samplers (void) {
+
+	samplers.clear();
+
+	GLuint programObject = program.id();
+
+	GLuint shaders[3];
+	GLsizei num_shaders = 0;
+	glGetAttachedShaders (programObject, 3, &num_shaders, shaders);
+
+	bool bindless = false;
+	for (GLsizei i = 0; i < num_shaders; ++i)
+		bindless = bindless || takes_texture_handles (shaders[i]);
+
+	GLint num_uniforms = 0, prev_program = 0, unit = 0;
+	glGetProgramiv (programObject, GL_ACTIVE_UNIFORMS, &num_uniforms);
+	glGetIntegerv (GL_CURRENT_PROGRAM, &prev_program);
+
+	for (GLint i = 0; i < num_uniforms; ++i) {
+
+		GLchar name[256];
+		GLsizei length;
+		GLint size;
+		GLenum type;
+
+		glGetActiveUniform (programObject, i, sizeof(name), &length, &size, &type, name);
+
+		GLenum target = sampler_target (type);
+		if (!target) continue;
+
+		if (length > 3 && strcmp (name + length - 3, "[0]") == 0)
+			name[length - 3] = '\0';
+
+		glslSampler s;
+		s.name = name;
+		s.location = glGetUniformLocation (programObject, name);
+		s.target = target;
+		s.unit = unit;
+		s.bindless = bindless;
+		s.handle = 0;
+
+		vector<GLint> units (size);
+		for (GLint k = 0; k < size; ++k)
+			units[k] = unit++;
+
+		glUseProgram (programObject);
+		glUniform1iv (s.location, size, &units[0]);
+
+		samplers.push_back (s);
+
+	}
+
+	if (!samplers.empty())
+		glUseProgram (prev_program);
+
+	assert (!error_check("Assigning sampler units"));
+
+}
+
 /// Sets the current kernel as the one in use
 /// @arg use_kernel if false, instructs opengl not to use any kernel 
 void glslKernel::use (bool use_kernel) {
 
-	glUseProgram (use_kernel?programObject:0);
+	if (use_kernel && !programReady) {
+
+		program.wait();
+		programReady = true;
+
+	}
+
+	glUseProgram (use_kernel?program.id():0);
 	assert (!error_check("Using shaders"));
 
 }
 
+/// Gets the texture unit assigned to a sampler uniform at install
+/// @arg name name of sampler uniform variable
+/// @return texture unit or -1 if there is no such sampler
+GLint glslKernel::get_sampler_unit (const GLchar* name) {
+
+	for (unsigned int i = 0; i < samplers.size(); i++)
+		if (samplers[i].name == name)
+			return samplers[i].unit;
+
+	return -1;
+
+}
+
+/// Binds a texture to a sampler uniform by name, through a texture
+/// handle when possible or through the sampler texture unit otherwise
+/// @arg name name of sampler uniform variable
+/// @arg texture texture object
+void glslKernel::bind_texture (const GLchar* name, GLuint texture) {
+
+	assert (installed());
+
+	unsigned int i = 0;
+	while (i < samplers.size() && samplers[i].name != name)
+		++i;
+
+	assert (i < samplers.size());
+	glslSampler& s = samplers[i];
+
+	if (s.bindless) {
+
+		GLuint64EXT handle = texture_handle (texture);
+		if (handle == s.handle) return;
+
+		assert (!error_check("Binding texture handle"));
+		glProgramUniformHandleui64ARB (program.id(), s.location, handle);
+
+		if (glGetError() == GL_NO_ERROR) {
+
+			s.handle = handle;
+			return;
+
+		}
+
+		s.bindless = false; // the shader does not take handles: use units
+
+	}
+
+	glsl_bind_texture (s.unit, s.target, texture);
+
+}
+
 /// Gets an uniform location by name
 /// @arg name name of uniform variable
 /// @return location handle of uniform variable
 GLint glslKernel::get_uniform_location (const GLchar* name) {
 
 	assert (installed());
-	return glGetUniformLocation (programObject, name);
+	return glGetUniformLocation (program.id(), name);
 
 }
 
@@ -432,10 +1412,9 @@ GLint glslKernel::get_uniform_location (const GLchar* name) {
 void glslKernel::get_uniform (const GLchar* name, GLfloat *p) {
 
 	assert (installed ());
-	assert (programObject);
-	GLint location = glGetUniformLocation (programObject, name);
+	GLint location = glGetUniformLocation (program.id(), name);
 	assert (location != -1);
-	glGetUniformfv (programObject, location, p);
+	glGetUniformfv (program.id(), location, p);
 	assert (!error_check());
 
 }
@@ -666,8 +1645,7 @@ void glslKernel::set_uniform_matrix (const GLchar* name, const GLfloat* m, GLuin
 GLint glslKernel::get_attribute_index (const GLchar* name) {
 
 	assert (installed());
-	assert (programObject);
-	return glGetAttribLocation (programObject, name);
+	return glGetAttribLocation (program.id(), name);
 
 }
 
@@ -799,7 +1777,21 @@ void glslKernel::set_attribute (const GLchar* name, GLdouble a) {
 /// @arg location index of attribute variable
 void glslKernel::bind_attribute_location (const GLchar* name, GLint index) {
 
-	glBindAttribLocation (programObject, index, name);
+	attribLocations.push_back (std::make_pair (std::string(name), index));
+
+	if (program.id())
+		glBindAttribLocation (program.id(), index, name);
+
+}
+
+/// Sets the vertex outputs captured by transform feedback
+/// @arg names names of output variables
+/// @arg count number of output variables
+/// @arg mode GL_INTERLEAVED_ATTRIBS or GL_SEPARATE_ATTRIBS
+void glslKernel::set_feedback_varyings (const GLchar** names, GLsizei count, GLenum mode) {
+
+	feedbackVaryings.assign (names, names + count);
+	feedbackMode = mode;
 
 }
 
@@ -30,6 +30,111 @@
 #include <GLee.h> ///< You need GLee in a default include directory
 #endif
 
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+///
+/// Extension entry points not covered by GLee (GLEW already has them),
+/// resolved at run time by the corresponding *_support() function
+///
+
+#ifndef GL_ARB_bindless_texture
+#define GL_ARB_bindless_texture 1
+#define __GLSL_ARB_bindless_texture__
+typedef GLuint64EXT (APIENTRYP PFNGLGETTEXTUREHANDLEARBPROC) (GLuint texture);
+typedef void (APIENTRYP PFNGLMAKETEXTUREHANDLERESIDENTARBPROC) (GLuint64EXT handle);
+typedef void (APIENTRYP PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC) (GLuint64EXT handle);
+typedef void (APIENTRYP PFNGLPROGRAMUNIFORMHANDLEUI64ARBPROC) (GLuint program, GLint location, GLuint64EXT value);
+extern PFNGLGETTEXTUREHANDLEARBPROC pglslGetTextureHandleARB;
+extern PFNGLMAKETEXTUREHANDLERESIDENTARBPROC pglslMakeTextureHandleResidentARB;
+extern PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC pglslMakeTextureHandleNonResidentARB;
+extern PFNGLPROGRAMUNIFORMHANDLEUI64ARBPROC pglslProgramUniformHandleui64ARB;
+#define glGetTextureHandleARB pglslGetTextureHandleARB
+#define glMakeTextureHandleResidentARB pglslMakeTextureHandleResidentARB
+#define glMakeTextureHandleNonResidentARB pglslMakeTextureHandleNonResidentARB
+#define glProgramUniformHandleui64ARB pglslProgramUniformHandleui64ARB
+#endif
+
+#ifndef GL_ARB_sync
+#define GL_ARB_sync 1
+#define __GLSL_ARB_sync__
+typedef struct __GLsync* GLsync;
+#define GL_OBJECT_TYPE                   0x9112
+#define GL_SYNC_CONDITION                0x9113
+#define GL_SYNC_STATUS                   0x9114
+#define GL_SYNC_FLAGS                    0x9115
+#define GL_SYNC_FENCE                    0x9116
+#define GL_SYNC_GPU_COMMANDS_COMPLETE    0x9117
+#define GL_UNSIGNALED                    0x9118
+#define GL_SIGNALED                      0x9119
+#define GL_ALREADY_SIGNALED              0x911A
+#define GL_TIMEOUT_EXPIRED               0x911B
+#define GL_CONDITION_SATISFIED           0x911C
+#define GL_WAIT_FAILED                   0x911D
+#define GL_SYNC_FLUSH_COMMANDS_BIT       0x00000001
+#define GL_TIMEOUT_IGNORED               0xFFFFFFFFFFFFFFFFull
+typedef GLsync (APIENTRYP PFNGLFENCESYNCPROC) (GLenum condition, GLbitfield flags);
+typedef void (APIENTRYP PFNGLDELETESYNCPROC) (GLsync sync);
+typedef GLenum (APIENTRYP PFNGLCLIENTWAITSYNCPROC) (GLsync sync, GLbitfield flags, GLuint64EXT timeout);
+typedef void (APIENTRYP PFNGLWAITSYNCPROC) (GLsync sync, GLbitfield flags, GLuint64EXT timeout);
+extern PFNGLFENCESYNCPROC pglslFenceSync;
+extern PFNGLDELETESYNCPROC pglslDeleteSync;
+extern PFNGLCLIENTWAITSYNCPROC pglslClientWaitSync;
+extern PFNGLWAITSYNCPROC pglslWaitSync;
+#define glFenceSync pglslFenceSync
+#define glDeleteSync pglslDeleteSync
+#define glClientWaitSync pglslClientWaitSync
+#define glWaitSync pglslWaitSync
+#endif
+
+#ifndef GL_ARB_copy_buffer
+#define GL_ARB_copy_buffer 1
+#define __GLSL_ARB_copy_buffer__
+#define GL_COPY_READ_BUFFER              0x8F36
+#define GL_COPY_WRITE_BUFFER             0x8F37
+typedef void (APIENTRYP PFNGLCOPYBUFFERSUBDATAPROC) (GLenum readTarget, GLenum writeTarget,
+						     GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size);
+extern PFNGLCOPYBUFFERSUBDATAPROC pglslCopyBufferSubData;
+#define glCopyBufferSubData pglslCopyBufferSubData
+#endif
+
+#ifndef GL_ARB_compute_shader
+#define GL_ARB_compute_shader 1
+#define __GLSL_ARB_compute_shader__
+#define GL_COMPUTE_SHADER                     0x91B9
+#define GL_MAX_COMPUTE_SHARED_MEMORY_SIZE     0x8262
+#define GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS 0x90EB
+#define GL_MAX_COMPUTE_WORK_GROUP_COUNT       0x91BE
+#define GL_MAX_COMPUTE_WORK_GROUP_SIZE        0x91BF
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEPROC) (GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
+extern PFNGLDISPATCHCOMPUTEPROC pglslDispatchCompute;
+#define glDispatchCompute pglslDispatchCompute
+#endif
+
+#ifndef GL_ARB_shader_storage_buffer_object
+#define GL_ARB_shader_storage_buffer_object 1
+#define GL_SHADER_STORAGE_BUFFER              0x90D2
+#define GL_SHADER_STORAGE_BARRIER_BIT         0x00002000
+#endif
+
+#ifndef GL_ARB_shader_image_load_store
+#define GL_ARB_shader_image_load_store 1
+#define __GLSL_ARB_shader_image_load_store__
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT    0x00000001
+#define GL_BUFFER_UPDATE_BARRIER_BIT          0x00000200
+#define GL_ALL_BARRIER_BITS                   0xFFFFFFFF
+typedef void (APIENTRYP PFNGLMEMORYBARRIERPROC) (GLbitfield barriers);
+extern PFNGLMEMORYBARRIERPROC pglslMemoryBarrier;
+#define glMemoryBarrier pglslMemoryBarrier
+#endif
+
+/// Resolves an OpenGL entry point by name
+/// @arg name name of the OpenGL function
+/// @return function address or 0 if it is not available
+void* glsl_proc_address (const char* name);
+
 /// Tells whether the system support OpenGL SL capabilities
 /// @return true if the system is ready for OpenGL SL
 bool glsl_support();
@@ -38,26 +143,212 @@ bool glsl_support();
 /// @return true if the graphics board could run Geometry Shader
 bool geom_shader_support ();
 
+/// Tells whether graphics board support transform feedback (OpenGL 3.0)
+/// @return true if vertex outputs can be captured into buffers
+bool transform_feedback_support ();
+
+/// Tells whether graphics board support fence sync objects
+/// @return true if glFenceSync and friends can be used
+bool sync_support ();
+
+/// Tells whether graphics board support copies between buffer objects
+/// (OpenGL 3.1)
+/// @return true if glCopyBufferSubData can be used
+bool copy_buffer_support ();
+
+/// Tells whether graphics board support compute shaders over shader
+/// storage buffers (OpenGL 4.3)
+/// @return true if glDispatchCompute and glMemoryBarrier can be used
+bool compute_shader_support ();
+
+/// Tells whether graphics board support instanced draws with per instance
+/// attributes (OpenGL 3.3)
+/// @return true if glDrawArraysInstancedARB and glVertexAttribDivisor can be used
+bool instancing_support ();
+
+/// Tells whether graphics board support GPU timer queries
+/// @return true if GL_TIME_ELAPSED queries can be used
+bool timer_query_support ();
+
+/// Gets the OpenGL context current in the calling thread
+/// @return platform context handle or 0 if no context is current
+void* glsl_current_context ();
+
+/// Tells whether graphics board support bindless textures
+/// @return true if texture handles can be used instead of texture units
+bool bindless_texture_support ();
+
+/// Binds a texture to a texture unit, skipping the call if the texture
+/// is already bound there (the last binding of each unit is cached for
+/// each context, as texture units are not shared between contexts)
+/// @arg unit texture unit number
+/// @arg target texture target, e.g. GL_TEXTURE_2D
+/// @arg texture texture object
+void glsl_bind_texture (GLint unit, GLenum target, GLuint texture);
+
+/// Forgets the cached texture bindings of the current context
+/// Call it after binding textures directly through OpenGL
+void glsl_reset_texture_cache ();
+
+/// Forgets the texture bindings and handles cached for the current
+/// context. Call it before destroying the context, as a new context
+/// may be created at the same address
+void glsl_release_context ();
+
+/// Releases the bindless handle and the cached bindings of a texture
+/// Call it before deleting a texture given to glslKernel::bind_texture
+/// @arg texture texture object
+void glsl_release_texture (GLuint texture);
+
+/// Sampler uniform of a GLSL program and the texture unit assigned to it
+struct glslSampler {
+
+	std::string name; ///< Uniform name
+	GLint location; ///< Uniform location
+	GLenum target; ///< Texture target matching the sampler type
+	GLint unit; ///< Texture unit assigned at install
+	bool bindless; ///< Whether the sampler accepts texture handles
+	GLuint64EXT handle; ///< Texture handle last set to the sampler
+
+};
+
+/// Immutable view of a shader source text stored in a glslSourceArena
+/// The text is NUL-terminated and length does not count the terminator
+struct glslSourceView {
+
+	const GLchar* text; ///< Shader source text
+	GLint length; ///< Number of characters in text
+
+};
+
+///
+/// Arena of shader sources: each file is read at once into one
+/// contiguous blob, so loading costs no per-line allocation and no
+/// line length limit.  Views remain valid until clear() or destruction.
+/// An arena is not thread-safe: use one arena per loading thread.
+///
+class glslSourceArena {
+
+	std::vector<GLchar*> blocks; ///< Memory blocks owned by the arena
+	size_t blockSize; ///< Default size of a new block in Bytes
+	size_t used; ///< Bytes used in the current block
+	size_t capacity; ///< Bytes available in the current block
+
+	glslSourceArena (const glslSourceArena&); ///< Non-copyable
+	glslSourceArena& operator = (const glslSourceArena&); ///< Non-copyable
+
+	/// Reserves n Bytes in the arena
+	/// @arg n number of Bytes
+	/// @return pointer to the reserved Bytes
+	GLchar* allocate (size_t n);
+
+public:
+	/// Constructor
+	/// @arg block_size default size of each memory block in Bytes
+	glslSourceArena (size_t block_size = 64 * 1024);
+
+	/// Destructor
+	~glslSourceArena ();
+
+	/// Reads a whole shader source file into the arena
+	/// @arg filename name of shader source file
+	/// @return view of the file text
+	glslSourceView load (const char* filename);
+
+	/// Releases all sources, invalidating every view given so far
+	void clear (void);
+
+};
+
+///
+/// Reference-counted handle to a linked GLSL program object
+/// Copies share the program, which is deleted with the last handle if a
+/// context is current (otherwise it goes away with its share group).
+/// A program linked in a loader context is published with a fence that
+/// each consumer waits on before its first use in another context.
+///
+class glslProgram {
+
+	struct shared {
+
+		GLuint program; ///< The GLSL program object
+		std::atomic<int> references; ///< Number of handles
+		std::atomic<GLsync> ready; ///< Fence signaled when the program is built
+
+	};
+
+	shared* obj; ///< Shared program state (0 for the null handle)
+
+	/// Drops this handle reference, deleting the program with the last one
+	void release (void);
+
+public:
+	/// Constructor
+	/// @arg program linked program object to take ownership of (0 for null)
+	explicit glslProgram (GLuint program = 0);
+
+	/// Copy and move constructors and assignments
+	glslProgram (const glslProgram& other);
+	glslProgram (glslProgram&& other);
+	glslProgram& operator = (const glslProgram& other);
+	glslProgram& operator = (glslProgram&& other);
+
+	/// Destructor
+	~glslProgram ();
+
+	/// Program object
+	/// @return program object or 0 for the null handle
+	GLuint id (void) const;
+
+	/// Number of handles sharing the program
+	/// @return reference count
+	int references (void) const;
+
+	/// Marks the point where the program is ready for other contexts
+	/// Call it in the context that built the program before handing it off
+	void publish (void);
+
+	/// Makes the current context wait until the program is ready
+	/// (the wait happens on the GPU and does not block the caller)
+	void wait (void) const;
+
+};
+
 ///
 /// Each GLSL Kernel contains one GLSL program with shaders
 /// Note: To read more about OpenGL Shading Language (GLSL)
 /// programming go to:   http://www.opengl.org/documentation/glsl/
 ///
+/// Kernels are move-only: ownership of the program moves with the kernel,
+/// and share() gives another kernel on the same program, e.g. for a
+/// second context of the same share group.
+///
 class glslKernel {
 
-	GLuint programObject;    ///< The GLSL program
-	GLuint geometryShader;   ///< Geometry Shader
-	GLuint fragmentShader;   ///< Fragment Shader
-	GLuint vertexShader;     ///< Vertex Shader
+	glslProgram program;     ///< The GLSL program
+	bool programReady;       ///< Whether use() already waited for the program
 	const GLchar** geomSource; ///< Geometry shader source
 	const GLchar** fragSource; ///< Fragment shader source
 	const GLchar** vtxSource;  ///< Vertex shader source
 	const GLchar* geomFileName; ///< Geometry shader source filename
 	const GLchar* fragFileName; ///< Fragment shader source filename
 	const GLchar* vtxFileName;  ///< Vertex shader source filename
+	glslSourceView geomView; ///< Geometry shader source loaded by the caller
+	glslSourceView fragView; ///< Fragment shader source loaded by the caller
+	glslSourceView vtxView;  ///< Vertex shader source loaded by the caller
+	const GLchar* compFileName; ///< Compute shader source filename
+	glslSourceView compView; ///< Compute shader source loaded by the caller
+	std::string defines; ///< #define lines inserted after the #version line
 	GLint geomVtxOut;  ///< Geometry Shader maximum number of output vertices
 	GLint geomTypeIn;  ///< Geometry Shader input primitive type
 	GLint geomTypeOut; ///< Geometry Shader output primitive type
+	std::vector<std::string> feedbackVaryings; ///< Transform feedback outputs
+	GLenum feedbackMode; ///< Transform feedback buffer mode
+	std::vector< std::pair<std::string, GLint> > attribLocations; ///< Attribute bindings
+	std::vector<glslSampler> samplers; ///< Sampler uniforms of the program
+
+	/// Finds the sampler uniforms and assigns one texture unit to each
+	void reflect_samplers (void);
 
 public:
 	/// Constructor
@@ -69,8 +360,30 @@ public:
 		    const GLchar ** vtx_source = 0);
 
 	/// Destructor
+	/// Drops the kernel program reference without touching the bound program
 	~glslKernel ();
 
+	/// Kernels are not copyable, use share() to reference the same program
+	glslKernel (const glslKernel&) = delete;
+	glslKernel& operator = (const glslKernel&) = delete;
+
+	/// Move constructor and assignment
+	glslKernel (glslKernel&&) = default;
+	glslKernel& operator = (glslKernel&&) = default;
+
+	/// Gives another kernel running the same program object
+	/// @return kernel sharing the program and the sampler units
+	glslKernel share (void) const;
+
+	/// Gets the program handle of this kernel
+	/// @return reference-counted program handle
+	const glslProgram& get_program (void) const;
+
+	/// Publishes the installed program for use in other contexts
+	/// Call it in the loader context right after install; the first use
+	/// afterwards, in this kernel or in one moved from it, waits once
+	void publish (void);
+
 	/// Size of GLSL Kernel
 	/// @return openGL usage in Bytes
 	int size_of(void);
@@ -87,6 +400,26 @@ public:
 	/// @arg filename name of vertex source file
 	void vertex_source (const GLchar* filename);
 
+	/// Sets an already loaded {geometry|fragment|vertex} shader source
+	/// The text must outlive the next call to install
+	/// @arg source view of shader source text, usually from a glslSourceArena
+	void geometry_source (const glslSourceView& source);
+	void fragment_source (const glslSourceView& source);
+	void vertex_source (const glslSourceView& source);
+
+	/// Sets the compute shader source, by file name or already loaded
+	/// A compute shader is the only stage of its program
+	/// @arg filename name of compute shader source file
+	/// @arg source view of compute shader source text
+	void compute_source (const GLchar* filename);
+	void compute_source (const glslSourceView& source);
+
+	/// Defines a preprocessor macro in every shader, applied on install
+	/// Defining it again replaces the previous value
+	/// @arg name macro name
+	/// @arg value macro value
+	void set_define (const GLchar* name, GLint value);
+
 	/// Tells whether the GLSL program is ready to run
 	/// @return true if and only if a program object was built
 	bool installed ();
@@ -97,9 +430,23 @@ public:
 	void install (bool debug = false);
 
 	/// Sets the current kernel as the one in use
+	/// The first use waits for a program published by another context
 	/// @arg use_kernel if false, instructs opengl not to use any kernel 
 	void use (bool use_kernel = true);
 	
+	/// Gets the texture unit assigned to a sampler uniform at install
+	/// @arg name name of sampler uniform variable
+	/// @return texture unit or -1 if there is no such sampler
+	GLint get_sampler_unit (const GLchar* name);
+
+	/// Binds a texture to a sampler uniform by name, through a texture
+	/// handle when bindless textures are available and the shader
+	/// accepts them, or through the sampler texture unit otherwise.
+	/// Redundant bindings are skipped.
+	/// @arg name name of sampler uniform variable
+	/// @arg texture texture object
+	void bind_texture (const GLchar* name, GLuint texture);
+
 	/// Gets an uniform location by name
 	/// @arg name name of uniform variable
 	/// @return location handle of uniform variable
@@ -208,10 +555,19 @@ public:
 	void set_attribute (const GLchar* name, GLdouble a);
 
 	/// Associates an attribute with a specefic index.
+	/// The binding is kept and applied on every install before linking
 	/// @arg name name of attribute variable
 	/// @arg location index of attribute variable
 	void bind_attribute_location (const GLchar* name, GLint index);
 
+	/// Sets the vertex outputs captured by transform feedback, applied
+	/// on install before linking
+	/// @arg names names of output variables
+	/// @arg count number of output variables
+	/// @arg mode GL_INTERLEAVED_ATTRIBS or GL_SEPARATE_ATTRIBS
+	void set_feedback_varyings (const GLchar** names, GLsizei count,
+				    GLenum mode = GL_INTERLEAVED_ATTRIBS);
+
 	/// Sets the maximum number of output vertices by the Geometry Shader
 	/// @arg vtx_out maximum number of output vertices
 	void set_geom_max_output_vertices (const GLint& vtx_out);
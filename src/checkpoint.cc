@@ -0,0 +1,109 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  checkpoint.cc -- Particle state saved to and resumed from a file
+ *
+ **/
+
+#include "checkpoint.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// Sections start on page boundaries, so each array maps page-aligned
+static const uint64_t PAGE = 4096;
+
+static uint64_t page_up( uint64_t n ) { return (n + PAGE - 1) & ~(PAGE - 1); }
+
+bool particleCheckpoint::write( const char *filename, header h, const float *pos, const float *vel,
+				const float *orig_vel ) {
+
+	FILE *f = fopen(filename, "wb");
+	if (!f)
+		return false;
+
+	memcpy(h.magic, "PCKP", 4);
+	h.version = 1;
+
+	uint64_t bytes = 4*sizeof(float)*(uint64_t)h.numParticles;
+	for (int k = 0; k < 3; ++k)
+		h.offsets[k] = PAGE + k*page_up(bytes);
+
+	const float *arrays[3] = { pos, vel, orig_vel };
+
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+
+	for (int k = 0; k < 3 && ok; ++k)
+		ok = fseek(f, h.offsets[k], SEEK_SET) == 0 &&
+			fwrite(arrays[k], 1, bytes, f) == bytes;
+
+	// the last array is padded too, so every section is whole pages
+	if (ok && page_up(bytes) > bytes)
+		ok = fseek(f, h.offsets[2] + page_up(bytes) - 1, SEEK_SET) == 0 && fputc(0, f) != EOF;
+
+	return fclose(f) == 0 && ok;
+
+}
+
+/// The mapping is populated up front where the system allows it, so
+/// the upload that follows does not fault page by page
+
+bool particleCheckpoint::open( const char *filename ) {
+
+	close();
+
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header)) {
+		::close(fd);
+		return false;
+	}
+
+	int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+	flags |= MAP_POPULATE;
+#endif
+
+	void *p = mmap(0, st.st_size, PROT_READ, flags, fd, 0);
+	::close(fd);
+
+	if (p == MAP_FAILED)
+		return false;
+
+	data = (const unsigned char*)p;
+	length = st.st_size;
+
+	const header& h = info();
+	uint64_t bytes = 4*sizeof(float)*(uint64_t)h.numParticles;
+
+	bool ok = memcmp(h.magic, "PCKP", 4) == 0 && h.version == 1;
+	for (int k = 0; k < 3 && ok; ++k)
+		ok = h.offsets[k] % PAGE == 0 && h.offsets[k] + bytes <= length;
+
+	if (!ok) {
+		close();
+		return false;
+	}
+
+	return true;
+
+}
+
+void particleCheckpoint::close( void ) {
+
+	if (data)
+		munmap((void*)data, length);
+
+	data = 0;
+	length = 0;
+
+}
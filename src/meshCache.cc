@@ -0,0 +1,392 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  meshCache.cc -- Models of the shaders examples kept in buffer objects
+ *
+ **/
+
+#include "meshCache.h"
+
+#include <stddef.h>
+#include <math.h>
+#include <assert.h>
+
+/// Quads along each side of a teapot patch, as the GLUT teapot
+static const GLuint TEAPOT_GRID = 14;
+
+/// Slices and stacks of the sphere
+static const GLuint SPHERE_SLICES = 150, SPHERE_STACKS = 150;
+
+/// Control points of the Newell teapot, z up
+static const GLfloat teapotPoints[][3] = {
+	{ 1.4, 0.0, 2.4 }, { 1.4, -0.784, 2.4 }, { 0.784, -1.4, 2.4 },
+	{ 0.0, -1.4, 2.4 }, { 1.3375, 0.0, 2.53125 }, { 1.3375, -0.749, 2.53125 },
+	{ 0.749, -1.3375, 2.53125 }, { 0.0, -1.3375, 2.53125 }, { 1.4375, 0.0, 2.53125 },
+	{ 1.4375, -0.805, 2.53125 }, { 0.805, -1.4375, 2.53125 }, { 0.0, -1.4375, 2.53125 },
+	{ 1.5, 0.0, 2.4 }, { 1.5, -0.84, 2.4 }, { 0.84, -1.5, 2.4 },
+	{ 0.0, -1.5, 2.4 }, { 1.75, 0.0, 1.875 }, { 1.75, -0.98, 1.875 },
+	{ 0.98, -1.75, 1.875 }, { 0.0, -1.75, 1.875 }, { 2.0, 0.0, 1.35 },
+	{ 2.0, -1.12, 1.35 }, { 1.12, -2.0, 1.35 }, { 0.0, -2.0, 1.35 },
+	{ 2.0, 0.0, 0.9 }, { 2.0, -1.12, 0.9 }, { 1.12, -2.0, 0.9 },
+	{ 0.0, -2.0, 0.9 }, { 2.0, 0.0, 0.45 }, { 2.0, -1.12, 0.45 },
+	{ 1.12, -2.0, 0.45 }, { 0.0, -2.0, 0.45 }, { 1.5, 0.0, 0.225 },
+	{ 1.5, -0.84, 0.225 }, { 0.84, -1.5, 0.225 }, { 0.0, -1.5, 0.225 },
+	{ 1.5, 0.0, 0.15 }, { 1.5, -0.84, 0.15 }, { 0.84, -1.5, 0.15 },
+	{ 0.0, -1.5, 0.15 }, { 0.0, 0.0, 3.15 }, { 0.0, -0.002, 3.15 },
+	{ 0.002, 0.0, 3.15 }, { 0.8, 0.0, 3.15 }, { 0.8, -0.45, 3.15 },
+	{ 0.45, -0.8, 3.15 }, { 0.0, -0.8, 3.15 }, { 0.0, 0.0, 2.85 },
+	{ 0.2, 0.0, 2.7 }, { 0.2, -0.112, 2.7 }, { 0.112, -0.2, 2.7 },
+	{ 0.0, -0.2, 2.7 }, { 0.4, 0.0, 2.55 }, { 0.4, -0.224, 2.55 },
+	{ 0.224, -0.4, 2.55 }, { 0.0, -0.4, 2.55 }, { 1.3, 0.0, 2.55 },
+	{ 1.3, -0.728, 2.55 }, { 0.728, -1.3, 2.55 }, { 0.0, -1.3, 2.55 },
+	{ 1.3, 0.0, 2.4 }, { 1.3, -0.728, 2.4 }, { 0.728, -1.3, 2.4 },
+	{ 0.0, -1.3, 2.4 }, { 0.0, 0.0, 0.0 }, { 0.0, -1.425, 0.0 },
+	{ 0.798, -1.425, 0.0 }, { 1.425, -0.798, 0.0 }, { 1.425, 0.0, 0.0 },
+	{ 0.0, -1.5, 0.075 }, { 0.84, -1.5, 0.075 }, { 1.5, -0.84, 0.075 },
+	{ 1.5, 0.0, 0.075 }, { -1.6, 0.0, 2.025 }, { -1.6, -0.3, 2.025 },
+	{ -1.5, -0.3, 2.25 }, { -1.5, 0.0, 2.25 }, { -2.3, 0.0, 2.025 },
+	{ -2.3, -0.3, 2.025 }, { -2.5, -0.3, 2.25 }, { -2.5, 0.0, 2.25 },
+	{ -2.7, 0.0, 2.025 }, { -2.7, -0.3, 2.025 }, { -3.0, -0.3, 2.25 },
+	{ -3.0, 0.0, 2.25 }, { -2.7, 0.0, 1.8 }, { -2.7, -0.3, 1.8 },
+	{ -3.0, -0.3, 1.8 }, { -3.0, 0.0, 1.8 }, { -2.7, 0.0, 1.575 },
+	{ -2.7, -0.3, 1.575 }, { -3.0, -0.3, 1.35 }, { -3.0, 0.0, 1.35 },
+	{ -2.5, 0.0, 1.125 }, { -2.5, -0.3, 1.125 }, { -2.65, -0.3, 0.9375 },
+	{ -2.65, 0.0, 0.9375 }, { -2.0, 0.0, 0.9 }, { -2.0, -0.3, 0.9 },
+	{ -1.9, -0.3, 0.6 }, { -1.9, 0.0, 0.6 }, { 1.7, 0.0, 1.425 },
+	{ 1.7, -0.66, 1.425 }, { 1.7, -0.66, 0.6 }, { 1.7, 0.0, 0.6 },
+	{ 2.6, 0.0, 1.425 }, { 2.6, -0.66, 1.425 }, { 3.1, -0.66, 0.825 },
+	{ 3.1, 0.0, 0.825 }, { 2.3, 0.0, 2.1 }, { 2.3, -0.25, 2.1 },
+	{ 2.4, -0.25, 2.025 }, { 2.4, 0.0, 2.025 }, { 2.7, 0.0, 2.4 },
+	{ 2.7, -0.25, 2.4 }, { 3.3, -0.25, 2.4 }, { 3.3, 0.0, 2.4 },
+	{ 2.8, 0.0, 2.475 }, { 2.8, -0.25, 2.475 }, { 3.525, -0.25, 2.49375 },
+	{ 3.525, 0.0, 2.49375 }, { 2.9, 0.0, 2.475 }, { 2.9, -0.15, 2.475 },
+	{ 3.45, -0.15, 2.5125 }, { 3.45, 0.0, 2.5125 }, { 2.8, 0.0, 2.4 },
+	{ 2.8, -0.15, 2.4 }, { 3.2, -0.15, 2.4 }, { 3.2, 0.0, 2.4 },
+};
+
+/// Bezier patches of the teapot over the control points, rows of four:
+/// the rim, body, lid and bottom patches of one quarter, then half the
+/// handle and the spout
+static const int NUM_TEAPOT_PATCHES = 10;
+static const int teapotPatches[NUM_TEAPOT_PATCHES][16] = {
+	{   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,  15 },
+	{  12,  13,  14,  15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25,  26,  27 },
+	{  24,  25,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39 },
+	{  40,  41,  42,  40,  43,  44,  45,  46,  47,  47,  47,  47,  48,  49,  50,  51 },
+	{  48,  49,  50,  51,  52,  53,  54,  55,  56,  57,  58,  59,  60,  61,  62,  63 },
+	{  64,  64,  64,  64,  65,  66,  67,  68,  69,  70,  71,  72,  39,  38,  37,  36 },
+	{  73,  74,  75,  76,  77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  88 },
+	{  85,  86,  87,  88,  89,  90,  91,  92,  93,  94,  95,  96,  97,  98,  99, 100 },
+	{ 101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111, 112, 113, 114, 115, 116 },
+	{ 113, 114, 115, 116, 117, 118, 119, 120, 121, 122, 123, 124, 125, 126, 127, 128 },
+};
+
+static inline void cross (const GLfloat a[3], const GLfloat b[3], GLfloat r[3]) {
+	r[0] = a[1]*b[2] - a[2]*b[1]; r[1] = a[2]*b[0] - a[0]*b[2]; r[2] = a[0]*b[1] - a[1]*b[0];
+}
+
+static inline GLfloat normalize (GLfloat v[3]) {
+	GLfloat l = sqrtf(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+	if (l > 0.0f) { v[0] /= l; v[1] /= l; v[2] /= l; }
+	return l;
+}
+
+/// Cubic Bernstein polynomials and their derivatives
+/// @arg t parameter
+/// @arg b, d values and derivatives
+
+static inline void bernstein (GLfloat t, GLfloat b[4], GLfloat d[4]) {
+
+	GLfloat s = 1.0f - t;
+
+	b[0] = s*s*s; b[1] = 3.0f*t*s*s; b[2] = 3.0f*t*t*s; b[3] = t*t*t;
+	d[0] = -3.0f*s*s; d[1] = 3.0f*s*s - 6.0f*t*s; d[2] = 6.0f*t*s - 3.0f*t*t; d[3] = 3.0f*t*t;
+
+}
+
+/// Point of a bicubic Bezier patch and its partial derivatives
+/// @arg cp control points, rows along v of four points along u
+/// @arg u, v parameters
+/// @arg p, pu, pv point and derivatives
+
+static void bezierPatch (const GLfloat cp[4][4][3], GLfloat u, GLfloat v, GLfloat p[3], GLfloat pu[3], GLfloat pv[3]) {
+
+	GLfloat bu[4], du[4], bv[4], dv[4];
+	bernstein(u, bu, du);
+	bernstein(v, bv, dv);
+
+	for (int k = 0; k < 3; ++k) {
+		p[k] = pu[k] = pv[k] = 0.0f;
+		for (int i = 0; i < 4; ++i)
+			for (int j = 0; j < 4; ++j) {
+				p[k] += bv[i]*bu[j]*cp[i][j][k];
+				pu[k] += bv[i]*du[j]*cp[i][j][k];
+				pv[k] += dv[i]*bu[j]*cp[i][j][k];
+			}
+	}
+
+}
+
+/// Sign of the bitangent along which t grows, against the one the
+/// normal and the tangent make
+/// @arg n, t normal and tangent
+/// @arg dt derivative of the position along t
+
+static inline GLfloat handedness (const GLfloat n[3], const GLfloat t[3], const GLfloat dt[3]) {
+
+	GLfloat b[3];
+	cross(n, t, b);
+	return (b[0]*dt[0] + b[1]*dt[1] + b[2]*dt[2] < 0.0f) ? -1.0f : 1.0f;
+
+}
+
+meshCache::meshCache () {
+
+	for (int m = 0; m < NUM_MODELS; ++m) {
+		meshes[m].vbo = meshes[m].ibo = 0;
+		meshes[m].count = 0;
+	}
+
+}
+
+void meshCache::build (void) {
+
+	std::vector< vertex > vertices;
+	std::vector< GLuint > indices;
+
+	sphere(SPHERE_SLICES, SPHERE_STACKS, vertices, indices);
+	upload(SPHERE, vertices, indices);
+
+	teapot(TEAPOT_GRID, vertices, indices);
+	upload(TEAPOT, vertices, indices);
+
+	quad(vertices, indices);
+	upload(QUAD, vertices, indices);
+
+}
+
+/// Client arrays over the buffers, left enabled only for the call
+
+void meshCache::draw (int m) const {
+
+	assert( m >= 0 && m < NUM_MODELS && meshes[m].vbo );
+
+	glBindBuffer(GL_ARRAY_BUFFER, meshes[m].vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshes[m].ibo);
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, sizeof(vertex), (const GLvoid*)offsetof(vertex, position));
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glNormalPointer(GL_FLOAT, sizeof(vertex), (const GLvoid*)offsetof(vertex, normal));
+
+	glClientActiveTexture(GL_TEXTURE1);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glTexCoordPointer(4, GL_FLOAT, sizeof(vertex), (const GLvoid*)offsetof(vertex, tangent));
+	glClientActiveTexture(GL_TEXTURE0);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glTexCoordPointer(2, GL_FLOAT, sizeof(vertex), (const GLvoid*)offsetof(vertex, texCoord));
+
+	glDrawElements(GL_TRIANGLES, meshes[m].count, GL_UNSIGNED_INT, 0);
+
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glClientActiveTexture(GL_TEXTURE1);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glClientActiveTexture(GL_TEXTURE0);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+}
+
+void meshCache::clear (void) {
+
+	for (int m = 0; m < NUM_MODELS; ++m) {
+		if (meshes[m].vbo) {
+			glDeleteBuffers(1, &meshes[m].vbo);
+			glDeleteBuffers(1, &meshes[m].ibo);
+		}
+		meshes[m].vbo = meshes[m].ibo = 0;
+		meshes[m].count = 0;
+	}
+
+}
+
+/// Stacks go from +z down to -z, t from 1 to 0, and slices start at +y
+/// turning towards -x, s from 0 to 1, as gluSphere with texture on; the
+/// last slice repeats the first with s = 1
+
+void meshCache::sphere (GLuint slices, GLuint stacks, std::vector< vertex >& vertices, std::vector< GLuint >& indices) {
+
+	vertices.clear();
+	indices.clear();
+
+	for (GLuint i = 0; i <= stacks; ++i) {
+
+		GLfloat rho = M_PI * i / stacks;
+
+		for (GLuint j = 0; j <= slices; ++j) {
+
+			GLfloat theta = (j == slices) ? 0.0f : 2.0f * M_PI * j / slices;
+
+			vertex v;
+			v.normal[0] = -sinf(theta) * sinf(rho);
+			v.normal[1] = cosf(theta) * sinf(rho);
+			v.normal[2] = cosf(rho);
+			for (int k = 0; k < 3; ++k)
+				v.position[k] = v.normal[k];
+
+			v.texCoord[0] = (GLfloat)j / slices;
+			v.texCoord[1] = 1.0f - (GLfloat)i / stacks;
+
+			// along the slices, defined at the poles too
+			v.tangent[0] = -cosf(theta);
+			v.tangent[1] = -sinf(theta);
+			v.tangent[2] = 0.0f;
+
+			const GLfloat dt[3] = { sinf(theta) * cosf(rho), -cosf(theta) * cosf(rho), sinf(rho) };
+			v.tangent[3] = handedness(v.normal, v.tangent, dt);
+
+			vertices.push_back(v);
+
+		}
+
+	}
+
+	grid(0, slices, stacks, indices);
+
+}
+
+/// The patches of one quarter are mirrored around the z axis four ways,
+/// the handle and the spout across the y = 0 plane, the mirrors reversing
+/// the rows so the winding holds. Then the teapot is turned y up, halved
+/// and lowered 0.75 as glutSolidTeapot does. The derivatives vanish along
+/// the rows (nearly) collapsed to a point, the top of the lid and the
+/// center of the bottom, so they are taken a little inside the patch
+
+void meshCache::teapot (GLuint n, std::vector< vertex >& vertices, std::vector< GLuint >& indices) {
+
+	vertices.clear();
+	indices.clear();
+
+	for (int p = 0; p < NUM_TEAPOT_PATCHES; ++p) {
+
+		int copies = (p < 6) ? 4 : 2;
+
+		for (int k = 0; k < copies; ++k) {
+
+			GLfloat sx = (copies == 4 && (k & 1)) ? -1.0f : 1.0f;
+			GLfloat sy = (k & (copies / 2)) ? -1.0f : 1.0f;
+			bool mirrored = (sx * sy < 0.0f);
+
+			GLfloat cp[4][4][3];
+			for (int i = 0; i < 4; ++i)
+				for (int j = 0; j < 4; ++j) {
+					const GLfloat *q = teapotPoints[ teapotPatches[p][i*4 + (mirrored ? 3 - j : j)] ];
+					cp[i][j][0] = sx * q[0];
+					cp[i][j][1] = sy * q[1];
+					cp[i][j][2] = q[2];
+				}
+
+			GLuint first = vertices.size();
+
+			for (GLuint r = 0; r <= n; ++r) {
+
+				for (GLuint c = 0; c <= n; ++c) {
+
+					GLfloat u = (GLfloat)r / n, v = (GLfloat)c / n;
+					GLfloat pos[3], pu[3], pv[3], nrm[3];
+
+					bezierPatch(cp, u, v, pos, pu, pv);
+
+					GLfloat ui = fminf(fmaxf(u, 1e-3f), 1.0f - 1e-3f);
+					GLfloat vi = fminf(fmaxf(v, 1e-3f), 1.0f - 1e-3f);
+					GLfloat q[3];
+					bezierPatch(cp, ui, vi, q, pu, pv);
+					cross(pu, pv, nrm);
+					normalize(nrm);
+
+					GLfloat tng[3] = { pu[0], pu[1], pu[2] };
+					normalize(tng);
+
+					vertex vtx;
+					vtx.position[0] = 0.5f * pos[0];
+					vtx.position[1] = 0.5f * (pos[2] - 1.5f);
+					vtx.position[2] = -0.5f * pos[1];
+					vtx.normal[0] = nrm[0]; vtx.normal[1] = nrm[2]; vtx.normal[2] = -nrm[1];
+					vtx.tangent[0] = tng[0]; vtx.tangent[1] = tng[2]; vtx.tangent[2] = -tng[1];
+					vtx.tangent[3] = handedness(nrm, tng, pv);
+					vtx.texCoord[0] = u;
+					vtx.texCoord[1] = v;
+
+					vertices.push_back(vtx);
+
+				}
+
+			}
+
+			grid(first, n, n, indices);
+
+		}
+
+	}
+
+}
+
+void meshCache::quad (std::vector< vertex >& vertices, std::vector< GLuint >& indices) {
+
+	vertices.clear();
+	indices.clear();
+
+	for (int r = 0; r < 2; ++r)
+		for (int c = 0; c < 2; ++c) {
+			vertex v = { { c - 0.5f, r - 0.5f, 0.0f }, { 0.0f, 0.0f, 1.0f },
+				     { (GLfloat)c, (GLfloat)r }, { 1.0f, 0.0f, 0.0f, 1.0f } };
+			vertices.push_back(v);
+		}
+
+	// counterclockwise seen from +z
+	indices.push_back(0); indices.push_back(1); indices.push_back(3);
+	indices.push_back(0); indices.push_back(3); indices.push_back(2);
+
+}
+
+/// A quad of row r and column c has the corners (r, c), (r + 1, c),
+/// (r + 1, c + 1) and (r, c + 1): counterclockwise when seen from the
+/// side the derivative along the rows crossed with the one along the
+/// columns points to
+
+void meshCache::grid (GLuint first, GLuint columns, GLuint rows, std::vector< GLuint >& indices) {
+
+	for (GLuint r = 0; r < rows; ++r)
+		for (GLuint c = 0; c < columns; ++c) {
+
+			GLuint a = first + r*(columns + 1) + c, b = a + columns + 1;
+
+			indices.push_back(a); indices.push_back(b); indices.push_back(a + 1);
+			indices.push_back(b); indices.push_back(b + 1); indices.push_back(a + 1);
+
+		}
+
+}
+
+void meshCache::upload (int m, const std::vector< vertex >& vertices, const std::vector< GLuint >& indices) {
+
+	if (!meshes[m].vbo) {
+		glGenBuffers(1, &meshes[m].vbo);
+		glGenBuffers(1, &meshes[m].ibo);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, meshes[m].vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(vertex), &vertices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshes[m].ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	meshes[m].count = indices.size();
+
+}
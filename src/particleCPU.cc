@@ -0,0 +1,354 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleCPU.cc -- CPU reference implementation of compute.frag
+ *
+ **/
+
+#include "particleCPU.h"
+
+#include <math.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+const char* particleCPU::simd_name( void ) {
+
+#if defined(__AVX2__)
+	return "avx2";
+#elif defined(__SSE2__)
+	return "sse2";
+#else
+	return "scalar";
+#endif
+
+}
+
+void particleCPU::set_state( size_t n, const float *pos, const float *vel, const float *orig_vel ) {
+
+	numParticles = n;
+
+	px.resize(n); py.resize(n); pz.resize(n); id.resize(n);
+	vx.resize(n); vy.resize(n); vz.resize(n);
+	ox.resize(n); oy.resize(n); oz.resize(n);
+
+	for (size_t i = 0; i < n; ++i) {
+
+		px[i] = pos[4*i + 0]; py[i] = pos[4*i + 1]; pz[i] = pos[4*i + 2];
+		id[i] = pos[4*i + 3];
+		vx[i] = vel[4*i + 0]; vy[i] = vel[4*i + 1]; vz[i] = vel[4*i + 2];
+		ox[i] = orig_vel[4*i + 0]; oy[i] = orig_vel[4*i + 1]; oz[i] = orig_vel[4*i + 2];
+
+	}
+
+}
+
+void particleCPU::get_state( float *pos, float *vel, float *orig_vel ) const {
+
+	for (size_t i = 0; i < numParticles; ++i) {
+
+		pos[4*i + 0] = px[i]; pos[4*i + 1] = py[i]; pos[4*i + 2] = pz[i];
+		pos[4*i + 3] = id[i];
+		vel[4*i + 0] = vx[i]; vel[4*i + 1] = vy[i]; vel[4*i + 2] = vz[i];
+		vel[4*i + 3] = 1.0f;
+
+		if (orig_vel) {
+			orig_vel[4*i + 0] = ox[i]; orig_vel[4*i + 1] = oy[i]; orig_vel[4*i + 2] = oz[i];
+			orig_vel[4*i + 3] = 1.0f;
+		}
+
+	}
+
+}
+
+void particleCPU::compute( float time_step, int step, const float gravity[3] ) {
+
+	/// chunks are multiples of 16 floats so threads never share a cache line
+	pool.run(numParticles, [&] (size_t begin, size_t end) {
+			compute_range(begin, end, time_step, step, gravity);
+		}, 16);
+
+}
+
+/// Scalar update of one component, as in compute.frag
+/// @arg p, v position and velocity component
+/// @arg gdt gravity times time step
+/// @arg dt time step
+
+static inline void update( float& p, float& v, float gdt, float dt ) {
+
+	v = v + gdt;
+	p = p + v*dt;
+
+	p = (p < -1.0f) ? -1.0f : (p > 1.0f) ? 1.0f : p;
+
+	if (p == -1.0f || p == 1.0f)
+		v = 0.0f;
+
+}
+
+void particleCPU::compute_range( size_t begin, size_t end, float time_step,
+				 int step, const float gravity[3] ) {
+
+	const float gdt[3] = { gravity[0]*time_step, gravity[1]*time_step, gravity[2]*time_step };
+	const float count = (float)numParticles;
+
+	float *p[3] = { &px[0], &py[0], &pz[0] };
+	float *v[3] = { &vx[0], &vy[0], &vz[0] };
+	const float *o[3] = { &ox[0], &oy[0], &oz[0] };
+
+	size_t i = begin;
+
+#if defined(__AVX2__)
+
+	const __m256 one = _mm256_set1_ps(1.0f), minus_one = _mm256_set1_ps(-1.0f);
+	const __m256 dt = _mm256_set1_ps(time_step), n = _mm256_set1_ps(count);
+	const __m256i s = _mm256_set1_epi32(step);
+
+	for (; i + 8 <= end; i += 8) {
+
+		/// int(particleId*float(numParticles)) > step
+		__m256i index = _mm256_cvttps_epi32( _mm256_mul_ps(_mm256_loadu_ps(&id[i]), n) );
+		__m256 reset = _mm256_castsi256_ps( _mm256_cmpgt_epi32(index, s) );
+
+		for (int c = 0; c < 3; ++c) {
+
+			__m256 vc = _mm256_add_ps( _mm256_loadu_ps(&v[c][i]), _mm256_set1_ps(gdt[c]) );
+			__m256 pc = _mm256_add_ps( _mm256_loadu_ps(&p[c][i]), _mm256_mul_ps(vc, dt) );
+
+			pc = _mm256_min_ps( _mm256_max_ps(pc, minus_one), one );
+
+			__m256 wall = _mm256_or_ps( _mm256_cmp_ps(pc, minus_one, _CMP_EQ_OQ),
+						    _mm256_cmp_ps(pc, one, _CMP_EQ_OQ) );
+			vc = _mm256_andnot_ps(wall, vc);
+
+			pc = _mm256_andnot_ps(reset, pc);
+			vc = _mm256_blendv_ps(vc, _mm256_loadu_ps(&o[c][i]), reset);
+
+			_mm256_storeu_ps(&p[c][i], pc);
+			_mm256_storeu_ps(&v[c][i], vc);
+
+		}
+
+	}
+
+#elif defined(__SSE2__)
+
+	const __m128 one = _mm_set1_ps(1.0f), minus_one = _mm_set1_ps(-1.0f);
+	const __m128 dt = _mm_set1_ps(time_step), n = _mm_set1_ps(count);
+	const __m128i s = _mm_set1_epi32(step);
+
+	for (; i + 4 <= end; i += 4) {
+
+		/// int(particleId*float(numParticles)) > step
+		__m128i index = _mm_cvttps_epi32( _mm_mul_ps(_mm_loadu_ps(&id[i]), n) );
+		__m128 reset = _mm_castsi128_ps( _mm_cmpgt_epi32(index, s) );
+
+		for (int c = 0; c < 3; ++c) {
+
+			__m128 vc = _mm_add_ps( _mm_loadu_ps(&v[c][i]), _mm_set1_ps(gdt[c]) );
+			__m128 pc = _mm_add_ps( _mm_loadu_ps(&p[c][i]), _mm_mul_ps(vc, dt) );
+
+			pc = _mm_min_ps( _mm_max_ps(pc, minus_one), one );
+
+			__m128 wall = _mm_or_ps( _mm_cmpeq_ps(pc, minus_one), _mm_cmpeq_ps(pc, one) );
+			vc = _mm_andnot_ps(wall, vc);
+
+			pc = _mm_andnot_ps(reset, pc);
+			vc = _mm_or_ps( _mm_andnot_ps(reset, vc), _mm_and_ps(reset, _mm_loadu_ps(&o[c][i])) );
+
+			_mm_storeu_ps(&p[c][i], pc);
+			_mm_storeu_ps(&v[c][i], vc);
+
+		}
+
+	}
+
+#endif
+
+	for (; i < end; ++i) {
+
+		bool reset = (int)(id[i]*count) > step;
+
+		for (int c = 0; c < 3; ++c) {
+
+			update(p[c][i], v[c][i], gdt[c], time_step);
+
+			if (reset) {
+				p[c][i] = 0.0f;
+				v[c][i] = o[c][i];
+			}
+
+		}
+
+	}
+
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+/// Folds the lanes of the vector accumulators into the statistics
+/// @arg lanes minimum, maximum and sum of x, y, z and the squared speed,
+/// then the walls, width floats each
+
+static void fold( particleStats& stats, const float *lanes, int width ) {
+
+	for (int l = 0; l < width; ++l) {
+
+		for (int c = 0; c < 4; ++c) {
+			const float *lane = &lanes[3*c*width];
+			stats.minimum[c] = lane[l] < stats.minimum[c] ? lane[l] : stats.minimum[c];
+			stats.maximum[c] = lane[width + l] > stats.maximum[c] ? lane[width + l] : stats.maximum[c];
+			stats.sum[c] += lane[2*width + l];
+		}
+
+		stats.count[1] += lanes[12*width + l];
+
+	}
+
+}
+
+#endif
+
+/// Speeds are reduced squared, the root and the half of the kinetic
+/// energy taken at the end; the CPU backend has no dead particles
+
+void particleCPU::reduce( particleStats& stats ) const {
+
+	stats.clear();
+
+	if (!numParticles)
+		return;
+
+	const float *p[3] = { &px[0], &py[0], &pz[0] };
+	const float *v[3] = { &vx[0], &vy[0], &vz[0] };
+
+	size_t i = 0;
+
+#if defined(__AVX2__)
+
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+	__m256 acc[13];
+	for (int c = 0; c < 4; ++c) {
+		acc[3*c] = _mm256_set1_ps(1e30f);
+		acc[3*c + 1] = _mm256_set1_ps(-1e30f);
+		acc[3*c + 2] = _mm256_setzero_ps();
+	}
+	acc[12] = _mm256_setzero_ps();
+
+	for (; i + 8 <= numParticles; i += 8) {
+
+		__m256 speed2 = _mm256_setzero_ps(), wall = _mm256_setzero_ps();
+
+		for (int c = 0; c < 4; ++c) {
+
+			__m256 x;
+
+			if (c < 3) {
+				x = _mm256_loadu_ps(&p[c][i]);
+				__m256 vc = _mm256_loadu_ps(&v[c][i]);
+				speed2 = _mm256_add_ps(speed2, _mm256_mul_ps(vc, vc));
+				wall = _mm256_or_ps(wall, _mm256_cmp_ps(_mm256_and_ps(x, abs_mask), one, _CMP_EQ_OQ));
+			} else
+				x = speed2;
+
+			acc[3*c] = _mm256_min_ps(acc[3*c], x);
+			acc[3*c + 1] = _mm256_max_ps(acc[3*c + 1], x);
+			acc[3*c + 2] = _mm256_add_ps(acc[3*c + 2], x);
+
+		}
+
+		acc[12] = _mm256_add_ps(acc[12], _mm256_and_ps(wall, one));
+
+	}
+
+	float lanes[13*8];
+	for (int k = 0; k < 13; ++k)
+		_mm256_storeu_ps(&lanes[8*k], acc[k]);
+	fold(stats, lanes, 8);
+
+#elif defined(__SSE2__)
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+	__m128 acc[13];
+	for (int c = 0; c < 4; ++c) {
+		acc[3*c] = _mm_set1_ps(1e30f);
+		acc[3*c + 1] = _mm_set1_ps(-1e30f);
+		acc[3*c + 2] = _mm_setzero_ps();
+	}
+	acc[12] = _mm_setzero_ps();
+
+	for (; i + 4 <= numParticles; i += 4) {
+
+		__m128 speed2 = _mm_setzero_ps(), wall = _mm_setzero_ps();
+
+		for (int c = 0; c < 4; ++c) {
+
+			__m128 x;
+
+			if (c < 3) {
+				x = _mm_loadu_ps(&p[c][i]);
+				__m128 vc = _mm_loadu_ps(&v[c][i]);
+				speed2 = _mm_add_ps(speed2, _mm_mul_ps(vc, vc));
+				wall = _mm_or_ps(wall, _mm_cmpeq_ps(_mm_and_ps(x, abs_mask), one));
+			} else
+				x = speed2;
+
+			acc[3*c] = _mm_min_ps(acc[3*c], x);
+			acc[3*c + 1] = _mm_max_ps(acc[3*c + 1], x);
+			acc[3*c + 2] = _mm_add_ps(acc[3*c + 2], x);
+
+		}
+
+		acc[12] = _mm_add_ps(acc[12], _mm_and_ps(wall, one));
+
+	}
+
+	float lanes[13*4];
+	for (int k = 0; k < 13; ++k)
+		_mm_storeu_ps(&lanes[4*k], acc[k]);
+	fold(stats, lanes, 4);
+
+#endif
+
+	for (; i < numParticles; ++i) {
+
+		float speed2 = 0.0f;
+		bool wall = false;
+
+		for (int c = 0; c < 4; ++c) {
+
+			float x;
+
+			if (c < 3) {
+				x = p[c][i];
+				speed2 += v[c][i]*v[c][i];
+				wall = wall || x == -1.0f || x == 1.0f;
+			} else
+				x = speed2;
+
+			stats.minimum[c] = x < stats.minimum[c] ? x : stats.minimum[c];
+			stats.maximum[c] = x > stats.maximum[c] ? x : stats.maximum[c];
+			stats.sum[c] += x;
+
+		}
+
+		if (wall)
+			stats.count[1] += 1.0f;
+
+	}
+
+	stats.minimum[3] = sqrt(stats.minimum[3]);
+	stats.maximum[3] = sqrt(stats.maximum[3]);
+	stats.sum[3] *= 0.5f;
+	stats.count[0] = (float)numParticles;
+
+}
@@ -0,0 +1,340 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleCompute.cc -- Compute shader particle engine
+ *
+ **/
+
+#include "particleCompute.h"
+#include "particleSDF.h"
+
+#include <assert.h>
+#include <vector>
+
+/// Storage buffer bindings of particles.comp, the dead list of the
+/// emitters or the table of the systems is at 3
+enum { BINDING_STATE_IN = 0, BINDING_STATE_OUT = 1, BINDING_ORIGINAL_VELOCITY = 2, BINDING_DEAD = 3,
+       BINDING_SYSTEMS = 3, BINDING_ENERGY = 4 };
+
+/// Bytes per particle in the state buffers
+static const GLsizei STATE_STRIDE = 8*sizeof(GLfloat);
+
+/// Attribute index of the previous position in points.vert
+enum { ATTRIB_PREVIOUS_POSITION = 1 };
+
+particleCompute::particleCompute () : ssbo_originalVelocity(0), curr(0), groupSize(256), maxGroups(0),
+				      neighbours(NEIGHBOURS_NONE), radius(0.02), stiffness(1.0), emitters(0),
+				      systems(0), integratorMode(INTEGRATOR_SYMPLECTIC), energyCheck(false),
+				      ssbo_energy(0) {
+
+	ssbo_state[0] = ssbo_state[1] = 0;
+
+}
+
+bool particleCompute::install (bool debug) {
+
+	if (!compute_shader_support())
+		return false;
+
+	assert( !systems || (!emitters && neighbours == NEIGHBOURS_NONE) );
+
+	/// the group size must fit the board, and its tile of positions the
+	/// shared memory
+	GLint max_size = 0, max_invocations = 0, max_shared = 0, max_groups = 0;
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &max_size);
+	glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &max_invocations);
+	glGetIntegerv(GL_MAX_COMPUTE_SHARED_MEMORY_SIZE, &max_shared);
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max_groups);
+	maxGroups = max_groups;
+
+	if (groupSize < 1) groupSize = 1;
+	if (groupSize > (GLuint)max_size) groupSize = max_size;
+	if (groupSize > (GLuint)max_invocations) groupSize = max_invocations;
+	if (groupSize*4*sizeof(GLfloat) > (GLuint)max_shared) groupSize = max_shared / (4*sizeof(GLfloat));
+
+	computeShader.set_define("GROUP_SIZE", groupSize);
+	computeShader.set_define("TILES", neighbours == NEIGHBOURS_TILES ? 1 : 0);
+	computeShader.set_define("EMITTERS", emitters ? 1 : 0);
+	computeShader.set_define("SYSTEMS", systems ? 1 : 0);
+	computeShader.set_define("INTEGRATOR", integratorMode);
+	computeShader.set_define("ENERGY", energyCheck ? 1 : 0);
+	computeShader.set_define("SDF", sdf ? 1 : 0);
+	computeShader.compute_source("particles.comp");
+	computeShader.install(debug);
+
+	if (energyCheck)
+		energySum.install(debug, groupSize);
+
+	if (neighbours == NEIGHBOURS_GRID) {
+		grid.set_params(radius, stiffness);
+		grid.install(debug, groupSize, emitters != 0);
+	}
+
+	if (emitters)
+		emitters->install(debug, groupSize);
+
+	displayShader.vertex_source("points.vert");
+	displayShader.fragment_source("display.frag");
+	displayShader.bind_attribute_location("previousPosition", ATTRIB_PREVIOUS_POSITION);
+	displayShader.install(debug);
+
+	return true;
+
+}
+
+GLuint particleCompute::max_particles (void) const {
+
+	unsigned long long invocations = (unsigned long long)maxGroups*groupSize;
+	GLuint limit = particleEngine::max_particles();
+
+	return (invocations < limit) ? (GLuint)invocations : limit;
+
+}
+
+void particleCompute::set_state (GLuint n, const GLfloat *pos, const GLfloat *vel, const GLfloat *orig_vel) {
+
+	clear();
+
+	numParticles = n;
+
+	GLfloat *state_data = new GLfloat[8*n];
+
+	for (GLuint i = 0; i < n; ++i) {
+		for (int c = 0; c < 4; ++c) {
+			state_data[8*i + c] = pos[4*i + c];
+			state_data[8*i + 4 + c] = vel[4*i + c];
+		}
+	}
+
+	glGenBuffers(2, ssbo_state);
+
+	for (int k = 0; k < 2; ++k) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_state[k]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, n*STATE_STRIDE, state_data, GL_DYNAMIC_COPY);
+	}
+
+	glGenBuffers(1, &ssbo_originalVelocity);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_originalVelocity);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, 4*n*sizeof(GLfloat), orig_vel, GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	delete [] state_data;
+
+	if (energyCheck) {
+
+		std::vector< GLfloat > zeros(n, 0.0);
+
+		glGenBuffers(1, &ssbo_energy);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_energy);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, n*sizeof(GLfloat), &zeros[0], GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	}
+
+	if (emitters)
+		emitters->set_state(n, pos);
+	if (systems)
+		systems->set_state(n);
+
+	curr = 0;
+
+}
+
+void particleCompute::get_state (GLfloat *pos, GLfloat *vel, GLfloat *orig_vel) {
+
+	if (pos || vel) {
+
+		GLfloat *state_data = new GLfloat[8*numParticles];
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_state[curr]);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numParticles*STATE_STRIDE, state_data);
+
+		for (GLuint i = 0; i < numParticles; ++i) {
+			for (int c = 0; c < 4; ++c) {
+				if (pos) pos[4*i + c] = state_data[8*i + c];
+				if (vel) vel[4*i + c] = state_data[8*i + 4 + c];
+			}
+		}
+
+		delete [] state_data;
+
+	}
+
+	if (orig_vel) {
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_originalVelocity);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, 4*numParticles*sizeof(GLfloat), orig_vel);
+
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+}
+
+void particleCompute::clear (void) {
+
+	if (!numParticles)
+		return;
+
+	glDeleteBuffers(2, ssbo_state);
+	glDeleteBuffers(1, &ssbo_originalVelocity);
+	if (ssbo_energy) {
+		glDeleteBuffers(1, &ssbo_energy);
+		energySum.clear();
+		ssbo_energy = 0;
+	}
+	grid.clear();
+	if (emitters)
+		emitters->clear();
+	if (systems)
+		systems->clear();
+
+	numParticles = 0;
+
+}
+
+/// Steps are dispatched back to back, with the barrier between them; the
+/// births of the emitters, then the grid passes, run before each step
+/// when enabled. The systems step all together, their reset steps
+/// advanced once per batch
+
+void particleCompute::compute_steps (GLfloat time_step, GLint step, const GLfloat gravity[3], GLuint count) {
+
+	GLuint numGroups = (numParticles + groupSize - 1) / groupSize;
+	assert( numGroups <= maxGroups );
+
+	computeShader.use();
+	computeShader.set_uniform("time_step", (GLfloat)time_step);
+	computeShader.set_uniform("numParticles", (GLint)numParticles);
+	computeShader.set_uniform("gravity", gravity[0], gravity[1], gravity[2]);
+	if (neighbours == NEIGHBOURS_TILES) {
+		computeShader.set_uniform("radius", (GLfloat)radius);
+		computeShader.set_uniform("stiffness", (GLfloat)stiffness);
+	}
+	if (systems)
+		computeShader.set_uniform("numSystems", (GLint)systems->size());
+	if (sdf)
+		sdf->bind(computeShader);
+
+	for (GLuint k = 0; k < count; ++k) {
+
+		GLint s = (step + k) % numParticles;
+
+		/// births are written to the current buffer, so they are updated
+		/// and collide in this step already
+		if (emitters) {
+			emitters->spawn(ssbo_state[curr], time_step);
+			computeShader.use();
+		}
+
+		/// the grid collision updates the current velocities in place
+		if (neighbours == NEIGHBOURS_GRID) {
+			particleGrid& g = neighbour_grid();
+			g.build(s);
+			g.collide(time_step);
+			computeShader.use();
+		}
+
+		// particles of emitters die instead of being reset at a step, the
+		// systems reset at their own step
+		if (systems)
+			computeShader.set_uniform("batchStep", (GLint)k);
+		else if (!emitters)
+			computeShader.set_uniform("step", s);
+
+		// read the current buffer and write the other one
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_STATE_IN, ssbo_state[curr]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_STATE_OUT, ssbo_state[1-curr]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_ORIGINAL_VELOCITY, ssbo_originalVelocity);
+		if (emitters)
+			emitters->bind_dead_list();
+		if (systems)
+			systems->bind_table();
+		if (energyCheck)
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_ENERGY, ssbo_energy);
+
+		glDispatchCompute(numGroups, 1, 1);
+
+		/// the written buffer is next read by the following dispatch, drawn
+		/// as a vertex array or read back
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+				GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		curr = 1-curr;
+
+	}
+
+	for (int b = BINDING_STATE_IN; b <= BINDING_ENERGY; ++b)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, 0);
+
+	computeShader.use(0);
+
+	if (systems)
+		systems->advance(count);
+
+}
+
+/// The changes are summed by the tree of the statistics, which clears
+/// them on the GPU to start again from zero
+
+GLdouble particleCompute::energy_drift (void) {
+
+	if (!energyCheck || !numParticles)
+		return 0.0;
+
+	return energySum.sum_and_clear(ssbo_energy, numParticles);
+
+}
+
+/// Draws the current state buffer as points, with the particle id of
+/// the position w giving the color, blended with the other buffer; the
+/// dead particles of the emitters are clipped by points.vert
+
+void particleCompute::draw (GLfloat alpha) {
+
+	displayShader.use();
+	displayShader.set_uniform("numParticles", (GLint)numParticles);
+	displayShader.set_uniform("alpha", (GLfloat)alpha);
+
+	glBindBuffer(GL_ARRAY_BUFFER, ssbo_state[1-curr]);
+	glVertexAttribPointer(ATTRIB_PREVIOUS_POSITION, 4, GL_FLOAT, GL_FALSE, STATE_STRIDE, 0);
+	glEnableVertexAttribArray(ATTRIB_PREVIOUS_POSITION);
+
+	glBindBuffer(GL_ARRAY_BUFFER, ssbo_state[curr]);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(4, GL_FLOAT, STATE_STRIDE, 0);
+
+	glDrawArrays(GL_POINTS, 0, numParticles);
+
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableVertexAttribArray(ATTRIB_PREVIOUS_POSITION);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	displayShader.use(false);
+
+}
+
+/// The state buffers are drawn as instance attributes; the barrier of the
+/// last dispatch covers them as it covers the vertex arrays
+
+void particleCompute::draw_sprites (particleSprites& sprites, GLfloat alpha) {
+
+	sprites.draw_buffers(ssbo_state[curr], ssbo_state[1-curr], STATE_STRIDE, numParticles, alpha);
+
+}
+
+/// The whole interleaved state buffer is copied, as in the feedback
+/// engine; the barrier of the last dispatch covers the copy
+
+void particleCompute::copy_positions (GLuint buffer) {
+
+	assert( copy_buffer_support() );
+
+	glBindBuffer(GL_COPY_READ_BUFFER, ssbo_state[curr]);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, numParticles*STATE_STRIDE);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+}
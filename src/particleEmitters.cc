@@ -0,0 +1,228 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleEmitters.cc -- Particle emitters of the compute shader engine
+ *
+ **/
+
+#include "particleEmitters.h"
+
+#include <math.h>
+#include <string.h>
+
+/// Storage buffer bindings of emitters.comp, the state is at 0 and the
+/// dead list at 3 as in particles.comp
+enum { BINDING_STATE = 0, BINDING_DEAD = 3, BINDING_EMITTERS = 4, BINDING_TRIANGLES = 5 };
+
+/// Emitter in the layout of emitters.comp, 16 words
+struct gpuEmitter {
+	GLfloat center[4]; ///< Center, radius
+	GLfloat velocity[4]; ///< Mean velocity, speed along the normal
+	GLfloat params[4]; ///< Spread, life, shape
+	GLint range[4]; ///< First birth, births, first triangle, triangles
+};
+
+particleEmitters::particleEmitters () : groupSize(256), numParticles(0), serial(0),
+					ssbo_emitters(0), ssbo_triangles(0), ssbo_dead(0) {
+
+}
+
+int particleEmitters::add (const emitter& e) {
+
+	emitters.push_back(e);
+	due.push_back(0.0);
+
+	return emitters.size() - 1;
+
+}
+
+/// The triangles are stored with the area share up to each one, in
+/// the w of its first vertex, normalized over the mesh
+
+int particleEmitters::add_mesh (emitter e, const GLfloat *vertices, const GLuint *indices, GLuint num_triangles) {
+
+	e.type = EMITTER_MESH;
+	e.firstTriangle = triangles.size() / 12;
+	e.numTriangles = num_triangles;
+
+	GLfloat total = 0.0;
+
+	for (GLuint t = 0; t < num_triangles; ++t) {
+
+		const GLfloat *v[3];
+		for (int k = 0; k < 3; ++k)
+			v[k] = &vertices[3*indices[3*t + k]];
+
+		GLfloat a[3], b[3];
+		for (int c = 0; c < 3; ++c) {
+			a[c] = v[1][c] - v[0][c];
+			b[c] = v[2][c] - v[0][c];
+		}
+
+		GLfloat n[3] = { a[1]*b[2] - a[2]*b[1], a[2]*b[0] - a[0]*b[2], a[0]*b[1] - a[1]*b[0] };
+		total += 0.5*sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+
+		for (int k = 0; k < 3; ++k) {
+			for (int c = 0; c < 3; ++c)
+				triangles.push_back(v[k][c]);
+			triangles.push_back(k == 0 ? total : 0.0);
+		}
+
+	}
+
+	/// the last triangle ends at exactly 1, so the search always lands
+	for (GLuint t = 0; t < num_triangles; ++t)
+		triangles[12*(e.firstTriangle + t) + 3] /= total;
+	if (num_triangles)
+		triangles[12*(e.firstTriangle + num_triangles - 1) + 3] = 1.0;
+
+	return add(e);
+
+}
+
+void particleEmitters::install (bool debug, GLuint group_size) {
+
+	groupSize = group_size;
+
+	for (int k = 0; k < NUM_PASSES; ++k) {
+
+		passes[k].set_define("GROUP_SIZE", groupSize);
+		passes[k].set_define("PASS", k);
+		passes[k].compute_source("emitters.comp");
+		passes[k].install(debug);
+
+	}
+
+	if (!ssbo_emitters) {
+		glGenBuffers(1, &ssbo_emitters);
+		glGenBuffers(1, &ssbo_triangles);
+	}
+
+	/// one triangle at least, an empty buffer cannot be bound
+	std::vector< GLfloat > data(triangles);
+	if (data.empty())
+		data.resize(12, 0.0);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_triangles);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, data.size()*sizeof(GLfloat), &data[0], GL_STATIC_DRAW);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_emitters);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (emitters.size() + 1)*sizeof(gpuEmitter), 0, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+}
+
+void particleEmitters::set_state (GLuint n, const GLfloat *pos) {
+
+	clear();
+
+	numParticles = n;
+
+	/// the count comes first, then the indices of the dead particles
+	std::vector< GLuint > data(1, 0);
+
+	for (GLuint i = 0; i < n; ++i)
+		if (pos[4*i + 3] < 0.0)
+			data.push_back(i);
+
+	data[0] = data.size() - 1;
+	data.resize(n + 1);
+
+	glGenBuffers(1, &ssbo_dead);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_dead);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, data.size()*sizeof(GLuint), &data[0], GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	for (size_t e = 0; e < due.size(); ++e)
+		due[e] = 0.0;
+
+}
+
+/// The births of each emitter are its rate over the step, the fraction
+/// left carried to the next step; the births of all emitters are handed
+/// out in order, each emitter taking a range of invocations
+
+void particleEmitters::spawn (GLuint state, GLfloat time_step) {
+
+	std::vector< gpuEmitter > table(emitters.size());
+	GLint births = 0;
+
+	for (size_t e = 0; e < emitters.size(); ++e) {
+
+		const emitter& em = emitters[e];
+		gpuEmitter& g = table[e];
+
+		due[e] += em.rate*time_step;
+		GLint count = (GLint)due[e];
+		due[e] -= count;
+
+		memcpy(g.center, em.center, 3*sizeof(GLfloat));
+		g.center[3] = em.radius;
+		memcpy(g.velocity, em.velocity, 3*sizeof(GLfloat));
+		g.velocity[3] = em.speed;
+		g.params[0] = em.spread;
+		g.params[1] = em.life;
+		g.params[2] = em.type;
+		g.params[3] = 0.0;
+		g.range[0] = births;
+		g.range[1] = count;
+		g.range[2] = em.firstTriangle;
+		g.range[3] = em.numTriangles;
+
+		births += count;
+
+	}
+
+	if (!births)
+		return;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_emitters);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, table.size()*sizeof(gpuEmitter), &table[0]);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_STATE, state);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_DEAD, ssbo_dead);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_EMITTERS, ssbo_emitters);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_TRIANGLES, ssbo_triangles);
+
+	passes[PASS_SPAWN].use();
+	passes[PASS_SPAWN].set_uniform("numParticles", (GLint)numParticles);
+	passes[PASS_SPAWN].set_uniform("numEmitters", (GLint)emitters.size());
+	passes[PASS_SPAWN].set_uniform("births", births);
+	passes[PASS_SPAWN].set_uniform("serial", (GLint)serial);
+	glDispatchCompute((births + groupSize - 1) / groupSize, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	/// the dead list shrinks once all births have read it
+	passes[PASS_COMMIT].use();
+	passes[PASS_COMMIT].set_uniform("births", births);
+	glDispatchCompute(1, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	passes[PASS_COMMIT].use(0);
+
+	for (int b = BINDING_DEAD; b <= BINDING_TRIANGLES; ++b)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, 0);
+
+	serial += births;
+
+}
+
+void particleEmitters::bind_dead_list (void) {
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_DEAD, ssbo_dead);
+
+}
+
+void particleEmitters::clear (void) {
+
+	if (!numParticles)
+		return;
+
+	glDeleteBuffers(1, &ssbo_dead);
+	ssbo_dead = 0;
+
+	numParticles = 0;
+
+}
@@ -0,0 +1,229 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleFeedback.cc -- Transform feedback particle engine
+ *
+ **/
+
+#include "particleFeedback.h"
+#include "particleSDF.h"
+
+#include <assert.h>
+
+/// Attribute indices of feedback.vert (position as 0, the vertex array)
+enum { ATTRIB_POSITION = 0, ATTRIB_VELOCITY = 1, ATTRIB_ORIGINAL_VELOCITY = 2 };
+
+/// Attribute index of the previous position in points.vert
+enum { ATTRIB_PREVIOUS_POSITION = 1 };
+
+/// Bytes per particle in the state buffers
+static const GLsizei STATE_STRIDE = 8*sizeof(GLfloat);
+
+particleFeedback::particleFeedback () : vbo_originalVelocity(0), curr(0) {
+
+	vbo_state[0] = vbo_state[1] = 0;
+
+}
+
+bool particleFeedback::install (bool debug) {
+
+	if (!transform_feedback_support())
+		return false;
+
+	static const GLchar* varyings[] = { "outPosition", "outVelocity" };
+
+	computeShader.set_define("SDF", sdf ? 1 : 0);
+	computeShader.vertex_source("feedback.vert");
+	computeShader.bind_attribute_location("position", ATTRIB_POSITION);
+	computeShader.bind_attribute_location("velocity", ATTRIB_VELOCITY);
+	computeShader.bind_attribute_location("originalVelocity", ATTRIB_ORIGINAL_VELOCITY);
+	computeShader.set_feedback_varyings(varyings, 2, GL_INTERLEAVED_ATTRIBS);
+	computeShader.install(debug);
+
+	displayShader.vertex_source("points.vert");
+	displayShader.fragment_source("display.frag");
+	displayShader.bind_attribute_location("previousPosition", ATTRIB_PREVIOUS_POSITION);
+	displayShader.install(debug);
+
+	return true;
+
+}
+
+void particleFeedback::set_state (GLuint n, const GLfloat *pos, const GLfloat *vel, const GLfloat *orig_vel) {
+
+	clear();
+
+	numParticles = n;
+
+	GLfloat *vtx_data = new GLfloat[8*n];
+
+	for (GLuint i = 0; i < n; ++i) {
+		for (int c = 0; c < 4; ++c) {
+			vtx_data[8*i + c] = pos[4*i + c];
+			vtx_data[8*i + 4 + c] = vel[4*i + c];
+		}
+	}
+
+	glGenBuffers(2, vbo_state);
+
+	for (int k = 0; k < 2; ++k) {
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_state[k]);
+		glBufferData(GL_ARRAY_BUFFER, n*STATE_STRIDE, vtx_data, GL_DYNAMIC_COPY);
+	}
+
+	glGenBuffers(1, &vbo_originalVelocity);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_originalVelocity);
+	glBufferData(GL_ARRAY_BUFFER, 4*n*sizeof(GLfloat), orig_vel, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	delete [] vtx_data;
+
+	curr = 0;
+
+}
+
+void particleFeedback::get_state (GLfloat *pos, GLfloat *vel, GLfloat *orig_vel) {
+
+	if (pos || vel) {
+
+		GLfloat *vtx_data = new GLfloat[8*numParticles];
+
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_state[curr]);
+		glGetBufferSubData(GL_ARRAY_BUFFER, 0, numParticles*STATE_STRIDE, vtx_data);
+
+		for (GLuint i = 0; i < numParticles; ++i) {
+			for (int c = 0; c < 4; ++c) {
+				if (pos) pos[4*i + c] = vtx_data[8*i + c];
+				if (vel) vel[4*i + c] = vtx_data[8*i + 4 + c];
+			}
+		}
+
+		delete [] vtx_data;
+
+	}
+
+	if (orig_vel) {
+
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_originalVelocity);
+		glGetBufferSubData(GL_ARRAY_BUFFER, 0, 4*numParticles*sizeof(GLfloat), orig_vel);
+
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+}
+
+void particleFeedback::clear (void) {
+
+	if (!numParticles)
+		return;
+
+	glDeleteBuffers(2, vbo_state);
+	glDeleteBuffers(1, &vbo_originalVelocity);
+
+	numParticles = 0;
+
+}
+
+/// The pipeline is set up once for all steps, each step only swaps the
+/// buffer it reads and the one it captures into
+
+void particleFeedback::compute_steps (GLfloat time_step, GLint step, const GLfloat gravity[3], GLuint count) {
+
+	computeShader.use();
+	computeShader.set_uniform("time_step", (GLfloat)time_step);
+	computeShader.set_uniform("numParticles", (GLint)numParticles);
+	computeShader.set_uniform("gravity", gravity[0], gravity[1], gravity[2]);
+	if (sdf)
+		sdf->bind(computeShader);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_originalVelocity);
+	glVertexAttribPointer(ATTRIB_ORIGINAL_VELOCITY, 4, GL_FLOAT, GL_FALSE, 0, 0);
+
+	glEnableVertexAttribArray(ATTRIB_POSITION);
+	glEnableVertexAttribArray(ATTRIB_VELOCITY);
+	glEnableVertexAttribArray(ATTRIB_ORIGINAL_VELOCITY);
+
+	glEnable(GL_RASTERIZER_DISCARD);
+
+	for (GLuint k = 0; k < count; ++k) {
+
+		computeShader.set_uniform("step", (GLint)((step + k) % numParticles));
+
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_state[curr]);
+		glVertexAttribPointer(ATTRIB_POSITION, 4, GL_FLOAT, GL_FALSE, STATE_STRIDE, 0);
+		glVertexAttribPointer(ATTRIB_VELOCITY, 4, GL_FLOAT, GL_FALSE, STATE_STRIDE,
+				      (const GLvoid*)(4*sizeof(GLfloat)));
+
+		// read the current buffer and capture into the other one
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, vbo_state[1-curr]);
+
+		glBeginTransformFeedback(GL_POINTS);
+		glDrawArrays(GL_POINTS, 0, numParticles);
+		glEndTransformFeedback();
+
+		curr = 1-curr;
+
+	}
+
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+
+	glDisableVertexAttribArray(ATTRIB_POSITION);
+	glDisableVertexAttribArray(ATTRIB_VELOCITY);
+	glDisableVertexAttribArray(ATTRIB_ORIGINAL_VELOCITY);
+
+	computeShader.use(0);
+
+}
+
+/// Draws the current state buffer as points, with the particle id of
+/// the position w giving the color, blended with the other buffer
+
+void particleFeedback::draw (GLfloat alpha) {
+
+	displayShader.use();
+	displayShader.set_uniform("numParticles", (GLint)numParticles);
+	displayShader.set_uniform("alpha", (GLfloat)alpha);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_state[1-curr]);
+	glVertexAttribPointer(ATTRIB_PREVIOUS_POSITION, 4, GL_FLOAT, GL_FALSE, STATE_STRIDE, 0);
+	glEnableVertexAttribArray(ATTRIB_PREVIOUS_POSITION);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_state[curr]);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(4, GL_FLOAT, STATE_STRIDE, 0);
+
+	glDrawArrays(GL_POINTS, 0, numParticles);
+
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableVertexAttribArray(ATTRIB_PREVIOUS_POSITION);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	displayShader.use(false);
+
+}
+
+void particleFeedback::draw_sprites (particleSprites& sprites, GLfloat alpha) {
+
+	sprites.draw_buffers(vbo_state[curr], vbo_state[1-curr], STATE_STRIDE, numParticles, alpha);
+
+}
+
+/// The whole interleaved state buffer is copied, so positions_stride is
+/// 8 floats
+
+void particleFeedback::copy_positions (GLuint buffer) {
+
+	assert( copy_buffer_support() );
+
+	glBindBuffer(GL_COPY_READ_BUFFER, vbo_state[curr]);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, numParticles*STATE_STRIDE);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+}
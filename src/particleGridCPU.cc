@@ -0,0 +1,165 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleGridCPU.cc -- Neighbour grid of the CPU particle backend
+ *
+ **/
+
+#include "particleGridCPU.h"
+
+#include <math.h>
+
+void particleGridCPU::build( int step ) {
+
+	size_t n = particles.numParticles;
+	unsigned slices = particles.pool.size();
+
+	resize(n);
+
+	key.resize(n); slot.resize(n);
+	counts.assign((size_t)slices * tableSize, 0);
+	cellRange.resize(2*tableSize);
+
+	/// Each slice counts its particles per bucket
+	particles.pool.run(slices, [&] (size_t s0, size_t s1) {
+
+		for (size_t s = s0; s < s1; ++s) {
+
+			unsigned *count = &counts[s * tableSize];
+
+			for (size_t i = s*n/slices; i < (s+1)*n/slices; ++i) {
+
+				if ((int)(particles.id[i] * (float)n) > step) {
+					key[i] = INACTIVE;
+					continue;
+				}
+
+				unsigned x = cell(particles.px[i]), y = cell(particles.py[i]), z = cell(particles.pz[i]);
+
+				key[i] = cell_key(x, y, z);
+				slot[i] = bucket(x, y, z);
+				count[slot[i]]++;
+
+			}
+
+		}
+
+	});
+
+	/// Buckets are laid out in order, each one with the particles of the
+	/// first slice, then the second and so on
+	unsigned offset = 0;
+
+	for (unsigned b = 0; b < tableSize; ++b) {
+
+		cellRange[2*b] = offset;
+
+		for (unsigned s = 0; s < slices; ++s) {
+			unsigned c = counts[(size_t)s * tableSize + b];
+			counts[(size_t)s * tableSize + b] = offset;
+			offset += c;
+		}
+
+		cellRange[2*b + 1] = offset;
+
+	}
+
+	sorted.resize(offset);
+	sortedIndex.resize(offset);
+
+	particles.pool.run(slices, [&] (size_t s0, size_t s1) {
+
+		for (size_t s = s0; s < s1; ++s) {
+
+			unsigned *next = &counts[s * tableSize];
+
+			for (size_t i = s*n/slices; i < (s+1)*n/slices; ++i) {
+
+				if (key[i] == INACTIVE)
+					continue;
+
+				unsigned k = next[slot[i]]++;
+				sortedParticle& s = sorted[k];
+				s.x = particles.px[i]; s.y = particles.py[i]; s.z = particles.pz[i];
+				s.key = key[i];
+				sortedIndex[k] = i;
+
+			}
+
+		}
+
+	});
+
+}
+
+void particleGridCPU::collide( float time_step ) {
+
+	/// particles are taken in sorted order, so the next particle is often
+	/// in the same row and its neighbours are still in cache
+	particles.pool.run(sorted.size(), [&] (size_t begin, size_t end) {
+
+		/// members are read through locals, which the compiler can keep
+		/// in registers across the stores to the velocities
+		const unsigned *range = &cellRange[0];
+		const sortedParticle *other = &sorted[0];
+		const int cells = side;
+		const unsigned mask = tableSize - 1;
+		const float r = radius, r2max = radius*radius, dv = stiffness*time_step;
+
+		for (size_t i = begin; i < end; ++i) {
+
+			float p[3] = { other[i].x, other[i].y, other[i].z };
+			int c[3] = { (int)cell(p[0]), (int)cell(p[1]), (int)cell(p[2]) };
+			float push[3] = { 0.0f, 0.0f, 0.0f };
+
+			int x0 = c[0] > 0 ? c[0]-1 : 0, x1 = c[0] < cells-1 ? c[0]+1 : cells-1;
+
+			for (int z = c[2]-1; z <= c[2]+1; ++z) {
+				if (z < 0 || z >= cells) continue;
+				for (int y = c[1]-1; y <= c[1]+1; ++y) {
+					if (y < 0 || y >= cells) continue;
+
+					/// cells x0..x1 of the row are buckets b0..b1, which
+					/// wrap around the end of the table at most once
+					unsigned k0 = cell_key(x0, y, z), nk = x1 - x0 + 1;
+					unsigned b0 = bucket(x0, y, z), b1 = (b0 + nk - 1) & mask;
+
+					unsigned seg[2][2] = { { range[2*b0], range[2*b1 + 1] }, { 0, 0 } };
+					if (b1 < b0) {
+						seg[0][1] = range[2*mask + 1];
+						seg[1][0] = range[0]; seg[1][1] = range[2*b1 + 1];
+					}
+
+					for (int s = 0; s < 2; ++s) {
+						for (unsigned j = seg[s][0]; j < seg[s][1]; ++j) {
+
+							if (other[j].key - k0 >= nk)
+								continue;
+
+							float d[3] = { p[0] - other[j].x, p[1] - other[j].y, p[2] - other[j].z };
+							float r2 = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+
+							if (r2 > 0.0f && r2 < r2max) {
+								float dist = sqrtf(r2);
+								float q = 1.0f - dist/r;
+								float w = q*q/dist;
+								push[0] += d[0]*w; push[1] += d[1]*w; push[2] += d[2]*w;
+							}
+
+						}
+					}
+
+				}
+			}
+
+			unsigned v = sortedIndex[i];
+			particles.vx[v] += dv*push[0];
+			particles.vy[v] += dv*push[1];
+			particles.vz[v] += dv*push[2];
+
+		}
+
+	}, 16);
+
+}
@@ -0,0 +1,130 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleGridGPU.cc -- Neighbour grid of the compute shader engine
+ *
+ **/
+
+#include "particleGridGPU.h"
+
+/// Storage buffer bindings of grid.comp, the state is at 0 as in particles.comp
+enum { BINDING_STATE = 0, BINDING_KEY = 3, BINDING_SORTED = 4, BINDING_CELL_START = 5, BINDING_CELL_END = 6 };
+
+particleGridGPU::particleGridGPU () : groupSize(256), emitterMode(false), stateBuffer(0), numParticles(0),
+				      ssbo_key(0), ssbo_sorted(0), ssbo_cellStart(0), ssbo_cellEnd(0),
+				      capacity(0), capacityTable(0) {
+
+}
+
+void particleGridGPU::install (bool debug, GLuint group_size, bool emitters) {
+
+	groupSize = group_size;
+	emitterMode = emitters;
+
+	for (int k = 0; k < NUM_PASSES; ++k) {
+
+		passes[k].set_define("GROUP_SIZE", groupSize);
+		passes[k].set_define("PASS", k);
+		passes[k].set_define("EMITTERS", emitterMode ? 1 : 0);
+		passes[k].compute_source("grid.comp");
+		passes[k].install(debug);
+
+	}
+
+}
+
+void particleGridGPU::clear (void) {
+
+	if (!capacity)
+		return;
+
+	glDeleteBuffers(1, &ssbo_key);
+	glDeleteBuffers(1, &ssbo_sorted);
+	glDeleteBuffers(1, &ssbo_cellStart);
+	glDeleteBuffers(1, &ssbo_cellEnd);
+
+	capacity = capacityTable = 0;
+
+}
+
+/// The grid passes run one invocation per item, the scan runs in one
+/// work group; each pass sets its own uniforms before
+
+void particleGridGPU::dispatch (glslKernel& pass, GLuint count) {
+
+	glDispatchCompute((count + groupSize - 1) / groupSize, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	pass.use(0);
+
+}
+
+void particleGridGPU::build (int step) {
+
+	resize(numParticles);
+
+	/// buffers only grow, so resizing back and forth reuses them
+	if (numParticles > capacity || tableSize > capacityTable) {
+
+		clear();
+
+		capacity = numParticles;
+		capacityTable = tableSize;
+
+		GLuint *buffers[] = { &ssbo_key, &ssbo_sorted, &ssbo_cellStart, &ssbo_cellEnd };
+		GLuint sizes[] = { capacity, capacity, capacityTable, capacityTable };
+
+		for (int k = 0; k < 4; ++k) {
+			glGenBuffers(1, buffers[k]);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, *buffers[k]);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizes[k]*sizeof(GLuint), 0, GL_DYNAMIC_COPY);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	}
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_STATE, stateBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_KEY, ssbo_key);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SORTED, ssbo_sorted);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_CELL_START, ssbo_cellStart);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_CELL_END, ssbo_cellEnd);
+
+	passes[PASS_CLEAR].use();
+	passes[PASS_CLEAR].set_uniform("tableSize", (GLint)tableSize);
+	dispatch(passes[PASS_CLEAR], tableSize);
+
+	passes[PASS_COUNT].use();
+	passes[PASS_COUNT].set_uniform("numParticles", (GLint)numParticles);
+	if (!emitterMode)
+		passes[PASS_COUNT].set_uniform("step", (GLint)step);
+	passes[PASS_COUNT].set_uniform("side", (GLint)side);
+	passes[PASS_COUNT].set_uniform("tableSize", (GLint)tableSize);
+	dispatch(passes[PASS_COUNT], numParticles);
+
+	passes[PASS_SCAN].use();
+	passes[PASS_SCAN].set_uniform("tableSize", (GLint)tableSize);
+	dispatch(passes[PASS_SCAN], groupSize);
+
+	passes[PASS_SCATTER].use();
+	passes[PASS_SCATTER].set_uniform("numParticles", (GLint)numParticles);
+	passes[PASS_SCATTER].set_uniform("side", (GLint)side);
+	passes[PASS_SCATTER].set_uniform("tableSize", (GLint)tableSize);
+	dispatch(passes[PASS_SCATTER], numParticles);
+
+}
+
+void particleGridGPU::collide (float time_step) {
+
+	passes[PASS_COLLIDE].use();
+	passes[PASS_COLLIDE].set_uniform("side", (GLint)side);
+	passes[PASS_COLLIDE].set_uniform("tableSize", (GLint)tableSize);
+	passes[PASS_COLLIDE].set_uniform("radius", (GLfloat)radius);
+	passes[PASS_COLLIDE].set_uniform("stiffness", (GLfloat)stiffness);
+	passes[PASS_COLLIDE].set_uniform("time_step", (GLfloat)time_step);
+	dispatch(passes[PASS_COLLIDE], numParticles);
+
+	for (int b = BINDING_STATE; b <= BINDING_CELL_END; ++b)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, 0);
+
+}
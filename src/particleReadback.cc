@@ -0,0 +1,161 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleReadback.cc -- Asynchronous readback of the particle positions
+ *
+ **/
+
+#include "particleReadback.h"
+
+#include <assert.h>
+
+/// Client waits are done in slices of this many nanoseconds
+static const GLuint64EXT WAIT_SLICE = 1000000000ull;
+
+particleReadback::particleReadback (GLuint depth) : ring(depth), head(0), numPending(0),
+						    numFrames(0), numStalls(0), numDropped(0), nextId(0) {
+
+	assert( depth > 0 );
+
+	for (GLuint k = 0; k < depth; ++k)
+		ring[k] = slot();
+
+}
+
+bool particleReadback::supported (void) {
+
+	return sync_support() && copy_buffer_support();
+
+}
+
+int particleReadback::add_consumer (const consumer& c) {
+
+	consumers.push_back(std::make_pair(nextId, c));
+	return nextId++;
+
+}
+
+void particleReadback::remove_consumer (int id) {
+
+	for (unsigned i = 0; i < consumers.size(); ++i)
+		if (consumers[i].first == id) {
+			consumers.erase(consumers.begin() + i);
+			return;
+		}
+
+}
+
+/// The copy only grows its buffer when the particles outgrow it; the
+/// fence is flushed by the first wait on it
+
+void particleReadback::queue (particleEngine& engine) {
+
+	poll();
+
+	if (numPending == ring.size()) {
+		++numStalls;
+		consume();
+	}
+
+	slot& s = ring[head];
+	s.count = engine.size();
+	s.stride = engine.positions_stride();
+	s.offset = engine.velocities_offset();
+	s.frame = numFrames++;
+
+	GLsizeiptr bytes = engine.copy_floats()*sizeof(GLfloat);
+
+	if (!s.buffer)
+		glGenBuffers(1, &s.buffer);
+
+	if (bytes > s.capacity) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+		glBufferData(GL_PIXEL_PACK_BUFFER, bytes, 0, GL_STREAM_READ);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		s.capacity = bytes;
+	}
+
+	engine.copy_positions(s.buffer);
+	s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	head = (head + 1) % ring.size();
+	++numPending;
+
+}
+
+void particleReadback::poll (bool wait) {
+
+	while (numPending) {
+
+		slot& s = ring[(head + ring.size() - numPending) % ring.size()];
+
+		if (!wait) {
+			GLenum status = glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+			if (status == GL_TIMEOUT_EXPIRED)
+				return;
+		}
+
+		consume();
+
+	}
+
+}
+
+void particleReadback::consume (void) {
+
+	assert( numPending );
+
+	slot& s = ring[(head + ring.size() - numPending) % ring.size()];
+
+	GLenum status;
+	do {
+		status = glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, WAIT_SLICE);
+	} while (status == GL_TIMEOUT_EXPIRED);
+
+	assert( status != GL_WAIT_FAILED );
+
+	glDeleteSync(s.fence);
+	s.fence = 0;
+	--numPending;
+
+	if (!s.count || consumers.empty())
+		return;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+	const GLfloat *data = (const GLfloat*) glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+
+	// a buffer that cannot be mapped loses its frame, the consumers
+	// never see a view without data
+	if (!data) {
+		++numDropped;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		return;
+	}
+
+	view v = { data, data + s.offset, s.count, s.stride, s.frame };
+
+	for (unsigned i = 0; i < consumers.size(); ++i)
+		consumers[i].second(v);
+
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+}
+
+void particleReadback::clear (void) {
+
+	for (GLuint k = 0; k < ring.size(); ++k) {
+
+		if (ring[k].fence)
+			glDeleteSync(ring[k].fence);
+		if (ring[k].buffer)
+			glDeleteBuffers(1, &ring[k].buffer);
+
+		ring[k] = slot();
+
+	}
+
+	head = numPending = 0;
+
+}
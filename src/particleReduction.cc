@@ -0,0 +1,231 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleReduction.cc -- Particle statistics reduced on the GPU
+ *
+ **/
+
+#include "particleReduction.h"
+
+#include <assert.h>
+#include <string.h>
+
+/// Storage buffer bindings of reduce.comp
+enum { BINDING_INPUT = 0, BINDING_SUMS = 1 };
+
+particleReduction::particleReduction () : groupSize(256), maxGroups(0), buffer_state(0), buffer_result(0),
+					  capacity(0), stateCapacity(0), fence(0) {
+
+	ssbo_results[0] = ssbo_results[1] = 0;
+	latest.clear();
+
+}
+
+bool particleReduction::supported (void) {
+
+	return compute_shader_support() && sync_support() && copy_buffer_support();
+
+}
+
+/// The shared memory holds one result, 16 floats, per invocation
+
+void particleReduction::install (bool debug, GLuint group_size) {
+
+	GLint max_invocations = 0, max_shared = 0, max_groups = 0;
+	glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &max_invocations);
+	glGetIntegerv(GL_MAX_COMPUTE_SHARED_MEMORY_SIZE, &max_shared);
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max_groups);
+	maxGroups = max_groups;
+
+	groupSize = group_size;
+	if (groupSize < 1) groupSize = 1;
+	if (groupSize > (GLuint)max_invocations) groupSize = max_invocations;
+	if (groupSize*sizeof(particleStats) > (GLuint)max_shared) groupSize = max_shared / sizeof(particleStats);
+
+	for (int k = 0; k < NUM_PASSES; ++k) {
+
+		passes[k].set_define("GROUP_SIZE", groupSize);
+		passes[k].set_define("PASS", k);
+		passes[k].compute_source("reduce.comp");
+		passes[k].install(debug);
+
+	}
+
+}
+
+/// Buffers only grow, as in the readback; a pass leaves one result per
+/// work group, at most the dispatch limit of them
+
+void particleReduction::reserve (GLuint n) {
+
+	if (!ssbo_results[0])
+		glGenBuffers(2, ssbo_results);
+
+	if (n <= capacity)
+		return;
+
+	GLuint numGroups = (n + groupSize - 1) / groupSize;
+	if (numGroups > maxGroups) numGroups = maxGroups;
+
+	capacity = n;
+	for (int k = 0; k < 2; ++k) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_results[k]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, numGroups*sizeof(particleStats), 0, GL_DYNAMIC_COPY);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+}
+
+/// Each pass reads from the buffer the one before wrote, the results
+/// ping-ponging between the two buffers
+
+GLuint particleReduction::reduce (GLuint from, GLuint n, int pass) {
+
+	int to = 0;
+
+	do {
+
+		GLuint numGroups = (n + groupSize - 1) / groupSize;
+		if (numGroups > maxGroups) numGroups = maxGroups;
+
+		passes[pass].use();
+		passes[pass].set_uniform("n", (GLint)n);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_INPUT, from);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SUMS, ssbo_results[to]);
+		glDispatchCompute(numGroups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		n = numGroups;
+		from = ssbo_results[to];
+		to = 1 - to;
+		pass = PASS_RESULTS;
+
+	} while (n > 1);
+
+	passes[PASS_RESULTS].use(0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_INPUT, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SUMS, 0);
+
+	return from;
+
+}
+
+bool particleReduction::queue (particleEngine& engine) {
+
+	if (fence)
+		return false;
+
+	GLuint n = engine.size(), floats = engine.copy_floats();
+
+	if (!n)
+		return false;
+
+	if (!buffer_state) {
+		glGenBuffers(1, &buffer_state);
+		glGenBuffers(1, &buffer_result);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_result);
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(particleStats), 0, GL_STREAM_READ);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	if (floats > stateCapacity) {
+		stateCapacity = floats;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer_state);
+		glBufferData(GL_PIXEL_PACK_BUFFER, stateCapacity*sizeof(GLfloat), 0, GL_STREAM_COPY);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	reserve(n);
+
+	engine.copy_positions(buffer_state);
+
+	passes[PASS_PARTICLES].use();
+	passes[PASS_PARTICLES].set_uniform("stride", (GLint)(engine.positions_stride() / 4));
+	passes[PASS_PARTICLES].set_uniform("velocityOffset", (GLint)(engine.velocities_offset() / 4));
+
+	GLuint from = reduce(buffer_state, n, PASS_PARTICLES);
+
+	glBindBuffer(GL_COPY_READ_BUFFER, from);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_result);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(particleStats));
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	return true;
+
+}
+
+/// The values sum in sum.x of the result, read with the GPU done, the
+/// first pass zeroing each value it reads; a queued reduction has
+/// already copied its result, so it is not touched
+
+GLfloat particleReduction::sum_and_clear (GLuint buffer, GLuint n) {
+
+	if (!n)
+		return 0.0;
+
+	reserve(n);
+
+	GLuint from = reduce(buffer, n, PASS_VALUES);
+
+	particleStats result;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, from);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(particleStats), &result);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	return result.sum[0];
+
+}
+
+bool particleReduction::poll (bool wait) {
+
+	if (!fence)
+		return false;
+
+	GLenum status;
+	do {
+		status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000ull : 0);
+	} while (wait && status == GL_TIMEOUT_EXPIRED);
+
+	if (status == GL_TIMEOUT_EXPIRED)
+		return false;
+
+	assert( status != GL_WAIT_FAILED );
+
+	glDeleteSync(fence);
+	fence = 0;
+
+	glBindBuffer(GL_COPY_READ_BUFFER, buffer_result);
+	const void *data = glMapBuffer(GL_COPY_READ_BUFFER, GL_READ_ONLY);
+	assert( data );
+	memcpy(&latest, data, sizeof(particleStats));
+	glUnmapBuffer(GL_COPY_READ_BUFFER);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	return true;
+
+}
+
+void particleReduction::clear (void) {
+
+	if (fence)
+		glDeleteSync(fence);
+	fence = 0;
+
+	if (buffer_state) {
+		glDeleteBuffers(1, &buffer_state);
+		glDeleteBuffers(1, &buffer_result);
+	}
+	if (ssbo_results[0])
+		glDeleteBuffers(2, ssbo_results);
+
+	buffer_state = buffer_result = 0;
+	ssbo_results[0] = ssbo_results[1] = 0;
+	capacity = stateCapacity = 0;
+
+}
@@ -0,0 +1,463 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleSDF.cc -- Signed distance field of a mesh the particles collide with
+ *
+ **/
+
+#include "particleSDF.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+/// Triangles per leaf of the hierarchy
+static const GLuint LEAF_SIZE = 4;
+
+/// Directions of the sign rays, both ways along each axis and one
+/// diagonal, slightly off so they do not run along the edges of axis
+/// aligned meshes
+static const int NUM_RAYS = 7;
+static const GLfloat rayDirections[NUM_RAYS][3] = { { 1.0f, 0.0013f, 0.0027f }, { -1.0f, -0.0029f, 0.0019f },
+						    { 0.0031f, 1.0f, 0.0017f }, { -0.0021f, -1.0f, -0.0033f },
+						    { 0.0023f, 0.0011f, 1.0f }, { 0.0017f, -0.0037f, -1.0f },
+						    { 0.5774f, 0.5771f, 0.5777f } };
+
+static inline void sub (const GLfloat a[3], const GLfloat b[3], GLfloat r[3]) {
+	r[0] = a[0] - b[0]; r[1] = a[1] - b[1]; r[2] = a[2] - b[2];
+}
+
+static inline GLfloat dot (const GLfloat a[3], const GLfloat b[3]) {
+	return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+static inline void cross (const GLfloat a[3], const GLfloat b[3], GLfloat r[3]) {
+	r[0] = a[1]*b[2] - a[2]*b[1]; r[1] = a[2]*b[0] - a[0]*b[2]; r[2] = a[0]*b[1] - a[1]*b[0];
+}
+
+/// Squared distance from a point to a triangle, by the region of the
+/// triangle plane the point projects to
+/// @arg p point
+/// @arg a, b, c triangle corners
+
+static GLfloat pointTriangle (const GLfloat p[3], const GLfloat a[3], const GLfloat b[3], const GLfloat c[3]) {
+
+	GLfloat ab[3], ac[3], ap[3], q[3];
+	sub(b, a, ab); sub(c, a, ac); sub(p, a, ap);
+
+	GLfloat d1 = dot(ab, ap), d2 = dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f)
+		return dot(ap, ap);
+
+	GLfloat bp[3];
+	sub(p, b, bp);
+	GLfloat d3 = dot(ab, bp), d4 = dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3)
+		return dot(bp, bp);
+
+	GLfloat cp[3];
+	sub(p, c, cp);
+	GLfloat d5 = dot(ab, cp), d6 = dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6)
+		return dot(cp, cp);
+
+	GLfloat u, v;
+	GLfloat vc = d1*d4 - d3*d2, vb = d5*d2 - d1*d6, va = d3*d6 - d5*d4;
+
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+		u = d1 / (d1 - d3); v = 0.0f; // edge ab
+	} else if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+		u = 0.0f; v = d2 / (d2 - d6); // edge ac
+	} else if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+		GLfloat w = (d4 - d3) / ((d4 - d3) + (d5 - d6)); // edge bc
+		u = 1.0f - w; v = w;
+	} else {
+		GLfloat denom = 1.0f / (va + vb + vc); // inside
+		u = vb*denom; v = vc*denom;
+	}
+
+	for (int c = 0; c < 3; ++c)
+		q[c] = ap[c] - u*ab[c] - v*ac[c];
+
+	return dot(q, q);
+
+}
+
+/// Squared distance from a point to a box, 0 inside
+
+static inline GLfloat pointBox (const GLfloat p[3], const GLfloat lo[3], const GLfloat hi[3]) {
+
+	GLfloat d2 = 0.0f;
+	for (int c = 0; c < 3; ++c) {
+		GLfloat d = std::max(std::max(lo[c] - p[c], p[c] - hi[c]), 0.0f);
+		d2 += d*d;
+	}
+
+	return d2;
+
+}
+
+particleSDF::particleSDF () : resolution(0), bakeTime(0.0), tex_field(0) {
+
+	boxMin[0] = boxMin[1] = boxMin[2] = -1.0;
+	boxMax[0] = boxMax[1] = boxMax[2] = 1.0;
+
+}
+
+/// OBJ indices count from 1, negative ones back from the last vertex;
+/// texture and normal indices after a slash are skipped
+
+bool particleSDF::load_obj (const char *filename) {
+
+	FILE *f = fopen(filename, "r");
+	if (!f)
+		return false;
+
+	std::vector< GLfloat > v;
+	std::vector< GLuint > t;
+	char line[1024];
+
+	while (fgets(line, sizeof(line), f)) {
+
+		if (line[0] == 'v' && line[1] == ' ') {
+
+			GLfloat x, y, z;
+			if (sscanf(line + 2, "%f %f %f", &x, &y, &z) == 3) {
+				v.push_back(x); v.push_back(y); v.push_back(z);
+			}
+
+		} else if (line[0] == 'f' && line[1] == ' ') {
+
+			std::vector< GLuint > face;
+			char *s = line + 2, *end;
+
+			for (long k = strtol(s, &end, 10); end != s; k = strtol(s, &end, 10)) {
+
+				long n = v.size() / 3;
+				face.push_back(k < 0 ? n + k : k - 1);
+
+				s = end;
+				while (*s && *s != ' ' && *s != '\t')
+					++s;
+
+			}
+
+			for (GLuint k = 2; k < face.size(); ++k) {
+				t.push_back(face[0]); t.push_back(face[k - 1]); t.push_back(face[k]);
+			}
+
+		}
+
+	}
+
+	fclose(f);
+
+	for (GLuint k = 0; k < t.size(); ++k)
+		if (t[k] >= v.size() / 3)
+			return false;
+
+	if (t.empty())
+		return false;
+
+	set_mesh(&v[0], v.size() / 3, &t[0], t.size() / 3);
+
+	return true;
+
+}
+
+void particleSDF::set_mesh (const GLfloat *v, GLuint num_vertices, const GLuint *t, GLuint num_triangles) {
+
+	assert( num_triangles > 0 );
+
+	vertices.assign(v, v + 3*num_vertices);
+	indices.assign(t, t + 3*num_triangles);
+
+	order.resize(num_triangles);
+	for (GLuint k = 0; k < num_triangles; ++k)
+		order[k] = k;
+
+	nodes.assign(1, node());
+	build(0, 0, num_triangles);
+
+}
+
+void particleSDF::fit (const GLfloat lo[3], const GLfloat hi[3]) {
+
+	GLfloat mlo[3] = { 1e30f, 1e30f, 1e30f }, mhi[3] = { -1e30f, -1e30f, -1e30f };
+
+	for (GLuint k = 0; k < vertices.size(); ++k) {
+		mlo[k%3] = std::min(mlo[k%3], vertices[k]);
+		mhi[k%3] = std::max(mhi[k%3], vertices[k]);
+	}
+
+	GLfloat scale = 1e30f;
+	for (int c = 0; c < 3; ++c)
+		if (mhi[c] > mlo[c])
+			scale = std::min(scale, (hi[c] - lo[c]) / (mhi[c] - mlo[c]));
+
+	for (GLuint k = 0; k < vertices.size(); ++k) {
+		int c = k%3;
+		vertices[k] = 0.5f*(lo[c] + hi[c]) + (vertices[k] - 0.5f*(mlo[c] + mhi[c]))*scale;
+	}
+
+	/// the boxes of the hierarchy move with the mesh
+	nodes.assign(1, node());
+	build(0, 0, triangles());
+
+}
+
+/// The triangles are split at the median of their centers along the
+/// longest axis of the box, the two children allocated together
+/// @arg index node, already allocated
+/// @arg begin, end range of the order
+
+void particleSDF::build (GLuint index, GLuint begin, GLuint end) {
+
+	node n;
+	n.lo[0] = n.lo[1] = n.lo[2] = 1e30f;
+	n.hi[0] = n.hi[1] = n.hi[2] = -1e30f;
+
+	for (GLuint k = begin; k < end; ++k)
+		for (int j = 0; j < 3; ++j) {
+			const GLfloat *v = &vertices[3*indices[3*order[k] + j]];
+			for (int c = 0; c < 3; ++c) {
+				n.lo[c] = std::min(n.lo[c], v[c]);
+				n.hi[c] = std::max(n.hi[c], v[c]);
+			}
+		}
+
+	if (end - begin <= LEAF_SIZE) {
+		n.first = begin;
+		n.count = end - begin;
+		nodes[index] = n;
+		return;
+	}
+
+	int axis = 0;
+	for (int c = 1; c < 3; ++c)
+		if (n.hi[c] - n.lo[c] > n.hi[axis] - n.lo[axis])
+			axis = c;
+
+	/// the sum of the corners orders the centers
+	const GLfloat *v = &vertices[0];
+	const GLuint *t = &indices[0];
+	GLuint mid = (begin + end) / 2;
+
+	std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+			 [v, t, axis] (GLuint a, GLuint b) {
+				 return v[3*t[3*a] + axis] + v[3*t[3*a + 1] + axis] + v[3*t[3*a + 2] + axis] <
+					 v[3*t[3*b] + axis] + v[3*t[3*b + 1] + axis] + v[3*t[3*b + 2] + axis];
+			 });
+
+	n.first = nodes.size();
+	n.count = 0;
+	nodes[index] = n;
+
+	nodes.push_back(node());
+	nodes.push_back(node());
+	build(n.first, begin, mid);
+	build(n.first + 1, mid, end);
+
+}
+
+/// Depth first, the nearer child first, skipping the boxes farther than
+/// the closest triangle so far
+
+GLfloat particleSDF::closest (const GLfloat p[3]) const {
+
+	GLfloat best = 1e30f;
+	GLuint stack[64];
+	int top = 0;
+
+	stack[top++] = 0;
+
+	while (top) {
+
+		const node& n = nodes[stack[--top]];
+
+		if (pointBox(p, n.lo, n.hi) >= best)
+			continue;
+
+		if (n.count) {
+
+			for (GLuint k = n.first; k < n.first + n.count; ++k) {
+				const GLuint *t = &indices[3*order[k]];
+				best = std::min(best, pointTriangle(p, &vertices[3*t[0]], &vertices[3*t[1]], &vertices[3*t[2]]));
+			}
+
+			continue;
+
+		}
+
+		const node& a = nodes[n.first];
+		const node& b = nodes[n.first + 1];
+
+		assert( top + 2 <= 64 );
+
+		if (pointBox(p, a.lo, a.hi) < pointBox(p, b.lo, b.hi)) {
+			stack[top++] = n.first + 1;
+			stack[top++] = n.first;
+		} else {
+			stack[top++] = n.first;
+			stack[top++] = n.first + 1;
+		}
+
+	}
+
+	return best;
+
+}
+
+/// Boxes are tested by their slabs, triangles by Moller-Trumbore
+
+GLuint particleSDF::crossings (const GLfloat p[3], const GLfloat d[3]) const {
+
+	GLfloat inv[3] = { 1.0f / d[0], 1.0f / d[1], 1.0f / d[2] };
+	GLuint count = 0;
+	GLuint stack[64];
+	int top = 0;
+
+	stack[top++] = 0;
+
+	while (top) {
+
+		const node& n = nodes[stack[--top]];
+
+		GLfloat tmin = 0.0f, tmax = 1e30f;
+		for (int c = 0; c < 3; ++c) {
+			GLfloat t0 = (n.lo[c] - p[c])*inv[c], t1 = (n.hi[c] - p[c])*inv[c];
+			tmin = std::max(tmin, std::min(t0, t1));
+			tmax = std::min(tmax, std::max(t0, t1));
+		}
+
+		if (tmin > tmax)
+			continue;
+
+		if (!n.count) {
+			assert( top + 2 <= 64 );
+			stack[top++] = n.first;
+			stack[top++] = n.first + 1;
+			continue;
+		}
+
+		for (GLuint k = n.first; k < n.first + n.count; ++k) {
+
+			const GLuint *t = &indices[3*order[k]];
+			const GLfloat *a = &vertices[3*t[0]];
+
+			GLfloat e1[3], e2[3], h[3], s[3], q[3];
+			sub(&vertices[3*t[1]], a, e1);
+			sub(&vertices[3*t[2]], a, e2);
+			cross(d, e2, h);
+
+			GLfloat det = dot(e1, h);
+			if (det == 0.0f)
+				continue;
+
+			sub(p, a, s);
+			GLfloat u = dot(s, h) / det;
+			if (u < 0.0f || u > 1.0f)
+				continue;
+
+			cross(s, e1, q);
+			GLfloat v = dot(d, q) / det;
+			if (v < 0.0f || u + v > 1.0f)
+				continue;
+
+			if (dot(e2, q) / det > 0.0f)
+				++count;
+
+		}
+
+	}
+
+	return count;
+
+}
+
+GLfloat particleSDF::signed_distance (const GLfloat p[3]) const {
+
+	GLfloat d = sqrtf(closest(p));
+
+	int inside = 0;
+	for (int r = 0; r < NUM_RAYS; ++r)
+		inside += crossings(p, rayDirections[r]) % 2;
+
+	return 2*inside > NUM_RAYS ? -d : d;
+
+}
+
+void particleSDF::bake (GLuint res, const GLfloat lo[3], const GLfloat hi[3], threadPool& pool) {
+
+	assert( !nodes.empty() && res > 0 );
+
+	std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+
+	resolution = res;
+	for (int c = 0; c < 3; ++c) {
+		boxMin[c] = lo[c];
+		boxMax[c] = hi[c];
+	}
+
+	field.resize(res*res*res);
+
+	/// one row of samples along x at a time
+	pool.run(res*res, [this, res] (size_t begin, size_t end) {
+
+			for (size_t row = begin; row < end; ++row)
+				for (GLuint x = 0; x < res; ++x) {
+
+					GLuint index[3] = { x, (GLuint)(row % res), (GLuint)(row / res) };
+					GLfloat p[3];
+					for (int c = 0; c < 3; ++c)
+						p[c] = boxMin[c] + (index[c] + 0.5f)*(boxMax[c] - boxMin[c]) / res;
+
+					field[row*res + x] = signed_distance(p);
+
+				}
+
+		});
+
+	bakeTime = std::chrono::duration< double, std::milli >( std::chrono::high_resolution_clock::now() - t0 ).count();
+
+	/// samples are the texel centers, filtered linearly between them
+	if (!tex_field)
+		glGenTextures(1, &tex_field);
+
+	glsl_bind_texture(0, GL_TEXTURE_3D, tex_field);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, res, res, res, 0, GL_RED, GL_FLOAT, &field[0]);
+
+}
+
+void particleSDF::bind (glslKernel& kernel) {
+
+	assert( tex_field );
+
+	kernel.bind_texture("sdfTex", tex_field);
+	kernel.set_uniform("sdfMin", boxMin[0], boxMin[1], boxMin[2]);
+	kernel.set_uniform("sdfMax", boxMax[0], boxMax[1], boxMax[2]);
+	kernel.set_uniform("sdfStep", (boxMax[0] - boxMin[0]) / resolution, (boxMax[1] - boxMin[1]) / resolution,
+			   (boxMax[2] - boxMin[2]) / resolution);
+
+}
+
+void particleSDF::clear (void) {
+
+	if (!tex_field)
+		return;
+
+	glsl_release_texture(tex_field);
+	glDeleteTextures(1, &tex_field);
+	tex_field = 0;
+
+}
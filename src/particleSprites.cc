@@ -0,0 +1,365 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleSprites.cc -- Particle sprites drawn by instancing
+ *
+ **/
+
+#include "particleSprites.h"
+
+#include <math.h>
+#include <assert.h>
+
+/// Attribute indices of sprites.vert, the corner is the per vertex one
+enum { ATTRIB_CORNER = 0, ATTRIB_POSITION = 1, ATTRIB_VELOCITY = 2, ATTRIB_PREVIOUS_POSITION = 3 };
+
+/// Storage buffer bindings of depthsort.comp
+enum { BINDING_STATE = 0, BINDING_PREVIOUS = 1, BINDING_KEYS = 2, BINDING_ORDER = 3, BINDING_SORTED = 4 };
+
+/// Remaining life over which sprites of emitters shrink and fade out
+static const GLfloat FADE_LIFE = 0.25;
+
+/// Bits of the depth keys, as in depthsort.comp
+static const GLuint DEPTH_BITS = 16;
+
+/// Floats per particle of the sorted state
+static const GLuint SORTED_FLOATS = 12;
+
+particleSprites::particleSprites () : groupSize(256), ssbo_keys(0), ssbo_order(0), ssbo_sorted(0),
+				      sortCapacity(0), sortDepth(false), sortReady(false),
+				      vbo_corners(0), tex_depth(0), depthWidth(0), depthHeight(0),
+				      spriteSize(0.01), softness(0.0) {
+
+}
+
+bool particleSprites::install (bool debug) {
+
+	if (!instancing_support())
+		return false;
+
+	bufferShader.set_define("TEXTURES", 0);
+	bufferShader.vertex_source("sprites.vert");
+	bufferShader.fragment_source("sprites.frag");
+	bufferShader.bind_attribute_location("corner", ATTRIB_CORNER);
+	bufferShader.bind_attribute_location("position", ATTRIB_POSITION);
+	bufferShader.bind_attribute_location("velocity", ATTRIB_VELOCITY);
+	bufferShader.bind_attribute_location("previousPosition", ATTRIB_PREVIOUS_POSITION);
+	bufferShader.install(debug);
+
+	textureShader.set_define("TEXTURES", 1);
+	textureShader.vertex_source("sprites.vert");
+	textureShader.fragment_source("sprites.frag");
+	textureShader.bind_attribute_location("corner", ATTRIB_CORNER);
+	textureShader.install(debug);
+
+	sortReady = compute_shader_support();
+
+	if (sortReady) {
+
+		GLint max_invocations = 0;
+		glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &max_invocations);
+		if (groupSize > (GLuint)max_invocations) groupSize = max_invocations;
+
+		for (int k = 0; k < NUM_SORT_PASSES; ++k) {
+
+			glslKernel *passes[] = { &bufferSort[k], &textureSort[k] };
+
+			for (int t = 0; t < 2; ++t) {
+				passes[t]->set_define("GROUP_SIZE", groupSize);
+				passes[t]->set_define("PASS", k);
+				passes[t]->set_define("TEXTURES", t);
+				passes[t]->compute_source("depthsort.comp");
+				passes[t]->install(debug);
+			}
+
+		}
+
+		sorter.install(debug, groupSize);
+
+	}
+
+	if (!vbo_corners) {
+
+		GLfloat corners[] = { -1.0, -1.0,  1.0, -1.0,  -1.0, 1.0,  1.0, 1.0 };
+
+		glGenBuffers(1, &vbo_corners);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_corners);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	}
+
+	return true;
+
+}
+
+/// The depth texture follows the viewport size, reallocated only when
+/// the viewport changes
+
+void particleSprites::capture_depth (void) {
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	if (!tex_depth)
+		glGenTextures(1, &tex_depth);
+
+	glsl_bind_texture(0, GL_TEXTURE_2D, tex_depth);
+
+	if (viewport[2] != depthWidth || viewport[3] != depthHeight) {
+
+		depthWidth = viewport[2];
+		depthHeight = viewport[3];
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, viewport[0], viewport[1],
+				 depthWidth, depthHeight, 0);
+
+	} else {
+
+		glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewport[0], viewport[1], depthWidth, depthHeight);
+
+	}
+
+}
+
+/// Sprites are blended in premultiplied alpha without writing depth, so
+/// the order they are drawn in does not cut them; the soft fade only
+/// applies once a depth has been captured
+
+void particleSprites::begin (glslKernel& shader, GLuint n, GLfloat alpha) {
+
+	glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_POLYGON_BIT);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	glDepthMask(GL_FALSE);
+
+	shader.use();
+	shader.set_uniform("numParticles", (GLint)n);
+	shader.set_uniform("alpha", (GLfloat)alpha);
+	shader.set_uniform("size", (GLfloat)spriteSize);
+	shader.set_uniform("fade", (GLfloat)FADE_LIFE);
+	shader.set_uniform("softness", (GLfloat)(tex_depth ? softness : 0.0));
+	shader.set_uniform("viewport", (GLfloat)depthWidth, (GLfloat)depthHeight);
+	if (tex_depth)
+		shader.bind_texture("depthTex", tex_depth);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_corners);
+	glVertexAttribPointer(ATTRIB_CORNER, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(ATTRIB_CORNER);
+
+}
+
+void particleSprites::end (GLuint n) {
+
+	glDrawArraysInstancedARB(GL_TRIANGLE_STRIP, 0, 4, n);
+
+	glDisableVertexAttribArray(ATTRIB_CORNER);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glPopAttrib();
+
+}
+
+/// The keys come from the view depth of the positions over the depth
+/// range of the box, read from the modelview of the draw
+
+void particleSprites::sort_keys (glslKernel& pass, GLuint n) {
+
+	GLfloat m[16];
+	glGetFloatv(GL_MODELVIEW_MATRIX, m);
+
+	GLfloat range = fabs(m[2]) + fabs(m[6]) + fabs(m[10]);
+
+	/// buffers only grow, as in the sort
+	if (n > sortCapacity) {
+
+		if (sortCapacity) {
+			glDeleteBuffers(1, &ssbo_keys);
+			glDeleteBuffers(1, &ssbo_order);
+			glDeleteBuffers(1, &ssbo_sorted);
+		}
+
+		sortCapacity = n;
+
+		GLuint *buffers[] = { &ssbo_keys, &ssbo_order, &ssbo_sorted };
+		GLuint sizes[] = { sortCapacity, sortCapacity, SORTED_FLOATS*sortCapacity };
+
+		for (int k = 0; k < 3; ++k) {
+			glGenBuffers(1, buffers[k]);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, *buffers[k]);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizes[k]*sizeof(GLfloat), 0, GL_DYNAMIC_COPY);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	}
+
+	GLuint numGroups = (n + groupSize - 1) / groupSize;
+
+	GLint max_groups = 0;
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max_groups);
+	assert( numGroups <= (GLuint)max_groups );
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_KEYS, ssbo_keys);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_ORDER, ssbo_order);
+
+	pass.set_uniform("numParticles", (GLint)n);
+	pass.set_uniform("viewZ", m[2], m[6], m[10]);
+	pass.set_uniform("range", (GLfloat)(range > 0.0 ? range : 1.0));
+	glDispatchCompute(numGroups, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	pass.use(false);
+
+	sorter.sort(ssbo_keys, ssbo_order, n, DEPTH_BITS);
+
+}
+
+void particleSprites::gather (glslKernel& pass, GLuint n) {
+
+	GLuint numGroups = (n + groupSize - 1) / groupSize;
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_ORDER, ssbo_order);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SORTED, ssbo_sorted);
+
+	pass.set_uniform("numParticles", (GLint)n);
+	glDispatchCompute(numGroups, 1, 1);
+	glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+	pass.use(false);
+
+	for (int b = BINDING_STATE; b <= BINDING_SORTED; ++b)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, 0);
+
+}
+
+void particleSprites::draw_instances (GLuint state, GLuint previous, GLsizei stride, GLsizei previous_offset,
+				      GLuint n, GLfloat alpha) {
+
+	begin(bufferShader, n, alpha);
+
+	GLuint attribs[] = { ATTRIB_POSITION, ATTRIB_VELOCITY, ATTRIB_PREVIOUS_POSITION };
+	GLuint buffers[] = { state, state, previous };
+	GLsizei offsets[] = { 0, 4*sizeof(GLfloat), previous_offset };
+
+	/// one position and velocity per instance, all corners share them
+	for (int k = 0; k < 3; ++k) {
+		glBindBuffer(GL_ARRAY_BUFFER, buffers[k]);
+		glVertexAttribPointer(attribs[k], 4, GL_FLOAT, GL_FALSE, stride, (const GLvoid*)(size_t)offsets[k]);
+		glVertexAttribDivisor(attribs[k], 1);
+		glEnableVertexAttribArray(attribs[k]);
+	}
+
+	end(n);
+
+	for (int k = 0; k < 3; ++k) {
+		glVertexAttribDivisor(attribs[k], 0);
+		glDisableVertexAttribArray(attribs[k]);
+	}
+
+	bufferShader.use(false);
+
+}
+
+/// Sorted, the sprites are drawn from the gathered state instead, the
+/// same attributes at the stride of the sorted buffer
+
+void particleSprites::draw_buffers (GLuint state, GLuint previous, GLsizei stride, GLuint n, GLfloat alpha) {
+
+	if (!sorted()) {
+		draw_instances(state, previous, stride, 0, n, alpha);
+		return;
+	}
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_STATE, state);
+
+	bufferSort[PASS_KEYS].use();
+	bufferSort[PASS_KEYS].set_uniform("stride", (GLint)(stride / (4*sizeof(GLfloat))));
+	sort_keys(bufferSort[PASS_KEYS], n);
+
+	/// the sort leaves its bindings unbound
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_STATE, state);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_PREVIOUS, previous);
+
+	bufferSort[PASS_GATHER].use();
+	bufferSort[PASS_GATHER].set_uniform("stride", (GLint)(stride / (4*sizeof(GLfloat))));
+	gather(bufferSort[PASS_GATHER], n);
+
+	draw_instances(ssbo_sorted, ssbo_sorted, SORTED_FLOATS*sizeof(GLfloat), 8*sizeof(GLfloat), n, alpha);
+
+}
+
+void particleSprites::draw_textures (GLuint position, GLuint previous, GLuint velocity,
+				     GLuint width, GLuint height, GLuint n, GLfloat alpha) {
+
+	if (sorted()) {
+
+		textureSort[PASS_KEYS].use();
+		textureSort[PASS_KEYS].bind_texture("positionTex", position);
+		textureSort[PASS_KEYS].set_uniform("texWidth", (GLint)width);
+		sort_keys(textureSort[PASS_KEYS], n);
+
+		textureSort[PASS_GATHER].use();
+		textureSort[PASS_GATHER].bind_texture("positionTex", position);
+		textureSort[PASS_GATHER].bind_texture("previousPositionTex", previous);
+		textureSort[PASS_GATHER].bind_texture("velocityTex", velocity);
+		textureSort[PASS_GATHER].set_uniform("texWidth", (GLint)width);
+		gather(textureSort[PASS_GATHER], n);
+
+		// as below, the previous set is rendered to by the next step
+		textureSort[PASS_GATHER].use();
+		textureSort[PASS_GATHER].bind_texture("previousPositionTex", position);
+		textureSort[PASS_GATHER].use(false);
+
+		draw_instances(ssbo_sorted, ssbo_sorted, SORTED_FLOATS*sizeof(GLfloat), 8*sizeof(GLfloat), n, alpha);
+		return;
+
+	}
+
+	begin(textureShader, n, alpha);
+
+	textureShader.bind_texture("positionTex", position);
+	textureShader.bind_texture("previousPositionTex", previous);
+	textureShader.bind_texture("velocityTex", velocity);
+	textureShader.set_uniform("texSize", (GLfloat)width, (GLfloat)height);
+
+	end(n);
+
+	// the previous set is rendered to by the next step: do not leave it
+	// bound for sampling
+	textureShader.bind_texture("previousPositionTex", position);
+
+	textureShader.use(false);
+
+}
+
+void particleSprites::clear (void) {
+
+	if (vbo_corners)
+		glDeleteBuffers(1, &vbo_corners);
+
+	if (tex_depth) {
+		glsl_release_texture(tex_depth);
+		glDeleteTextures(1, &tex_depth);
+	}
+
+	vbo_corners = tex_depth = 0;
+	depthWidth = depthHeight = 0;
+
+	if (sortCapacity) {
+		glDeleteBuffers(1, &ssbo_keys);
+		glDeleteBuffers(1, &ssbo_order);
+		glDeleteBuffers(1, &ssbo_sorted);
+	}
+
+	ssbo_keys = ssbo_order = ssbo_sorted = 0;
+	sortCapacity = 0;
+
+	sorter.clear();
+
+}
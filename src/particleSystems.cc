@@ -0,0 +1,145 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleSystems.cc -- Particle systems batched in the compute engine
+ *
+ **/
+
+#include "particleSystems.h"
+
+#include <assert.h>
+
+/// Storage buffer binding of the table in particles.comp
+enum { BINDING_SYSTEMS = 3 };
+
+/// System in the layout of particles.comp, 16 words
+struct gpuSystem {
+	GLfloat boundsMin[4]; ///< Box, scale of the gravity
+	GLfloat boundsMax[4]; ///< Box, scale of the time step
+	GLfloat origin[4]; ///< Reset position
+	GLint range[4]; ///< First particle, particles, reset step, integrator
+};
+
+particleSystems::particleSystems () : numParticles(0), ssbo_systems(0) {
+
+}
+
+int particleSystems::add (const system& s) {
+
+	systems.push_back(s);
+	steps.push_back(0);
+
+	return systems.size() - 1;
+
+}
+
+/// Every system gets its share of the particles rounded down at its
+/// end, so the ranges cover all particles whatever n
+
+GLuint particleSystems::first (GLuint s, GLuint n) const {
+
+	GLfloat total = 0.0, before = 0.0;
+
+	for (GLuint k = 0; k < systems.size(); ++k) {
+		if (k < s)
+			before += systems[k].share;
+		total += systems[k].share;
+	}
+
+	if (s >= systems.size())
+		return n;
+
+	return (GLuint)(n*(double)before / total);
+
+}
+
+GLuint particleSystems::system_of (GLuint i, GLuint n) const {
+
+	GLuint s = 0;
+	while (s + 1 < systems.size() && first(s + 1, n) <= i)
+		++s;
+
+	return s;
+
+}
+
+void particleSystems::set_state (GLuint n) {
+
+	assert( !systems.empty() );
+
+	clear();
+
+	numParticles = n;
+
+	for (GLuint s = 0; s < systems.size(); ++s)
+		steps[s] = 0;
+
+	glGenBuffers(1, &ssbo_systems);
+	upload();
+
+}
+
+void particleSystems::upload (void) {
+
+	std::vector< gpuSystem > table(systems.size());
+
+	for (GLuint s = 0; s < systems.size(); ++s) {
+
+		const system& sys = systems[s];
+		gpuSystem& g = table[s];
+
+		for (int c = 0; c < 3; ++c) {
+			g.boundsMin[c] = sys.boundsMin[c];
+			g.boundsMax[c] = sys.boundsMax[c];
+			g.origin[c] = sys.origin[c];
+		}
+		g.boundsMin[3] = sys.gravity;
+		g.boundsMax[3] = sys.time_scale;
+		g.origin[3] = 0.0;
+
+		g.range[0] = first(s, numParticles);
+		g.range[1] = first(s + 1, numParticles) - g.range[0];
+		g.range[2] = steps[s];
+		g.range[3] = sys.integrator;
+
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_systems);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, table.size()*sizeof(gpuSystem), &table[0], GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+}
+
+void particleSystems::bind_table (void) {
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_SYSTEMS, ssbo_systems);
+
+}
+
+/// Each system wraps its step at its own number of particles, as the
+/// engines do at the total
+
+void particleSystems::advance (GLuint count) {
+
+	for (GLuint s = 0; s < systems.size(); ++s) {
+		GLuint n = first(s + 1, numParticles) - first(s, numParticles);
+		if (n)
+			steps[s] = (steps[s] + count) % n;
+	}
+
+	upload();
+
+}
+
+void particleSystems::clear (void) {
+
+	if (!ssbo_systems)
+		return;
+
+	glDeleteBuffers(1, &ssbo_systems);
+	ssbo_systems = 0;
+
+	numParticles = 0;
+
+}
@@ -0,0 +1,426 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  particleTexture.cc -- Render-to-texture particle engine
+ *
+ **/
+
+#include "particleTexture.h"
+#include "particleSDF.h"
+
+#ifdef __MAC__
+#include <OpenGL/glu.h>
+#else
+#include <GL/glu.h>
+#endif
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#ifndef GL_RGBA16_SNORM
+#define GL_RGBA16_SNORM 0x8F9B
+#endif
+
+/// Texture formats of the positions and the velocities, by precision
+static const GLenum positionFormats[] = { GL_RGBA32F_ARB, GL_RGBA16F_ARB, GL_RGBA16_SNORM };
+static const GLenum velocityFormats[] = { GL_RGBA32F_ARB, GL_RGBA16F_ARB, GL_RGBA16F_ARB };
+static const GLuint positionBytes[] = { 16, 8, 8 }, velocityBytes[] = { 16, 8, 8 };
+
+particleTexture::particleTexture () : callerFbo(0), curr(0), vbo_particles(0), tex_width(0), tex_height(0),
+				      maxTextureSize(0), statePrecision(PRECISION_FLOAT32) {
+
+	tex_position[0] = tex_position[1] = 0;
+	tex_velocity[0] = tex_velocity[1] = 0;
+	fbo[0] = fbo[1] = 0;
+	tex_originalVelocity = 0;
+
+}
+
+bool particleTexture::install (bool debug) {
+
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+
+	displayShader.vertex_source("display.vert");
+	displayShader.fragment_source("display.frag");
+	displayShader.install(debug);
+
+	computeShader.set_define("IMPLICIT_ID", statePrecision != PRECISION_FLOAT32 ? 1 : 0);
+	computeShader.set_define("SDF", sdf ? 1 : 0);
+	computeShader.vertex_source("compute.vert");
+	computeShader.fragment_source("compute.frag");
+	computeShader.install(debug);
+
+	return true;
+
+}
+
+GLuint particleTexture::state_bytes (void) const {
+
+	return positionBytes[statePrecision] + 2*velocityBytes[statePrecision];
+
+}
+
+GLuint particleTexture::max_particles (void) const {
+
+	unsigned long long texels = (unsigned long long)maxTextureSize*maxTextureSize;
+	GLuint limit = particleEngine::max_particles();
+
+	return (texels < limit) ? (GLuint)texels : limit;
+
+}
+
+/// A position and a velocity texel are attached to a framebuffer of
+/// their own, as the state sets are
+
+bool particleTexture::renderable (void) {
+
+	const GLfloat texel[4] = { 0.0, 0.0, 0.0, 0.0 };
+	GLuint tex[2], fb;
+
+	glGenTextures(2, tex);
+	glGenFramebuffersEXT(1, &fb);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fb);
+
+	for (int k = 0; k < 2; ++k) {
+
+		glsl_bind_texture(0, GL_TEXTURE_2D, tex[k]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, k ? velocityFormats[statePrecision] : positionFormats[statePrecision],
+			     1, 1, 0, GL_RGBA, GL_FLOAT, texel);
+		glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, k ? GL_COLOR_ATTACHMENT1_EXT : GL_COLOR_ATTACHMENT0_EXT,
+					  GL_TEXTURE_2D, tex[k], 0);
+
+	}
+
+	bool complete = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) == GL_FRAMEBUFFER_COMPLETE_EXT;
+
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, callerFbo);
+	glDeleteFramebuffersEXT(1, &fb);
+	glDeleteTextures(2, tex);
+
+	return complete;
+
+}
+
+/// Creates a particle state texture
+/// @arg data initial values, 4 floats per texel
+/// @arg format internal format
+/// @return texture object
+
+GLuint particleTexture::create_texture (const GLfloat *data, GLenum format) {
+
+	GLuint tex;
+
+	glGenTextures(1, &tex);
+	glsl_bind_texture(0, GL_TEXTURE_2D, tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, tex_width, tex_height, 0, GL_RGBA, GL_FLOAT, &data[0]);
+
+	return tex;
+
+}
+
+/// Reads a particle state texture back
+/// @arg tex texture object
+/// @arg data output, 4 floats per particle
+
+void particleTexture::read_texture (GLuint tex, GLfloat *data) {
+
+	GLuint numTexels = tex_width*tex_height;
+
+	if (numTexels == numParticles) {
+
+		glsl_bind_texture(0, GL_TEXTURE_2D, tex);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &data[0]);
+		return;
+
+	}
+
+	GLfloat *tex_data = new GLfloat[4*numTexels];
+
+	glsl_bind_texture(0, GL_TEXTURE_2D, tex);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &tex_data[0]);
+
+	memcpy(data, tex_data, 4*numParticles*sizeof(GLfloat));
+
+	delete [] tex_data;
+
+}
+
+/// The state textures are as square as possible, with only the last row
+/// partially filled; texels are row-major so particle i is texel i
+
+void particleTexture::set_state (GLuint n, const GLfloat *pos, const GLfloat *vel, const GLfloat *orig_vel) {
+
+	clear();
+
+	assert( n <= max_particles() );
+
+	tex_width = (GLuint)ceil(sqrt((double)n));
+	if (tex_width > (GLuint)maxTextureSize)
+		tex_width = maxTextureSize;
+	tex_height = (n + tex_width - 1) / tex_width;
+
+	numParticles = n;
+
+	/// pad the last row with zeros
+	GLuint numTexels = tex_width*tex_height;
+	GLfloat *tex_data = new GLfloat[4*numTexels];
+	memset(tex_data, 0, 4*numTexels*sizeof(GLfloat));
+
+	memcpy(tex_data, pos, 4*n*sizeof(GLfloat));
+	for (int k = 0; k < 2; ++k)
+		tex_position[k] = create_texture(tex_data, positionFormats[statePrecision]);
+
+	memcpy(tex_data, vel, 4*n*sizeof(GLfloat));
+	for (int k = 0; k < 2; ++k)
+		tex_velocity[k] = create_texture(tex_data, velocityFormats[statePrecision]);
+
+	memcpy(tex_data, orig_vel, 4*n*sizeof(GLfloat));
+	tex_originalVelocity = create_texture(tex_data, velocityFormats[statePrecision]);
+
+	delete [] tex_data;
+
+	/// One framebuffer per state set, each rendering to its own textures
+	glGenFramebuffersEXT(2, fbo);
+
+	for (int k = 0; k < 2; ++k) {
+
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo[k]);
+
+		glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, tex_position[k], 0);
+		glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT1_EXT, GL_TEXTURE_2D, tex_velocity[k], 0);
+
+		if (glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) != GL_FRAMEBUFFER_COMPLETE_EXT)
+			printf("ERROR - Incomplete FrameBuffer\n");
+
+	}
+
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, callerFbo);
+	curr = 0;
+
+	/// Static buffer of particle texel centers and indices
+	GLfloat *vtx_data = new GLfloat[3*n];
+
+	for (GLuint i = 0; i < n; ++i) {
+		vtx_data[3*i + 0] = ((i % tex_width) + 0.5) / (GLfloat)tex_width;
+		vtx_data[3*i + 1] = ((i / tex_width) + 0.5) / (GLfloat)tex_height;
+		vtx_data[3*i + 2] = i;
+	}
+
+	glGenBuffers(1, &vbo_particles);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_particles);
+	glBufferData(GL_ARRAY_BUFFER, 3*n*sizeof(GLfloat), vtx_data, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	delete [] vtx_data;
+
+}
+
+/// Below 32 bits the id in the position w is rounded, the exact one is
+/// restored from the texel index
+
+void particleTexture::get_state (GLfloat *pos, GLfloat *vel, GLfloat *orig_vel) {
+
+	if (pos) read_texture(tex_position[curr], pos);
+	if (pos && statePrecision != PRECISION_FLOAT32)
+		for (GLuint i = 0; i < numParticles; ++i)
+			pos[4*i + 3] = i/(GLfloat)numParticles;
+	if (vel) read_texture(tex_velocity[curr], vel);
+	if (orig_vel) read_texture(tex_originalVelocity, orig_vel);
+
+}
+
+void particleTexture::clear (void) {
+
+	if (!numParticles)
+		return;
+
+	for (int k = 0; k < 2; ++k) {
+		glsl_release_texture(tex_position[k]);
+		glsl_release_texture(tex_velocity[k]);
+	}
+	glsl_release_texture(tex_originalVelocity);
+
+	glDeleteTextures(2, tex_position);
+	glDeleteTextures(2, tex_velocity);
+	glDeleteTextures(1, &tex_originalVelocity);
+	glDeleteFramebuffersEXT(2, fbo);
+	glDeleteBuffers(1, &vbo_particles);
+
+	numParticles = 0;
+
+}
+
+/// Emits a quad covering texels [x0,x1) x [y0,y1) of the state textures
+/// @arg x0, y0, x1, y1 texel rectangle
+
+void particleTexture::draw_quad (GLuint x0, GLuint y0, GLuint x1, GLuint y1) {
+
+	glTexCoord2f(x0/(GLfloat)tex_width, y0/(GLfloat)tex_height);
+	glVertex2f(x0, y0);
+	glTexCoord2f(x1/(GLfloat)tex_width, y0/(GLfloat)tex_height);
+	glVertex2f(x1, y0);
+	glTexCoord2f(x1/(GLfloat)tex_width, y1/(GLfloat)tex_height);
+	glVertex2f(x1, y1);
+	glTexCoord2f(x0/(GLfloat)tex_width, y1/(GLfloat)tex_height);
+	glVertex2f(x0, y1);
+
+}
+
+/// The pipeline is set up once for all steps, each step only swaps the
+/// framebuffer and the textures it reads
+
+void particleTexture::compute_steps (GLfloat time_step, GLint step, const GLfloat gravity[3], GLuint count) {
+
+	glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT | GL_POLYGON_BIT | GL_LIGHTING_BIT);
+
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glViewport(0, 0, tex_width, tex_height);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+
+	gluOrtho2D(0.0, tex_width, 0.0, tex_height);
+
+	glEnable(GL_TEXTURE_2D);
+
+	computeShader.use();
+
+	computeShader.set_uniform("time_step", (GLfloat)time_step);
+	computeShader.set_uniform("numParticles", (GLint)numParticles);
+	computeShader.set_uniform("gravity", gravity[0], gravity[1], gravity[2]);
+	if (statePrecision != PRECISION_FLOAT32)
+		computeShader.set_uniform("texWidth", (GLint)tex_width);
+	if (sdf)
+		sdf->bind(computeShader);
+
+	/// Cover the full rows and the used part of the last row only, so
+	/// texels past the last particle are never computed
+	GLuint full_rows = numParticles / tex_width;
+	GLuint last_row = numParticles % tex_width;
+
+	glShadeModel(GL_FLAT);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+	GLenum drawBufs[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+
+	for (GLuint k = 0; k < count; ++k) {
+
+		// read the current set and write the other one: no texture is
+		// sampled and rendered to in the same pass
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo[1-curr]);
+		glDrawBuffers(2, drawBufs);
+
+		computeShader.bind_texture("positionTex", tex_position[curr]);
+		computeShader.bind_texture("velocityTex", tex_velocity[curr]);
+		computeShader.bind_texture("originalVelocityTex", tex_originalVelocity);
+		computeShader.set_uniform("step", (GLint)((step + k) % numParticles));
+
+		glBegin(GL_QUADS);
+		draw_quad(0, 0, tex_width, full_rows);
+		if (last_row)
+			draw_quad(0, full_rows, last_row, full_rows+1);
+		glEnd();
+
+		curr = 1-curr;
+
+	}
+
+	computeShader.use(0);
+
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+	glPopAttrib();
+	glFlush();
+
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, callerFbo);
+
+}
+
+/// Draws the particles straight from the position texture: a static
+/// buffer of texel centers is drawn as points and the vertex shader
+/// fetches each position, so positions never reach the CPU
+
+void particleTexture::draw (GLfloat alpha) {
+
+	displayShader.use();
+	displayShader.bind_texture("positionTex", tex_position[curr]);
+	displayShader.bind_texture("previousPositionTex", tex_position[1-curr]);
+	displayShader.set_uniform("alpha", (GLfloat)alpha);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_particles);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, 0);
+
+	glDrawArrays(GL_POINTS, 0, numParticles);
+
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// the previous set is rendered to by the next step: do not leave it
+	// bound for sampling
+	displayShader.bind_texture("previousPositionTex", tex_position[curr]);
+
+	displayShader.use(false);
+
+}
+
+/// Sprites fetch the state textures by instance, as the points do by
+/// texel center
+
+void particleTexture::draw_sprites (particleSprites& sprites, GLfloat alpha) {
+
+	sprites.draw_textures(tex_position[curr], tex_position[1-curr], tex_velocity[curr],
+			      tex_width, tex_height, numParticles, alpha);
+
+}
+
+/// The position and velocity textures are read through the framebuffer
+/// of their set into the buffer bound as pixel pack buffer, so
+/// glReadPixels only queues the copy; the full rows and the used part of
+/// the last row are read, which leaves the particles packed
+
+void particleTexture::copy_positions (GLuint buffer) {
+
+	glPushAttrib(GL_PIXEL_MODE_BIT);
+
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo[curr]);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+
+	GLuint full_rows = numParticles / tex_width;
+	GLuint last_row = numParticles % tex_width;
+
+	/// positions, then velocities after all of them
+	for (int k = 0; k < 2; ++k) {
+
+		GLsizeiptr offset = 4*k*numParticles*sizeof(GLfloat);
+
+		glReadBuffer(k ? GL_COLOR_ATTACHMENT1_EXT : GL_COLOR_ATTACHMENT0_EXT);
+
+		if (full_rows)
+			glReadPixels(0, 0, tex_width, full_rows, GL_RGBA, GL_FLOAT, (GLvoid*)offset);
+		if (last_row)
+			glReadPixels(0, full_rows, last_row, 1, GL_RGBA, GL_FLOAT,
+				     (GLvoid*)(offset + 4*tex_width*full_rows*sizeof(GLfloat)));
+
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glPopAttrib();
+
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, callerFbo);
+
+}
@@ -24,15 +24,36 @@ extern "C" {
 #endif
 }
 
+#ifdef __EGL__
+#include <EGL/egl.h> // offscreen benchmark context
+#include <EGL/eglext.h>
+#endif
+
 #include <math.h> 
 #include <stdio.h> // standard i/o
 #include <stdlib.h>
+#include <string.h>
+#include <assert.h>
 
 #include "arcball.h"
+#include "particleCPU.h"
+#include "particleGridCPU.h"
+#include "particleTexture.h"
+#include "particleFeedback.h"
+#include "particleCompute.h"
+#include "particleReadback.h"
+#include "particleEmitters.h"
+#include "particleSystems.h"
+#include "particleReduction.h"
+#include "particleSDF.h"
+#include "trajectory.h"
+#include "checkpoint.h"
 
 #include <iostream> // i/o stream
-
-#define TEXTURE_TYPE GL_RGBA32F_ARB
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <vector>
 
 using std::cout;
 using std::cerr;
@@ -47,22 +68,140 @@ static const char titleWin[] = "Simple GLSL Particle Simulation"; ///< Window ti
 
 static int winWidth = 1024, winHeight = 768; ///< Window size
 
-static GLuint tex_velocity, tex_originalVelocity, tex_position, fbo; ///< Textures
-static GLuint tex_size = 64;
-static GLuint numParticles;
-
-static glslKernel computeShader; ///< GLSL Kernel Shaders
-static glslKernel displayShader; ///< GLSL Kernel Shaders
-
-// Vertex and Fragment Shader file names
-static const char vsFile[2][255] = { "display.vert", "compute.vert" };
-
-static const char fsFile[2][255] = { "display.frag", "compute.frag" };
-
-static GLfloat time_step = 0.001;
+/// GPU particle engines, the state moves to the selected one
+static particleTexture textureEngine; ///< Render to texture
+static particleTexture referenceEngine; ///< 32 bit path the reduced precisions are measured against
+static particleFeedback feedbackEngine; ///< Transform feedback
+static particleCompute computeEngine; ///< Compute shader, set with --group-size=N
+static particleEngine *engines[] = { &textureEngine, &feedbackEngine, &computeEngine };
+static const int numEngines = sizeof(engines) / sizeof(engines[0]);
+static bool engineReady[numEngines]; ///< Engines able to run in this context
+static int currEngine = 0; ///< Set with --engine=NAME or e
+static bool engineGiven = false; ///< Set with --engine=NAME
+static particleEngine *engine = engines[0]; ///< Selected engine
+
+static bool gpuRender = true; ///< Draw from the GPU state (true) or read it back (false)
+
+/// Particles drawn from the GPU state as points, or as sprites in one
+/// instanced draw, soft where they cross the scene depth
+enum { DRAW_POINTS, DRAW_SPRITES, DRAW_SOFT_SPRITES, NUM_DRAW_MODES };
+static const char *drawModeNames[] = { "points", "sprites", "soft sprites" };
+static particleSprites sprites;
+static bool spritesReady = false; ///< Instancing available
+static int drawMode = DRAW_POINTS; ///< Set with --sprites[=soft] or s
+static GLfloat softness = 0.1; ///< Soft sprite fade distance, set with --softness=D
+static bool sortSprites = true; ///< Sprites drawn back to front, unset with --unsorted or o
+
+/// Positions read back without stalling: the readback draw and the
+/// export consume them two frames after they were queued
+static particleReadback readback;
+static std::vector< GLfloat > readbackPositions; ///< Last positions read back, 4 floats each
+static FILE *exportFile = 0; ///< Positions of every frame, set with --export=FILE
+static bool asyncReadback = false; ///< Benchmark readback, set with --readback=sync|async
+
+/// Trajectory recording: a snapshot every recordInterval steps, read
+/// back through a ring of its own and written by the recorder thread;
+/// --replay reads a snapshot back
+static trajectoryRecorder recorder;
+static particleReadback recordReadback; ///< Snapshots on their way to the recorder
+static std::deque< std::pair< GLuint, uint64_t > > recordSteps; ///< Frame and step of the snapshots in the ring, oldest first
+static const char *recordFile = 0; ///< Set with --record=FILE
+static unsigned recordInterval = 10; ///< Set with --record-every=K
+static bool recordHalf = false; ///< Set with --record-half
+static bool recordCompress = false; ///< Set with --record-compress
+static uint64_t totalSteps = 0; ///< Steps run since the start
+static const char *replayFile = 0; ///< Set with --replay=FILE
+static uint64_t replayStep = 0; ///< Set with --at=STEP
+
+/// Checkpoints: the state is saved at the end of the run and with c,
+/// and a run resumes from a checkpoint instead of the origin
+static const char *checkpointFile = 0; ///< Set with --checkpoint=FILE
+static const char *resumeFile = 0; ///< Set with --resume=FILE
+static GLuint numParticles = 64*64; ///< Set with --particles=N or < and >
+
+/// Step time measured with GPU timer queries, read one submission later
+static GLuint stepQuery[2]; ///< Timer queries of the last two submissions
+static GLuint stepQuerySteps[2]; ///< Steps of each query
+static int stepQueryCount = 0; ///< Number of submissions issued with a query
+static double stepTime = 0.0; ///< Smoothed step time in milliseconds
+
+static GLfloat time_step = 0.001; ///< Set with --time-step=DT
 static GLint step = 0;
 
+/// Fixed time step scheduler: the simulation runs stepRate steps of
+/// time_step per second of wall time, whatever the frame rate. Each frame
+/// runs the steps due since the last one in a single submission, at most
+/// maxSubsteps (the backlog is dropped when the simulation cannot keep
+/// up), and draws the particles blended between the last two steps by
+/// the fraction of a step left over
+static GLfloat stepRate = 100.0; ///< Steps per second, set with --rate=HZ or + and -
+static GLuint maxSubsteps = 8; ///< Set with --max-substeps=N
+static double stepsDue = 0.0; ///< Steps owed to the wall clock
+static GLfloat renderAlpha = 1.0; ///< Blend of the drawn state, 1 draws the last step
+static std::chrono::high_resolution_clock::time_point lastFrame; ///< Time of the last frame
+static double frameRate = 0.0, stepsPerFrame = 0.0; ///< Smoothed for the HUD
+static GLuint batchSteps = 1; ///< Benchmark steps per submission, set with --batch=N
+
 static GLint point_size = 2;
+
+/// Backend options: the GPU backend runs in a window, the CPU backend
+/// runs headless; both stop after maxSteps steps (0 runs forever)
+static bool cpuBackend = false; ///< Set with --backend=cpu
+static GLint maxSteps = 0; ///< Set with --steps=N
+static const char *dumpFile = 0; ///< State written here after the last step
+static unsigned cpuThreads = 0; ///< CPU backend threads (0 for one per core)
+
+/// Benchmark mode: a fixed number of steps as fast as possible, without
+/// a visible window, reporting one JSON line on stdout
+static bool benchmark = false; ///< Set with --benchmark
+static unsigned seed = 0; ///< Set with --seed=N (benchmarks default to 1)
+static bool seedGiven = false;
+
+/// Particle collisions: the compute engine finds the neighbours in
+/// shared memory tiles or a grid, the CPU backend in a grid
+static particleCompute::neighbourMode neighbours = particleCompute::NEIGHBOURS_NONE; ///< Set with --neighbours=tiles|grid
+static GLfloat radius = 0.02; ///< Interaction radius, set with --radius=R
+static GLfloat stiffness = 1.0; ///< Push stiffness, set with --stiffness=K
+static bool gridSweep = false; ///< Set with --grid-sweep
+
+/// Particle emitters of the compute engine: particles are born on a
+/// point, a sphere and a torus, and die after their life instead of
+/// being reset to the origin
+static particleEmitters emitters;
+static bool useEmitters = false; ///< Set with --emitters
+
+/// Independent particle systems of the compute engine, side by side in
+/// the box and advanced in one dispatch
+static particleSystems systems;
+static GLuint numSystems = 0; ///< Set with --systems=N
+
+/// Integrator of the compute engine, the symplectic Euler of the other
+/// engines by default, and its energy drift summed on the GPU
+static particleCompute::integrator integrator = particleCompute::INTEGRATOR_SYMPLECTIC;
+static bool integratorGiven = false; ///< Set with --integrator=euler|symplectic|verlet|rk4
+static bool energyCheck = false; ///< Set with --energy
+static const char *integratorNames[] = { "euler", "symplectic", "verlet", "rk4" };
+
+/// Emitters, systems, integrators and the energy drift run on the
+/// compute engine only
+static bool computeOnly = false;
+
+/// Statistics of the particles reduced on the GPU, read back a frame or
+/// so later, or on the CPU by the CPU backend
+static particleReduction reduction;
+static bool showStats = false; ///< Set with --stats
+static bool statsReady = false; ///< GPU reduction available
+
+/// Precision of the state of the texture engine; below 32 bits the
+/// benchmark reports the drift from the 32 bit path
+static particleTexture::precision precision = particleTexture::PRECISION_FLOAT32; ///< Set with --precision=fp32|fp16|packed
+static const char *precisionNames[] = { "fp32", "fp16", "packed" };
+
+/// Mesh the particles collide with, on the floor of the box under the
+/// fountain, baked on the CPU into a signed distance field over the box
+static particleSDF collider;
+static const char *collideFile = 0; ///< Set with --collide=FILE.obj
+static GLuint sdfResolution = 64; ///< Set with --sdf-resolution=N
 /// ------------------------------------   ARCBALL   --------------------------------------
 
 // scene parameters
@@ -116,9 +255,37 @@ void showIH( void ) {
 	sprintf(str, "[ / ] : point size" );
 	glWrite(-0.95, 0.8, str);
 
-	sprintf(str, "+ / - : animation speed %f", time_step );
+	sprintf(str, "+ / - : %.0f steps/s of %g", stepRate, time_step );
 	glWrite(-0.95, 0.7, str);
 
+	if (gpuRender)
+		sprintf(str, "g : draw from GPU state" );
+	else
+		sprintf(str, "g : draw from CPU readback, %u frames in flight", readback.pending() );
+	glWrite(-0.95, 0.6, str);
+
+	sprintf(str, "< / > : %u particles, step %.3f ms", numParticles, stepTime );
+	glWrite(-0.95, 0.5, str);
+
+	sprintf(str, "e : %s engine", engine->name() );
+	glWrite(-0.95, 0.4, str);
+
+	sprintf(str, "s : draw %s%s", drawModeNames[drawMode],
+		drawMode != DRAW_POINTS && sprites.sorted() ? ", o : sorted" : "" );
+	glWrite(-0.95, 0.2, str);
+
+	if (statsReady) {
+		const particleStats& st = reduction.stats();
+		sprintf(str, "box %.2f %.2f %.2f to %.2f %.2f %.2f, kinetic %.3g, %.0f of %.0f at walls",
+			st.minimum[0], st.minimum[1], st.minimum[2], st.maximum[0], st.maximum[1], st.maximum[2],
+			st.sum[3], st.count[1], st.count[0] );
+		glWrite(-0.95, 0.1, str);
+	}
+
+	sprintf(str, "%.2f steps/frame, sim:render %.0f:%.0f Hz",
+		stepsPerFrame, stepsPerFrame*frameRate, frameRate );
+	glWrite(-0.95, 0.3, str);
+
 	glPopMatrix();
 	glMatrixMode(GL_MODELVIEW);
 	glPopMatrix();
@@ -213,114 +380,332 @@ void drawBoundingBox(void) {
 }
 
 
-void computeCinematics( void ) {
-	
+/// Computes the gravity vector in the particle space, i.e. rotated by
+/// the inverse of the current view. The view is built on the CPU from the
+/// arcball rotation, the modelview of display, so no matrix is queried
+/// from OpenGL
+/// @arg gravity output vector
+
+void computeGravity( GLfloat gravity[3] ) {
+
+	GLfloat rotation[16];
+	arcball_matrix(rotation);
+
+	/// the modelview is the rotation scaled by zoom, column major
+	GLfloat mv[3][3];
+	for (int c = 0; c < 3; ++c)
+		for (int r = 0; r < 3; ++r)
+			mv[c][r] = zoom*rotation[4*c + r];
 
-	/*********** COMPUTE THE ROTATED GRAVITY VECTOR ************/
-	glMatrixMode(GL_MODELVIEW);
-	glPushMatrix();
-	glLoadIdentity();
-	glScalef(zoom, zoom, zoom);	
-	arcball_rotate();	
-	
 	GLfloat g[3] = {0.0, -0.98, 0.0};
-	
-	GLfloat mv[4][4];
-	glGetFloatv(GL_MODELVIEW_MATRIX, &mv[0][0]);
 
-	/// multiply by the inverse of the modelview
-	GLfloat gravity[3] = {g[0]*mv[0][0] + g[1]*mv[0][1] + g[2]*mv[0][2],
-		    			  g[0]*mv[1][0] + g[1]*mv[1][1] + g[2]*mv[1][2],
-		    			  g[0]*mv[2][0] + g[1]*mv[2][1] + g[2]*mv[2][2]};
-	
-	glLoadIdentity();
-	
-	
-	glViewport(0, 0, tex_size, tex_size);
-	glMatrixMode(GL_PROJECTION);
-	glPushMatrix();	
-	glLoadIdentity();
-	
-	gluOrtho2D(0.0, tex_size, 0.0, tex_size);
-	
-	glEnable(GL_TEXTURE_2D);
+	/// multiply by the transpose of the rotation, its inverse
+	gravity[0] = g[0]*mv[0][0] + g[1]*mv[0][1] + g[2]*mv[0][2];
+	gravity[1] = g[0]*mv[1][0] + g[1]*mv[1][1] + g[2]*mv[1][2];
+	gravity[2] = g[0]*mv[2][0] + g[1]*mv[2][1] + g[2]*mv[2][2];
 
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
-	GLenum drawBufs[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
-	glDrawBuffers(2, drawBufs);
+}
 
-	computeShader.use();
+/// Runs steps in one submission and advances the step counters
+/// @arg count number of steps
 
-	computeShader.set_uniform("positionTex", 0);
-	computeShader.set_uniform("velocityTex", 1);
-	computeShader.set_uniform("originalVelocityTex", 2);
-	computeShader.set_uniform("time_step", (GLfloat)time_step);
-	computeShader.set_uniform("step", (GLint)step);
-	computeShader.set_uniform("numParticles", (GLint)numParticles);
-	computeShader.set_uniform("gravity", gravity[0], gravity[1], gravity[2]);
-	
-	glShadeModel(GL_FLAT);	
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	glBegin(GL_QUADS);
-	glTexCoord2f(0.0, 0.0);
-	glVertex2f(0.0, 0.0);
-	glTexCoord2f(1.0, 0.0);
-	glVertex2f( tex_size, 0.0);
-	glTexCoord2f(1.0, 1.0);
-	glVertex2f( tex_size,  tex_size);
-	glTexCoord2f(0.0, 1.0);
-	glVertex2f(0.0, tex_size);
-	glEnd();
-	
-	computeShader.use(0);
-	
-	
-	glMatrixMode(GL_PROJECTION);
-	glPopMatrix();
-	glMatrixMode(GL_MODELVIEW);
-	glPopMatrix();
-	glViewport(0, 0, winWidth, winHeight);
-	glFlush();
+void submitSteps( GLuint count ) {
 
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-	glDisable(GL_TEXTURE_2D);
+	GLfloat gravity[3];
+	computeGravity(gravity);
+
+	if (timer_query_support()) {
+		stepQuerySteps[stepQueryCount%2] = count;
+		glBeginQuery(GL_TIME_ELAPSED_EXT, stepQuery[stepQueryCount%2]);
+	}
+
+	engine->compute_steps(time_step, step, gravity, count);
+
+	step = (step + count) % numParticles;
+	totalSteps += count;
+
+	if (timer_query_support()) {
+
+		glEndQuery(GL_TIME_ELAPSED_EXT);
+		++stepQueryCount;
+
+		/// the query of the previous submission is usually done by now
+		GLuint prev = stepQuery[stepQueryCount%2], ns = 0;
+		GLint available = 0;
+		if (stepQueryCount > 1)
+			glGetQueryObjectiv(prev, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available) {
+			glGetQueryObjectuiv(prev, GL_QUERY_RESULT, &ns);
+			stepTime = 0.9*stepTime + 0.1*(ns*1e-6 / stepQuerySteps[stepQueryCount%2]);
+		}
+
+	}
 
-	
 }
 
+/// Hands a snapshot read back to the recorder
+/// @arg v positions and velocities of a recorded step
 
-/// Display
+void recordSnapshot( const particleReadback::view& v ) {
 
-void display( void ) {
+	// the frames the ring dropped are skipped
+	while (recordSteps.front().first != v.frame)
+		recordSteps.pop_front();
 
-	glDrawBuffer(GL_BACK);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-	glScalef(zoom, zoom, zoom);
-    arcball_rotate();
+	recorder.record(recordSteps.front().second, v.count, v.positions, v.velocities, v.stride);
+	recordSteps.pop_front();
 
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, tex_position);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, tex_velocity);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, tex_originalVelocity);
+}
 
-	GLfloat *tex_data = new GLfloat[4*numParticles];
+/// Queues the state for the recorder, read back without stalling where
+/// the context has fences and buffer copies
 
-	glReadBuffer(GL_COLOR_ATTACHMENT0);
-	glReadPixels(0, 0, tex_size, tex_size, GL_RGBA, GL_FLOAT, &tex_data[0]);
+void recordState( void ) {
+
+	if (particleReadback::supported()) {
+		recordSteps.push_back(std::make_pair(recordReadback.frames(), totalSteps));
+		recordReadback.queue(*engine);
+		return;
+	}
+
+	GLfloat *pos_data = new GLfloat[4*numParticles];
+	GLfloat *vel_data = new GLfloat[4*numParticles];
+
+	engine->get_state(pos_data, vel_data, 0);
+	recorder.record(totalSteps, numParticles, pos_data, vel_data);
+
+	delete [] pos_data;
+	delete [] vel_data;
+
+}
+
+/// Records the snapshots still read back, then closes the file
+/// @return false if the recording could not be written whole
+
+bool closeRecorder( void ) {
+
+	recordReadback.poll(true);
+	recordSteps.clear();
+
+	if (!recorder.close()) {
+		cerr << "[Error] Cannot write the whole recording to " << recordFile << endl;
+		return false;
+	}
+
+	return true;
+
+}
+
+/// Runs steps, splitting the submissions at the recorded steps
+/// @arg count number of steps
+
+void computeCinematics( GLuint count ) {
+
+	if (!recorder.is_open()) {
+		submitSteps(count);
+		return;
+	}
+
+	GLuint every = recorder.interval();
+
+	recordReadback.poll();
+
+	while (count) {
+
+		GLuint n = every - totalSteps % every;
+		if (n > count)
+			n = count;
+
+		submitSteps(n);
+		count -= n;
+
+		if (totalSteps % every == 0)
+			recordState();
+
+	}
+
+}
+
+void dumpGPUState ( void );
+void queueReadback ( void );
+void checkpointGPUState ( void );
+
+/// Runs the steps due since the last frame, in one submission, and sets
+/// the blend of the drawn state to the fraction of a step left over
+
+void scheduleSteps( void ) {
+
+	std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+	double seconds = std::chrono::duration< double >( now - lastFrame ).count();
+	lastFrame = now;
+
+	stepsDue += seconds * stepRate;
+
+	GLuint count = (GLuint)stepsDue;
+	if (count > maxSubsteps) {
+		stepsDue -= count - maxSubsteps;
+		count = maxSubsteps;
+	}
+	if (maxSteps && count > (GLuint)maxSteps)
+		count = maxSteps;
+
+	if (count)
+		computeCinematics(count);
+
+	stepsDue -= count;
+	renderAlpha = stepsDue < 1.0 ? stepsDue : 1.0;
+
+	if (seconds > 0.0) {
+		frameRate = 0.9*frameRate + 0.1/seconds;
+		stepsPerFrame = 0.9*stepsPerFrame + 0.1*count;
+	}
+
+	if (maxSteps && (maxSteps -= count) == 0) {
+		if (dumpFile)
+			dumpGPUState();
+		queueReadback();
+		readback.poll(true);
+		bool recorded = closeRecorder();
+		checkpointGPUState();
+		exit(recorded ? 0 : 1);
+	}
+
+}
+
+
+/// Draws the particles straight from the GPU state, so positions
+/// never reach the CPU
+
+void drawParticles( void ) {
+
+	if (drawMode == DRAW_POINTS) {
+
+		glPointSize(point_size);
+		engine->draw(renderAlpha);
+
+	} else {
+
+		/// sprites are twice as wide as the points at the center of the
+		/// box, their edge being soft; pixel is the width of a pixel there
+		/// with the 50 degrees field of view of reshape
+		GLfloat pixel = 2.0*eye.z*tan(25.0*PI/180.0) / winHeight;
+		sprites.set_size(point_size*pixel);
+		sprites.set_softness(drawMode == DRAW_SOFT_SPRITES ? softness : 0.0);
+		sprites.set_sorted(sortSprites);
+		engine->draw_sprites(sprites, renderAlpha);
+
+	}
+
+}
+
+/// Draws the box writing depth, and keeps the depth for the soft sprites
+
+void captureSceneDepth( void ) {
+
+	if (drawMode != DRAW_SOFT_SPRITES)
+		return;
+
+	glClear(GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_DEPTH_TEST);
+	glColor3f(0.0, 0.0, 0.0);
+	drawBoundingBox();
+	glDisable(GL_DEPTH_TEST);
+
+	sprites.capture_depth();
+
+}
+
+/// Reads the current positions back to the CPU
+/// @arg tex_data output, 4 floats per particle
+
+void readPositions( GLfloat *tex_data ) {
+
+	engine->get_state(tex_data, 0, 0);
+
+}
+
+/// Keeps the positions read back for the readback draw
+/// @arg v positions of a past frame
+
+void keepPositions( const particleReadback::view& v ) {
+
+	if (gpuRender)
+		return;
+
+	readbackPositions.resize(4*v.count);
+
+	for (GLuint i = 0; i < v.count; ++i)
+		memcpy(&readbackPositions[4*i], &v.positions[i*v.stride], 4*sizeof(GLfloat));
+
+}
+
+/// Writes the positions read back to the export file, one particle per
+/// line with its frame
+/// @arg v positions of a past frame
+
+void exportPositions( const particleReadback::view& v ) {
+
+	for (GLuint i = 0; i < v.count; ++i) {
+		const GLfloat *p = &v.positions[i*v.stride];
+		fprintf(exportFile, "%u %.9g %.9g %.9g\n", v.frame, p[0], p[1], p[2]);
+	}
+
+}
+
+/// Queues the current positions for the readback consumers, when there
+/// is any use for them
+
+void queueReadback( void ) {
+
+	if ((!gpuRender || exportFile) && particleReadback::supported())
+		readback.queue(*engine);
+
+}
+
+/// Queues the statistics of the current state, reading those queued
+/// before when the GPU is done with them
+
+void queueStats( void ) {
+
+	if (!statsReady)
+		return;
+
+	reduction.poll();
+	reduction.queue(*engine);
+
+}
+
+/// Formats statistics as a field of the benchmark output
+/// @arg str output, at least 512 characters
+/// @arg st statistics
+
+void formatStats( char *str, const particleStats& st ) {
+
+	GLfloat live = st.count[0] > 0.0 ? st.count[0] : 1.0;
+
+	sprintf(str, ", \"stats\": {\"min\": [%.6g, %.6g, %.6g], \"max\": [%.6g, %.6g, %.6g], "
+		"\"mean\": [%.6g, %.6g, %.6g], \"speed\": [%.6g, %.6g], \"kinetic\": %.6g, "
+		"\"live\": %.0f, \"walls\": %.0f}",
+		st.minimum[0], st.minimum[1], st.minimum[2], st.maximum[0], st.maximum[1], st.maximum[2],
+		st.sum[0] / live, st.sum[1] / live, st.sum[2] / live, st.minimum[3], st.maximum[3],
+		st.sum[3], st.count[0], st.count[1]);
+
+}
+
+/// Draws the particles from positions on the CPU
+/// @arg tex_data positions, 4 floats per particle
+/// @arg count number of particles
+
+void drawPositions( const GLfloat *tex_data, GLuint count ) {
 
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-	
 	glEnable(GL_COLOR_MATERIAL);
 	
 	glPointSize(point_size);
 	glBegin(GL_POINTS);
-	for (int i = 0; i < numParticles; ++i) {
+	for (GLuint i = 0; i < count; ++i) {
+
+		if (tex_data[4*i + 3] < 0.0) // dead particle of the emitters
+			continue;
 		
 		if (i%3 == 0)
 			glColor3f(1.0, 0.0, 0.0);
@@ -332,13 +717,59 @@ void display( void ) {
 		glVertex3f( tex_data[4*i + 0], tex_data[4*i + 1], tex_data[4*i + 2]);
 	}
 	glEnd();
-	
+
+}
+
+/// Draws the particles reading the positions back to the CPU: the last
+/// frame handed by the readback ring, or the current state read right
+/// away when the context has no fences
+
+void drawParticlesReadback( void ) {
+
+	if (particleReadback::supported()) {
+
+		if (!readbackPositions.empty())
+			drawPositions(&readbackPositions[0], readbackPositions.size()/4);
+		return;
+
+	}
+
+	GLfloat *tex_data = new GLfloat[4*numParticles];
+
+	readPositions(tex_data);
+	drawPositions(tex_data, numParticles);
+
+	delete [] tex_data;
+
+}
+
+/// Display
+
+void display( void ) {
+
+	scheduleSteps();
+	queueReadback();
+	queueStats();
+
+	glDrawBuffer(GL_BACK);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	glScalef(zoom, zoom, zoom);
+    arcball_rotate();
+
+	captureSceneDepth();
+
+	if (gpuRender)
+		drawParticles();
+	else
+		drawParticlesReadback();
+
 	glColor3f(0.0, 0.0, 0.0);
 	drawBoundingBox();
 	
 	showIH();
-	
-	delete [] tex_data;
 		
 	glutSwapBuffers();
 }
@@ -369,6 +800,9 @@ void reshape( int w, int h ) {
 }
 
 
+void resizeParticles ( GLuint n );
+void selectEngine ( int k );
+
 /// Keyboard
 /// @arg key key pressed
 /// @arg x, y window position when key was pressed
@@ -376,13 +810,11 @@ void reshape( int w, int h ) {
 void keyboard( unsigned char key, int x, int y ) {
 
 	switch(key) {
-	case '+': 
-		time_step += 0.0005;
+	case '+': // faster simulation, same time step
+		stepRate *= 1.25;
 		return;		
 	case '-': 
-		time_step -= 0.0005;
-		if (time_step < 0)
-			time_step = 0;
+		stepRate /= 1.25;
 		return;
 	case '[': 
 		point_size --;
@@ -392,13 +824,44 @@ void keyboard( unsigned char key, int x, int y ) {
 	case ']': 
 		point_size++;
 		return;					
+	case '<': // halve the number of particles
+		if (numParticles > 1)
+			resizeParticles(numParticles/2);
+		return;
+	case '>': // double the number of particles, up to the engine limit
+		if (numParticles > engine->max_particles() / 2)
+			cerr << "[Error] The " << engine->name() << " engine holds at most "
+			     << engine->max_particles() << " particles" << endl;
+		else
+			resizeParticles(numParticles*2);
+		return;
+	case 'e': case 'E': // next particle engine
+		selectEngine(currEngine + 1);
+		return;
+	case 'g': case 'G': // draw from GPU state or CPU readback
+		gpuRender = !gpuRender;
+		return;
+	case 's': case 'S': // points, sprites or soft sprites
+		if (spritesReady)
+			drawMode = (drawMode + 1) % NUM_DRAW_MODES;
+		return;
+	case 'o': case 'O': // sprites sorted back to front or not
+		sortSprites = !sortSprites;
+		return;
 	case 'r': case 'R': // quit application
 		
 	  setupShaders();
 		return;
+	case 'c': case 'C': // save a checkpoint
+		checkpointGPUState();
+		return;
 	case 'q': case 'Q': case 27: // quit application
 		//glutDestroyWindow( glutGetWindow() );
-		exit(0);
+		{
+			bool recorded = closeRecorder();
+			checkpointGPUState();
+			exit(recorded ? 0 : 1);
+		}
 		return;
 	default: // any other key (just to avoid warnings)
 		cerr << "[Error] No key bind for " << key
@@ -463,114 +926,984 @@ void motion( int x, int y ) {
 }
 
 
-/// Setup position and velocity textures with random initial
-void setupTextures ( void ) {
-		
-	numParticles = tex_size*tex_size;		
-	GLfloat *tex_data = new GLfloat[4*numParticles];
-	
-	srand ( time(NULL) );
-	
-	for (int i = 0; i < numParticles; ++i) {
-		tex_data[4*i + 0] = 0.0;
-		tex_data[4*i + 1] = 0.0;
-		tex_data[4*i + 2] = 0.0;
-		tex_data[4*i + 3] = i/(GLfloat)numParticles;
+/// Sets the initial state of a particle
+/// @arg i particle index
+/// @arg pos, vel position and velocity state arrays, 4 floats per particle
+
+void initParticle ( GLuint i, GLfloat *pos, GLfloat *vel ) {
+
+	pos[4*i + 0] = 0.0;
+	pos[4*i + 1] = 0.0;
+	pos[4*i + 2] = 0.0;
+	pos[4*i + 3] = i/(GLfloat)numParticles;
+
+	vel[4*i + 0] = (2.0*((GLfloat)rand() / ((GLfloat)RAND_MAX)) - 1.0)*0.25;
+	vel[4*i + 1] = ((GLfloat)rand() / ((GLfloat)RAND_MAX)); 
+	vel[4*i + 2] = (2.0*((GLfloat)rand() / ((GLfloat)RAND_MAX)) - 1.0)*0.25;
+	vel[4*i + 3] = 1.0;
+
+	/// the particles of a system start from its origin, with the id of
+	/// all particles so the systems take different colors
+	if (numSystems) {
+		const particleSystems::system& s = systems.get(systems.system_of(i, numParticles));
+		for (int c = 0; c < 3; ++c)
+			pos[4*i + c] = s.origin[c];
 	}
-	
-	glGenTextures(1, &tex_position);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, tex_position);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glTexImage2D(GL_TEXTURE_2D, 0, TEXTURE_TYPE, tex_size, tex_size, 0, GL_RGBA, GL_FLOAT, &tex_data[0]);
-
-	for (int i = 0; i < numParticles; ++i) {		
-		tex_data[i*4+0] = (2.0*((GLfloat)rand() / ((GLfloat)RAND_MAX)) - 1.0)*0.25;
-		tex_data[i*4+1] = ((GLfloat)rand() / ((GLfloat)RAND_MAX)); 
-		tex_data[i*4+2] = (2.0*((GLfloat)rand() / ((GLfloat)RAND_MAX)) - 1.0)*0.25;
-		tex_data[i*4+3] = 1.0;
-	}
-
-	glGenTextures(1, &tex_velocity);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, tex_velocity);	
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glTexImage2D(GL_TEXTURE_2D, 0, TEXTURE_TYPE, tex_size, tex_size, 0, GL_RGBA, GL_FLOAT, &tex_data[0]);
-
-	glGenTextures(1, &tex_originalVelocity);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, tex_originalVelocity);	
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glTexImage2D(GL_TEXTURE_2D, 0, TEXTURE_TYPE, tex_size, tex_size, 0, GL_RGBA, GL_FLOAT, &tex_data[0]);	
 
-	delete [] tex_data;
+	/// emitters give birth to the particles, which start dead
+	if (useEmitters) {
+		pos[4*i + 3] = -1.0;
+		vel[4*i + 0] = vel[4*i + 1] = vel[4*i + 2] = vel[4*i + 3] = 0.0;
+	}
 
-	glGenFramebuffersEXT(1, &fbo);
-  	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
+}
 
-	glBindTexture(GL_TEXTURE_2D, tex_position);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, tex_position, 0);
+/// Writes a checkpoint with --checkpoint
+/// @arg pos, vel, orig_vel state, 4 floats per particle
+/// @arg gravity gravity of the last step
 
-	glBindTexture(GL_TEXTURE_2D, tex_velocity);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT1_EXT, GL_TEXTURE_2D, tex_velocity, 0);
+void saveCheckpoint ( const GLfloat *pos, const GLfloat *vel, const GLfloat *orig_vel, const GLfloat gravity[3] ) {
 
-	if (glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) != GL_FRAMEBUFFER_COMPLETE_EXT)
-	printf("ERROR - Incomplete FrameBuffer\n");
+	particleCheckpoint::header h;
+	h.numParticles = numParticles;
+	h.step = step;
+	h.totalSteps = totalSteps;
+	h.time_step = time_step;
+	memcpy(h.gravity, gravity, 3*sizeof(GLfloat));
 
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+	if (particleCheckpoint::write(checkpointFile, h, pos, vel, orig_vel))
+		cout << "[Checkpoint] " << numParticles << " particles at step " << totalSteps
+		     << " saved to " << checkpointFile << endl;
+	else
+		cerr << "[Error] Cannot write " << checkpointFile << endl;
 
 }
 
-void timer(int extra) {	
-	
-	computeCinematics();
-	
-	step+=1;
-	if (step >= numParticles)
-		step = 0;
-	glutTimerFunc(10, timer, 0);	
-}
+/// Reads the GPU state back and saves it with --checkpoint
 
+void checkpointGPUState ( void ) {
 
-/// OpenGL Utility (GLUT) Setup
+	if (!checkpointFile)
+		return;
 
-void setupGL( void ) {
+	GLfloat *pos_data = new GLfloat[4*numParticles];
+	GLfloat *vel_data = new GLfloat[4*numParticles];
+	GLfloat *orig_data = new GLfloat[4*numParticles];
+	GLfloat gravity[3];
 
-	glutInitDisplayMode(GLUT_DOUBLE | GLUT_DEPTH | GLUT_RGBA);
-	glutInitWindowSize(winWidth, winHeight);
-	glutInitWindowPosition(100, 100);
-	glutCreateWindow(titleWin);
+	engine->get_state(pos_data, vel_data, orig_data);
+	computeGravity(gravity);
 
-#ifdef __GLEW__
-	if( GLEW_OK != glewInit() ) {
-	  cerr << "glew failed" << endl;
-	  exit(1);
-	}
-#endif
+	saveCheckpoint(pos_data, vel_data, orig_data, gravity);
 
-	glClearColor(1., 1., 1., 0.);
+	delete [] pos_data;
+	delete [] vel_data;
+	delete [] orig_data;
 
-	glDisable(GL_DEPTH_TEST);
+}
+
+/// Maps the checkpoint of --resume and restores the counters and the
+/// time step from it
+/// @arg cp checkpoint to open
+/// @return false if the file is not a checkpoint
+
+bool openCheckpoint ( particleCheckpoint& cp ) {
+
+	if (!cp.open(resumeFile)) {
+		cerr << "[Error] Cannot resume from " << resumeFile << endl;
+		return false;
+	}
+
+	const particleCheckpoint::header& h = cp.info();
+
+	numParticles = h.numParticles;
+	step = h.step;
+	totalSteps = h.totalSteps;
+	time_step = h.time_step;
+
+	return true;
+
+}
+
+/// Resumes the run of --resume on the GPU: the mapped arrays go to
+/// set_state as they are
+
+void resumeParticles ( void ) {
+
+	std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+
+	particleCheckpoint cp;
+
+	if (!openCheckpoint(cp))
+		exit(1);
+
+	if (numParticles > engine->max_particles()) {
+		cerr << "[Error] The " << engine->name() << " engine holds at most "
+		     << engine->max_particles() << " particles" << endl;
+		exit(1);
+	}
+
+	engine->set_state(numParticles, cp.positions(), cp.velocities(), cp.original_velocities());
+
+	if (recorder.is_open()) {
+		recordReadback.poll(true);
+		recorder.record(totalSteps, numParticles, cp.positions(), cp.velocities());
+	}
+
+	glFinish();
+
+	cout << "[Checkpoint] " << numParticles << " particles at step " << totalSteps << " resumed in "
+	     << std::chrono::duration< double, std::milli >( std::chrono::high_resolution_clock::now() - t0 ).count()
+	     << " ms" << endl;
+
+}
+
+/// Setup the particle state with random initial velocities, or from
+/// the checkpoint of --resume
+void setupParticles ( void ) {
+
+	if (resumeFile) {
+
+		resumeParticles();
+
+	} else {
+
+		GLfloat *pos_data = new GLfloat[4*numParticles];
+		GLfloat *vel_data = new GLfloat[4*numParticles];
+
+		srand ( seed );
+
+		for (GLuint i = 0; i < numParticles; ++i)
+			initParticle(i, pos_data, vel_data);
+
+		engine->set_state(numParticles, pos_data, vel_data, vel_data);
+
+		if (recorder.is_open()) {
+			recordReadback.poll(true);
+			recorder.record(totalSteps, numParticles, pos_data, vel_data);
+		}
+
+		delete [] pos_data;
+		delete [] vel_data;
+
+	}
+
+	if (timer_query_support())
+		glGenQueries(2, stepQuery);
+
+}
+
+/// Changes the number of particles keeping the state of the existing
+/// ones; new particles start from the origin as usual, or dead with
+/// emitters
+/// @arg n new number of particles
+
+void resizeParticles ( GLuint n ) {
+
+	GLuint old_count = numParticles;
+	GLuint count = (n > old_count) ? n : old_count;
+
+	GLfloat *pos_data = new GLfloat[4*count];
+	GLfloat *vel_data = new GLfloat[4*count];
+	GLfloat *orig_data = new GLfloat[4*count];
+
+	engine->get_state(pos_data, vel_data, orig_data);
+
+	numParticles = n;
+
+	for (GLuint i = 0; i < numParticles; ++i) {
+
+		if (i < old_count) {
+
+			/// the emitter index of the live particles is kept, and the
+			/// dead ones stay dead
+			if (!useEmitters)
+				pos_data[4*i + 3] = i/(GLfloat)numParticles;
+			else if (pos_data[4*i + 3] >= 0.0)
+				pos_data[4*i + 3] = floor(pos_data[4*i + 3]*old_count + 0.5)/numParticles;
+
+		} else {
+
+			initParticle(i, pos_data, vel_data);
+			memcpy(&orig_data[4*i], &vel_data[4*i], 4*sizeof(GLfloat));
+
+		}
+
+	}
+
+	engine->set_state(numParticles, pos_data, vel_data, orig_data);
+
+	delete [] pos_data;
+	delete [] vel_data;
+	delete [] orig_data;
+
+	if (step >= (GLint)numParticles)
+		step = 0;
+
+	cout << "[Resize] " << old_count << " -> " << numParticles << " particles ("
+	     << engine->name() << "), last step " << stepTime << " ms" << endl;
+
+	stepQueryCount = 0;
+	stepTime = 0.0;
+
+}
+
+/// Moves the particle state to another engine, skipping the engines
+/// that cannot run in this context
+/// @arg k engine index (taken modulo the number of engines)
+
+void selectEngine ( int k ) {
+
+	/// engines too small for the particles are skipped
+	for (int tries = 0; tries < numEngines && (!engineReady[k % numEngines] ||
+						    engines[k % numEngines]->max_particles() < numParticles); ++tries)
+		++k;
+	k %= numEngines;
+
+	if (k == currEngine || !engineReady[k] || engines[k]->max_particles() < numParticles)
+		return;
+
+	GLfloat *pos_data = new GLfloat[4*numParticles];
+	GLfloat *vel_data = new GLfloat[4*numParticles];
+	GLfloat *orig_data = new GLfloat[4*numParticles];
+
+	engine->get_state(pos_data, vel_data, orig_data);
+	engine->clear();
+
+	cout << "[Engine] " << engine->name() << " -> " << engines[k]->name()
+	     << ", last step " << stepTime << " ms" << endl;
+
+	currEngine = k;
+	engine = engines[k];
+	engine->set_state(numParticles, pos_data, vel_data, orig_data);
+
+	delete [] pos_data;
+	delete [] vel_data;
+	delete [] orig_data;
+
+	stepQueryCount = 0;
+	stepTime = 0.0;
+
+}
+
+
+/// Writes the particle state as text, one particle per line with its
+/// position and velocity
+/// @arg filename output file
+/// @arg pos, vel state, 4 floats per particle
+
+void dumpState ( const char *filename, const GLfloat *pos, const GLfloat *vel ) {
+
+	FILE *f = fopen(filename, "w");
+
+	if (!f) {
+		cerr << "[Error] Cannot write " << filename << endl;
+		return;
+	}
+
+	for (GLuint i = 0; i < numParticles; ++i)
+		fprintf(f, "%.9g %.9g %.9g %.9g %.9g %.9g\n",
+			pos[4*i + 0], pos[4*i + 1], pos[4*i + 2],
+			vel[4*i + 0], vel[4*i + 1], vel[4*i + 2]);
+
+	fclose(f);
+
+}
+
+/// Reads the current GPU state back and dumps it
+
+void dumpGPUState ( void ) {
+
+	GLfloat *pos_data = new GLfloat[4*numParticles];
+	GLfloat *vel_data = new GLfloat[4*numParticles];
+
+	engine->get_state(pos_data, vel_data, 0);
+
+	dumpState(dumpFile, pos_data, vel_data);
+
+	delete [] pos_data;
+	delete [] vel_data;
+
+}
+
+
+/// Finds the last snapshot at or before replayStep in a trajectory
+/// file, and dumps it with --dump
+
+int runReplay ( void ) {
+
+	trajectoryReader reader;
+
+	if (!reader.open(replayFile)) {
+		cerr << "[Error] Cannot read trajectory " << replayFile << endl;
+		return 1;
+	}
+
+	size_t k = reader.find(replayStep);
+
+	if (k == reader.size()) {
+		cerr << "[Error] No snapshot at step " << replayStep << endl;
+		return 1;
+	}
+
+	numParticles = reader.count(k);
+
+	cout << "[Replay] " << reader.size() << " snapshots every " << reader.interval()
+	     << " steps, step " << reader.step(k) << " has " << numParticles << " particles" << endl;
+
+	if (dumpFile) {
+
+		GLfloat *pos_data = new GLfloat[4*numParticles];
+		GLfloat *vel_data = new GLfloat[4*numParticles];
+
+		if (!reader.read(k, pos_data, vel_data)) {
+			cerr << "[Error] Corrupt snapshot at step " << reader.step(k) << endl;
+			delete [] pos_data;
+			delete [] vel_data;
+			return 1;
+		}
+
+		dumpState(dumpFile, pos_data, vel_data);
+
+		delete [] pos_data;
+		delete [] vel_data;
+
+	}
+
+	return 0;
+
+}
+
+/// Runs the simulation headless on the CPU backend, with the gravity
+/// of the initial view (no arcball rotation)
+
+int runCPU ( void ) {
+
+	particleCPU cpu(cpuThreads);
+
+	/// the modelview of the initial view is only scaled by zoom; a
+	/// resumed run keeps the gravity it had
+	GLfloat gravity[3] = {0.0f, -0.98f*zoom, 0.0f};
+
+	particleCheckpoint cp;
+
+	if (resumeFile) {
+
+		if (!openCheckpoint(cp))
+			return 1;
+
+		memcpy(gravity, cp.info().gravity, 3*sizeof(GLfloat));
+
+	}
+
+	GLfloat *pos_data = new GLfloat[4*numParticles];
+	GLfloat *vel_data = new GLfloat[4*numParticles];
+
+	if (resumeFile) {
+
+		cpu.set_state(numParticles, cp.positions(), cp.velocities(), cp.original_velocities());
+		cpu.get_state(pos_data, vel_data);
+		cp.close();
+
+	} else {
+
+		srand ( seed );
+
+		for (GLuint i = 0; i < numParticles; ++i)
+			initParticle(i, pos_data, vel_data);
+
+		cpu.set_state(numParticles, pos_data, vel_data, vel_data);
+
+	}
+
+	if (recorder.is_open())
+		recorder.record(totalSteps, numParticles, pos_data, vel_data);
+
+	particleGridCPU grid(cpu);
+	grid.set_params(radius, stiffness);
+
+	GLint steps = maxSteps ? maxSteps : 1000;
+
+	std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+
+	for (GLint k = 0; k < steps; ++k) {
+
+		if (neighbours == particleCompute::NEIGHBOURS_GRID) {
+			grid.build(step);
+			grid.collide(time_step);
+		}
+
+		cpu.compute(time_step, step, gravity);
+
+		step+=1;
+		if (step >= (GLint)numParticles)
+			step = 0;
+
+		++totalSteps;
+		if (recorder.is_open() && totalSteps % recorder.interval() == 0) {
+			cpu.get_state(pos_data, vel_data);
+			recorder.record(totalSteps, numParticles, pos_data, vel_data);
+		}
+
+	}
+
+	double ms = std::chrono::duration< double, std::milli >( std::chrono::high_resolution_clock::now() - t0 ).count();
+
+	char stats[512] = "";
+	if (showStats) {
+		particleStats st;
+		cpu.reduce(st);
+		formatStats(stats, st);
+	}
+
+	if (benchmark)
+		printf("{\"backend\": \"cpu\", \"simd\": \"%s\", \"threads\": %u, \"particles\": %u, "
+		       "\"steps\": %d, \"seed\": %u, \"steps_per_sec\": %.3f, \"particles_per_sec\": %.6g, "
+		       "\"compute_ms\": %.6f%s}\n", particleCPU::simd_name(), cpu.threads(), numParticles,
+		       steps, seed, steps / (ms*1e-3), (double)numParticles*steps / (ms*1e-3), ms / steps, stats);
+	else
+		cout << "[CPU] " << numParticles << " particles, " << steps << " steps, "
+		     << cpu.threads() << " threads (" << particleCPU::simd_name() << "): "
+		     << ms / steps << " ms/step" << endl;
+
+	if (dumpFile) {
+		cpu.get_state(pos_data, vel_data);
+		dumpState(dumpFile, pos_data, vel_data);
+	}
+
+	if (checkpointFile) {
+		GLfloat *orig_data = new GLfloat[4*numParticles];
+		cpu.get_state(pos_data, vel_data, orig_data);
+		saveCheckpoint(pos_data, vel_data, orig_data, gravity);
+		delete [] orig_data;
+	}
+
+	bool recorded = closeRecorder();
+
+	delete [] pos_data;
+	delete [] vel_data;
+
+	return recorded ? 0 : 1;
+
+}
+
+/// Runs the neighbour grid over uniformly random particles at growing
+/// densities (expected particles per cell), timing the build and the
+/// collision apart and reporting one JSON line per density
+/// @arg grid grid over the particles
+/// @arg load sets the particle state
+/// @arg sync waits for the grid to finish, 0 on the CPU
+
+void sweepGrid ( particleGrid& grid, const std::function< void (GLfloat*, GLfloat*) >& load,
+		 void (*sync)( void ) ) {
+
+	static const float densities[] = { 0.125f, 0.25f, 0.5f, 1.0f, 2.0f, 4.0f, 8.0f, 16.0f };
+
+	GLfloat *pos_data = new GLfloat[4*numParticles];
+	GLfloat *vel_data = new GLfloat[4*numParticles];
+
+	srand ( seed );
+
+	for (GLuint i = 0; i < numParticles; ++i) {
+		for (int c = 0; c < 3; ++c) {
+			pos_data[4*i + c] = 2.0*((GLfloat)rand() / ((GLfloat)RAND_MAX)) - 1.0;
+			vel_data[4*i + c] = 0.0;
+		}
+		pos_data[4*i + 3] = i/(GLfloat)numParticles;
+		vel_data[4*i + 3] = 1.0;
+	}
+
+	GLint steps = maxSteps ? maxSteps : 10;
+
+	for (unsigned d = 0; d < sizeof(densities) / sizeof(densities[0]); ++d) {
+
+		/// cells as wide as the radius, slightly under so that 2/radius
+		/// rounds down to the wanted number of cells
+		int side = (int)floor(cbrt(numParticles / densities[d]) + 0.5);
+		if (side < 1) side = 1;
+		grid.set_params(1.999f / side, stiffness);
+
+		load(pos_data, vel_data);
+		if (sync) sync();
+
+		double build_ms = 0.0, collide_ms = 0.0;
+
+		for (GLint k = 0; k < steps; ++k) {
+
+			std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+			grid.build(numParticles);
+			if (sync) sync();
+			std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+			grid.collide(time_step);
+			if (sync) sync();
+			std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
+
+			build_ms += std::chrono::duration< double, std::milli >( t1 - t0 ).count();
+			collide_ms += std::chrono::duration< double, std::milli >( t2 - t1 ).count();
+
+		}
+
+		printf("{\"grid\": \"%s\", \"particles\": %u, \"seed\": %u, \"cells_per_side\": %u, "
+		       "\"table_size\": %u, \"radius\": %.6f, \"density\": %.4f, \"steps\": %d, "
+		       "\"build_ms\": %.6f, \"collide_ms\": %.6f}\n",
+		       grid.name(), numParticles, seed, grid.cells_per_side(), grid.table_size(),
+		       grid.interaction_radius(), numParticles / ((double)side*side*side), steps,
+		       build_ms / steps, collide_ms / steps);
+
+	}
+
+	delete [] pos_data;
+	delete [] vel_data;
+
+}
+
+/// Density sweep of the CPU grid
+
+int runGridSweepCPU ( void ) {
+
+	particleCPU cpu(cpuThreads);
+	particleGridCPU grid(cpu);
+
+	sweepGrid(grid, [&] (GLfloat *pos, GLfloat *vel) {
+			cpu.set_state(numParticles, pos, vel, vel);
+		}, 0);
+
+	return 0;
+
+}
+
+/// Density sweep of the grid of the compute engine
+
+int runGridSweepGPU ( void ) {
+
+	if( engine != &computeEngine ) {
+		cerr << "[Error] The grid sweep needs the compute engine (--engine=compute)" << endl;
+		return 1;
+	}
+
+	/// the grid is bound again to the new state buffers after each load
+	sweepGrid(computeEngine.neighbour_grid(), [&] (GLfloat *pos, GLfloat *vel) {
+			computeEngine.set_state(numParticles, pos, vel, vel);
+			computeEngine.neighbour_grid();
+		}, glFinish);
+
+	return 0;
+
+}
+
+#ifdef __EGL__
+static EGLDisplay benchDisplay = EGL_NO_DISPLAY; ///< Display of the benchmark context
+static EGLContext benchContext = EGL_NO_CONTEXT; ///< Offscreen benchmark context
+#endif
+
+/// Creates the offscreen context of the benchmark: a surfaceless EGL
+/// context when built with __EGL__, otherwise a hidden GLUT window
+/// @return true if a context is current
+
+bool setupBenchmarkContext( int *argc, char **argv ) {
+
+#ifdef __EGL__
+
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+	EGLDisplay display = EGL_NO_DISPLAY;
+	if (getPlatformDisplay)
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+	if (display == EGL_NO_DISPLAY)
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if (!eglInitialize(display, &major, &minor) || !eglBindAPI(EGL_OPENGL_API))
+		return false;
+
+	EGLint attribs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config;
+	EGLint numConfigs = 0;
+	if (!eglChooseConfig(display, attribs, &config, 1, &numConfigs) || numConfigs == 0)
+		return false;
+
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, 0);
+	if (context == EGL_NO_CONTEXT)
+		return false;
+
+	if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+		return false;
+
+	benchDisplay = display;
+	benchContext = context;
+
+#else
+
+	glutInit(argc, argv);
+	glutInitDisplayMode(GLUT_DOUBLE | GLUT_DEPTH | GLUT_RGBA);
+	glutInitWindowSize(1, 1);
+	glutCreateWindow(titleWin);
+	glutHideWindow();
+
+#endif
+
+#ifdef __GLEW__
+	if( GLEW_OK != glewInit() ) {
+	  cerr << "glew failed" << endl;
+	  return false;
+	}
+#endif
+
+	return true;
+
+}
+
+/// Destroys the offscreen context of the benchmark, once the texture
+/// cache of the kernels has forgotten it
+
+void releaseBenchmarkContext( void ) {
+
+	glsl_release_context();
+
+#ifdef __EGL__
+	eglMakeCurrent(benchDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(benchDisplay, benchContext);
+	eglTerminate(benchDisplay);
+	benchDisplay = EGL_NO_DISPLAY;
+	benchContext = EGL_NO_CONTEXT;
+#else
+	glutDestroyWindow(glutGetWindow());
+#endif
+
+}
+
+/// Milliseconds elapsed since t0, after the GPU has finished
+/// @arg t0 start time
+
+double elapsedMs( const std::chrono::high_resolution_clock::time_point& t0 ) {
+
+	glFinish();
+	return std::chrono::duration< double, std::milli >( std::chrono::high_resolution_clock::now() - t0 ).count();
+
+}
+
+/// Bakes the field of the mesh of --collide over the box, with the
+/// threads of the CPU backend
+
+void setupCollider( void ) {
+
+	threadPool pool(cpuThreads);
+
+	const GLfloat lo[3] = { -1.0, -1.0, -1.0 }, hi[3] = { 1.0, 1.0, 1.0 };
+	collider.bake(sdfResolution, lo, hi, pool);
+
+	if (!benchmark)
+		cout << "[Collide] " << collideFile << ", " << collider.triangles() << " triangles, "
+		     << sdfResolution << "^3 samples baked in " << collider.bake_time() << " ms ("
+		     << pool.size() << " threads)" << endl;
+
+}
+
+/// Distance of the engine positions from the 32 bit path: a texture
+/// engine in 32 bit floats runs the same steps from the same initial
+/// state, in one submission, colliding with the same mesh
+/// @arg first_step step of the first step run
+/// @arg steps number of steps run
+/// @arg drift output, JSON object of the largest and RMS distance
+
+void precisionDrift( GLint first_step, GLint steps, char *drift ) {
+
+	GLfloat *pos_data = new GLfloat[4*numParticles];
+	GLfloat *vel_data = new GLfloat[4*numParticles];
+
+	srand ( seed );
+
+	for (GLuint i = 0; i < numParticles; ++i)
+		initParticle(i, pos_data, vel_data);
+
+	referenceEngine.install(false);
+	referenceEngine.set_state(numParticles, pos_data, vel_data, vel_data);
+
+	GLfloat gravity[3];
+	computeGravity(gravity);
+	referenceEngine.compute_steps(time_step, first_step, gravity, steps);
+
+	GLfloat *ref_data = new GLfloat[4*numParticles];
+	referenceEngine.get_state(ref_data, 0, 0);
+	referenceEngine.clear();
+	engine->get_state(pos_data, 0, 0);
+
+	double largest = 0.0, sum = 0.0;
+
+	for (GLuint i = 0; i < numParticles; ++i) {
+
+		double d2 = 0.0;
+		for (int c = 0; c < 3; ++c)
+			d2 += (pos_data[4*i + c] - ref_data[4*i + c])*(double)(pos_data[4*i + c] - ref_data[4*i + c]);
+
+		if (d2 > largest)
+			largest = d2;
+		sum += d2;
+
+	}
+
+	sprintf(drift, "{\"max\": %.6g, \"rms\": %.6g}", sqrt(largest), sqrt(sum / numParticles));
+
+	delete [] pos_data;
+	delete [] vel_data;
+	delete [] ref_data;
+
+}
+
+/// Runs the GPU benchmark: compute, readback and draw phases timed
+/// apart (each one ends with glFinish), drawing to an offscreen
+/// framebuffer of the window size
+
+int runBenchmark( void ) {
+
+	glClearColor(1., 1., 1., 0.);
+	glDisable(GL_DEPTH_TEST);
+
+	GLuint benchFbo, benchColor, benchDepth;
+	glGenRenderbuffersEXT(1, &benchColor);
+	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, benchColor);
+	glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_RGBA8, winWidth, winHeight);
+	glGenRenderbuffersEXT(1, &benchDepth);
+	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, benchDepth);
+	glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24, winWidth, winHeight);
+	glGenFramebuffersEXT(1, &benchFbo);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, benchFbo);
+	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_RENDERBUFFER_EXT, benchColor);
+	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, benchDepth);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
+	textureEngine.set_framebuffer(benchFbo);
+	referenceEngine.set_framebuffer(benchFbo);
+
+	/// the offscreen framebuffer stays bound, a surfaceless context has
+	/// no complete default one to draw or even compute with
+
+	reshape(winWidth, winHeight);
+
+	GLfloat *tex_data = new GLfloat[4*numParticles];
+	GLint steps = maxSteps ? maxSteps : 1000, firstStep = step;
+	double compute_ms = 0.0, readback_ms = 0.0, draw_ms = 0.0;
+
+	glFinish();
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now(), t0;
+
+	/// steps are submitted batchSteps at a time, each batch read back
+	/// and drawn once
+	for (GLint k = 0; k < steps; k += batchSteps) {
+
+		GLuint count = (k + batchSteps > (GLuint)steps) ? steps - k : batchSteps;
+
+		t0 = std::chrono::high_resolution_clock::now();
+		computeCinematics(count);
+		compute_ms += elapsedMs(t0);
+
+		t0 = std::chrono::high_resolution_clock::now();
+		if (asyncReadback)
+			readback.queue(*engine);
+		else
+			readPositions(tex_data);
+		queueStats();
+		readback_ms += elapsedMs(t0);
+
+		t0 = std::chrono::high_resolution_clock::now();
+		glClear(GL_COLOR_BUFFER_BIT);
+		glMatrixMode(GL_MODELVIEW);
+		glLoadIdentity();
+		glScalef(zoom, zoom, zoom);
+		arcball_rotate();
+		captureSceneDepth();
+		if (gpuRender)
+			drawParticles();
+		else
+			drawParticlesReadback();
+		draw_ms += elapsedMs(t0);
+
+	}
+
+	/// the frames still in flight are part of the readback
+	t0 = std::chrono::high_resolution_clock::now();
+	readback.poll(true);
+	readback_ms += elapsedMs(t0);
+
+	double total = elapsedMs(start);
+
+	/// statistics of the last state
+	char stats[512] = "";
+	if (statsReady) {
+		reduction.poll(true);
+		queueStats();
+		reduction.poll(true);
+		formatStats(stats, reduction.stats());
+	}
+
+	/// energy the integrator gained per particle over the run
+	char drift[32] = "null";
+	if (energyCheck)
+		sprintf(drift, "%.6g", computeEngine.energy_drift() / numParticles);
+
+	/// positions against the 32 bit path, from a new run only
+	char precisionDist[64] = "null";
+	if (precision != particleTexture::PRECISION_FLOAT32 && !resumeFile)
+		precisionDrift(firstStep, steps, precisionDist);
+
+	/// mesh collided with, its bake is not part of the steps
+	char collide[256] = "null";
+	if (collideFile)
+		snprintf(collide, sizeof(collide), "\"%s\"", collideFile);
+
+	printf("{\"backend\": \"gpu\", \"renderer\": \"%s\", \"engine\": \"%s\", \"particles\": %u, "
+	       "\"steps\": %d, \"batch\": %u, \"seed\": %u, \"steps_per_sec\": %.3f, \"particles_per_sec\": %.6g, "
+	       "\"compute_ms\": %.6f, \"readback_ms\": %.6f, \"draw_ms\": %.6f, \"draw\": \"%s\", "
+	       "\"readback\": \"%s\", \"readback_stalls\": %u, \"readback_dropped\": %u, \"render\": \"%s\", \"sorted\": %s, "
+	       "\"systems\": %u, \"integrator\": \"%s\", \"time_step\": %g, \"energy_drift\": %s, "
+	       "\"precision\": \"%s\", \"state_bytes\": %u, \"precision_drift\": %s, "
+	       "\"collide\": %s, \"sdf_resolution\": %u, \"sdf_bake_ms\": %.3f%s}\n",
+	       (const char*) glGetString(GL_RENDERER), engine->name(), numParticles,
+	       steps, batchSteps, seed, steps / (total*1e-3), (double)numParticles*steps / (total*1e-3),
+	       compute_ms / steps, readback_ms / steps, draw_ms / steps, gpuRender ? "gpu" : "readback",
+	       asyncReadback ? "async" : "sync", readback.stalls(), readback.dropped(), drawModeNames[drawMode],
+	       drawMode != DRAW_POINTS && sprites.sorted() ? "true" : "false", numSystems,
+	       numSystems && !integratorGiven ? "per system" : integratorNames[integrator], time_step, drift,
+	       engine == &textureEngine ? precisionNames[precision] : "fp32", engine->state_bytes(), precisionDist,
+	       collide, collideFile ? sdfResolution : 0, collider.bake_time(), stats);
+
+	if (dumpFile)
+		dumpGPUState();
+
+	bool recorded = closeRecorder();
+	checkpointGPUState();
+
+	delete [] tex_data;
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+	textureEngine.set_framebuffer(0);
+	referenceEngine.set_framebuffer(0);
+	glDeleteFramebuffersEXT(1, &benchFbo);
+	glDeleteRenderbuffersEXT(1, &benchColor);
+	glDeleteRenderbuffersEXT(1, &benchDepth);
+
+	return recorded ? 0 : 1;
+
+}
+
+/// OpenGL Utility (GLUT) Setup
+
+void setupGL( void ) {
+
+	glutInitDisplayMode(GLUT_DOUBLE | GLUT_DEPTH | GLUT_RGBA);
+	glutInitWindowSize(winWidth, winHeight);
+	glutInitWindowPosition(100, 100);
+	glutCreateWindow(titleWin);
+
+#ifdef __GLEW__
+	if( GLEW_OK != glewInit() ) {
+	  cerr << "glew failed" << endl;
+	  exit(1);
+	}
+#endif
+
+	glClearColor(1., 1., 1., 0.);
+
+	glDisable(GL_DEPTH_TEST);
 
 	glutReshapeFunc(reshape);
 	glutDisplayFunc(display);
 	glutIdleFunc(display);
-	glutTimerFunc(0,timer,0);
 	glutKeyboardFunc(keyboard);
 	glutMouseFunc(mouse);
 	glutMotionFunc(motion);
 
 }
 
+/// Adds the systems of --systems: fountains side by side in the box,
+/// each in its own column with its own gravity and pace, and its own
+/// integrator unless --integrator is given
+
+void setupSystems( void ) {
+
+	for (GLuint k = 0; k < numSystems; ++k) {
+
+		/// 0 to 1 across the systems
+		GLfloat t = numSystems > 1 ? k / (GLfloat)(numSystems - 1) : 0.5;
+
+		particleSystems::system s;
+		s.share = 1.0;
+		s.gravity = 0.5 + t;
+		s.time_scale = 1.25 - 0.5*t;
+		s.integrator = integratorGiven ? integrator : (particleCompute::integrator)(k % particleCompute::NUM_INTEGRATORS);
+
+		s.boundsMin[0] = -1.0 + 2.0*k / numSystems;
+		s.boundsMax[0] = -1.0 + 2.0*(k + 1) / numSystems;
+		s.boundsMin[1] = s.boundsMin[2] = -1.0;
+		s.boundsMax[1] = s.boundsMax[2] = 1.0;
+
+		s.origin[0] = 0.5*(s.boundsMin[0] + s.boundsMax[0]);
+		s.origin[1] = -0.5;
+		s.origin[2] = 0.0;
+
+		systems.add(s);
+
+	}
+
+	computeEngine.set_systems(&systems);
+
+}
+
+/// Adds the emitters of --emitters: a fountain from a point, a sphere
+/// and a torus mesh, each keeping about a third of the particles alive
+
+void setupEmitters( void ) {
+
+	particleEmitters::emitter e;
+	memset(&e, 0, sizeof(e));
+
+	e.type = particleEmitters::EMITTER_POINT;
+	e.center[1] = -0.8;
+	e.velocity[1] = 1.2;
+	e.spread = 0.3;
+	e.life = 1.5;
+	e.rate = 0.9*numParticles / (3.0*e.life);
+	emitters.add(e);
+
+	e.type = particleEmitters::EMITTER_SPHERE;
+	e.center[0] = -0.5; e.center[1] = 0.3;
+	e.radius = 0.15;
+	e.velocity[1] = 0.0;
+	e.speed = 0.4;
+	e.spread = 0.05;
+	e.life = 1.0;
+	e.rate = 0.9*numParticles / (3.0*e.life);
+	emitters.add(e);
+
+	/// torus around the y axis, rings x sides quads of two triangles
+	const int rings = 24, sides = 12;
+	const GLfloat R = 0.2, r = 0.05;
+
+	std::vector< GLfloat > vertices;
+	std::vector< GLuint > indices;
+
+	for (int i = 0; i < rings; ++i)
+		for (int j = 0; j < sides; ++j) {
+
+			GLfloat u = 2.0*PI*i / rings, v = 2.0*PI*j / sides;
+			vertices.push_back((R + r*cos(v))*cos(u));
+			vertices.push_back(r*sin(v));
+			vertices.push_back((R + r*cos(v))*sin(u));
+
+			GLuint a = i*sides + j, b = ((i + 1)%rings)*sides + j;
+			GLuint c = ((i + 1)%rings)*sides + (j + 1)%sides, d = i*sides + (j + 1)%sides;
+			GLuint quad[6] = { a, d, c, a, c, b };
+			indices.insert(indices.end(), quad, quad + 6);
+
+		}
+
+	e.center[0] = 0.5; e.center[1] = 0.3;
+	e.speed = 0.3;
+	emitters.add_mesh(e, &vertices[0], &indices[0], indices.size() / 3);
+
+	computeEngine.set_emitters(&emitters);
+
+}
+
 /// Setup GLSL Shaders
 
 bool setupShaders( void ) {
@@ -582,13 +1915,74 @@ bool setupShaders( void ) {
 
 	}
 
-	//~ displayShader.vertex_source(vsFile[0]);
-	//~ displayShader.fragment_source(fsFile[0]);
-	//~ displayShader.install(true);
+	/// the packed positions are 16 bit normalized, not renderable on
+	/// every board, then half floats keep the whole state
+	if( precision == particleTexture::PRECISION_PACKED && !textureEngine.renderable() ) {
+		cerr << "[Warning] No rendering to 16 bit normalized textures, the state is kept in fp16" << endl;
+		precision = particleTexture::PRECISION_FLOAT16;
+		textureEngine.set_precision(precision);
+	}
+
+	if( precision != particleTexture::PRECISION_FLOAT32 && !textureEngine.renderable() ) {
+		cerr << "[Error] No rendering to 16 bit float textures" << endl;
+		return false;
+	}
+
+	for (int k = 0; k < numEngines; ++k) {
+
+		/// only the compute engine has emitters, systems and integrators
+		if( computeOnly && engines[k] != &computeEngine ) {
+			engineReady[k] = false;
+			continue;
+		}
+
+		engineReady[k] = engines[k]->install(!benchmark);
+
+		if( !engineReady[k] )
+			cerr << "[Warning] No support for the " << engines[k]->name() << " engine" << endl;
+
+	}
+
+	if( computeOnly && !engineReady[currEngine] ) {
+		cerr << "[Error] The emitters, systems, integrators and energy check need the compute engine" << endl;
+		return false;
+	}
+
+	if( !engineReady[currEngine] ) {
+		currEngine = 0;
+		engine = engines[0];
+	}
+
+	if( numParticles > engine->max_particles() ) {
+		cerr << "[Error] The " << engine->name() << " engine holds at most "
+		     << engine->max_particles() << " particles" << endl;
+		return false;
+	}
 
-	computeShader.vertex_source(vsFile[1]);
-	computeShader.fragment_source(fsFile[1]);
-	computeShader.install(true);
+	spritesReady = sprites.install(!benchmark);
+
+	if( !spritesReady && drawMode != DRAW_POINTS ) {
+		cerr << "[Warning] No instancing, drawing points instead of sprites" << endl;
+		drawMode = DRAW_POINTS;
+	}
+
+	if( showStats ) {
+		statsReady = particleReduction::supported();
+		if( statsReady )
+			reduction.install(!benchmark, 256);
+		else
+			cerr << "[Warning] No compute shaders, no statistics" << endl;
+	}
+
+	if( drawMode != DRAW_POINTS && sortSprites && !sprites.sort_support() )
+		cerr << "[Warning] No compute shaders, sprites are not sorted" << endl;
+
+	GLint vtxTexUnits = 0;
+	glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS, &vtxTexUnits);
+	if( vtxTexUnits == 0 && engine == &textureEngine ) {
+		cerr << "[Warning] No vertex texture fetch, reading particles back" << endl;
+		gpuRender = false;
+	}
 
 	return true;
 
@@ -598,6 +1992,317 @@ bool setupShaders( void ) {
 
 int main( int argc, char** argv ) {
 
+	for (int i = 1; i < argc; ++i) {
+
+		if (strncmp(argv[i], "--particles=", 12) == 0)
+			numParticles = atol(argv[i] + 12);
+		else if (strcmp(argv[i], "-n") == 0 && i+1 < argc)
+			numParticles = atol(argv[++i]);
+		else if (strcmp(argv[i], "--backend=cpu") == 0)
+			cpuBackend = true;
+		else if (strcmp(argv[i], "--backend=gpu") == 0)
+			cpuBackend = false;
+		else if (strncmp(argv[i], "--steps=", 8) == 0)
+			maxSteps = atol(argv[i] + 8);
+		else if (strncmp(argv[i], "--dump=", 7) == 0)
+			dumpFile = argv[i] + 7;
+		else if (strncmp(argv[i], "--threads=", 10) == 0)
+			cpuThreads = atol(argv[i] + 10);
+		else if (strncmp(argv[i], "--rate=", 7) == 0)
+			stepRate = atof(argv[i] + 7);
+		else if (strncmp(argv[i], "--max-substeps=", 15) == 0)
+			maxSubsteps = atol(argv[i] + 15);
+		else if (strncmp(argv[i], "--batch=", 8) == 0)
+			batchSteps = atol(argv[i] + 8);
+		else if (strcmp(argv[i], "--benchmark") == 0)
+			benchmark = true;
+		else if (strcmp(argv[i], "--readback=sync") == 0)
+			asyncReadback = false;
+		else if (strcmp(argv[i], "--readback=async") == 0)
+			asyncReadback = true;
+		else if (strncmp(argv[i], "--record=", 9) == 0)
+			recordFile = argv[i] + 9;
+		else if (strncmp(argv[i], "--record-every=", 15) == 0)
+			recordInterval = atol(argv[i] + 15);
+		else if (strcmp(argv[i], "--record-half") == 0)
+			recordHalf = true;
+		else if (strcmp(argv[i], "--record-compress") == 0)
+			recordCompress = true;
+		else if (strncmp(argv[i], "--checkpoint=", 13) == 0)
+			checkpointFile = argv[i] + 13;
+		else if (strncmp(argv[i], "--resume=", 9) == 0)
+			resumeFile = argv[i] + 9;
+		else if (strncmp(argv[i], "--replay=", 9) == 0)
+			replayFile = argv[i] + 9;
+		else if (strncmp(argv[i], "--at=", 5) == 0)
+			replayStep = strtoull(argv[i] + 5, 0, 10);
+		else if (strncmp(argv[i], "--export=", 9) == 0) {
+			exportFile = fopen(argv[i] + 9, "w");
+			if (!exportFile) {
+				cerr << "[Error] Cannot write " << argv[i] + 9 << endl;
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--engine=", 9) == 0) {
+			currEngine = -1;
+			for (int k = 0; k < numEngines; ++k)
+				if (strcmp(argv[i] + 9, engines[k]->name()) == 0)
+					currEngine = k;
+			if (currEngine < 0) {
+				cerr << "[Error] Unknown engine " << argv[i] + 9 << endl;
+				return 1;
+			}
+			engine = engines[currEngine];
+			engineGiven = true;
+		}
+		else if (strncmp(argv[i], "--group-size=", 13) == 0)
+			computeEngine.set_group_size(atol(argv[i] + 13));
+		else if (strcmp(argv[i], "--neighbours=tiles") == 0)
+			neighbours = particleCompute::NEIGHBOURS_TILES;
+		else if (strcmp(argv[i], "--neighbours=grid") == 0)
+			neighbours = particleCompute::NEIGHBOURS_GRID;
+		else if (strncmp(argv[i], "--radius=", 9) == 0)
+			radius = atof(argv[i] + 9);
+		else if (strncmp(argv[i], "--stiffness=", 12) == 0)
+			stiffness = atof(argv[i] + 12);
+		else if (strcmp(argv[i], "--emitters") == 0)
+			useEmitters = true;
+		else if (strncmp(argv[i], "--systems=", 10) == 0)
+			numSystems = atoi(argv[i] + 10);
+		else if (strncmp(argv[i], "--integrator=", 13) == 0) {
+			int k = 0;
+			while (k < particleCompute::NUM_INTEGRATORS && strcmp(argv[i] + 13, integratorNames[k]) != 0)
+				++k;
+			if (k == particleCompute::NUM_INTEGRATORS) {
+				cerr << "[Error] Unknown integrator " << argv[i] + 13 << endl;
+				return 1;
+			}
+			integrator = (particleCompute::integrator)k;
+			integratorGiven = true;
+		}
+		else if (strcmp(argv[i], "--energy") == 0)
+			energyCheck = true;
+		else if (strcmp(argv[i], "--stats") == 0)
+			showStats = true;
+		else if (strncmp(argv[i], "--precision=", 12) == 0) {
+			int k = 0;
+			while (k < particleTexture::NUM_PRECISIONS && strcmp(argv[i] + 12, precisionNames[k]) != 0)
+				++k;
+			if (k == particleTexture::NUM_PRECISIONS) {
+				cerr << "[Error] Unknown precision " << argv[i] + 12 << endl;
+				return 1;
+			}
+			precision = (particleTexture::precision)k;
+		}
+		else if (strncmp(argv[i], "--collide=", 10) == 0)
+			collideFile = argv[i] + 10;
+		else if (strncmp(argv[i], "--sdf-resolution=", 17) == 0)
+			sdfResolution = atol(argv[i] + 17);
+		else if (strncmp(argv[i], "--time-step=", 12) == 0)
+			time_step = atof(argv[i] + 12);
+		else if (strcmp(argv[i], "--sprites") == 0)
+			drawMode = DRAW_SPRITES;
+		else if (strcmp(argv[i], "--sprites=soft") == 0)
+			drawMode = DRAW_SOFT_SPRITES;
+		else if (strncmp(argv[i], "--softness=", 11) == 0)
+			softness = atof(argv[i] + 11);
+		else if (strcmp(argv[i], "--unsorted") == 0)
+			sortSprites = false;
+		else if (strcmp(argv[i], "--grid-sweep") == 0) {
+			gridSweep = benchmark = true;
+			neighbours = particleCompute::NEIGHBOURS_GRID;
+		}
+		else if (strncmp(argv[i], "--seed=", 7) == 0) {
+			seed = atol(argv[i] + 7);
+			seedGiven = true;
+		}
+		else {
+			cerr << "Usage: " << argv[0] << " [--particles=N | -n N] [--backend=cpu|gpu]"
+			     << " [--engine=texture|feedback|compute] [--steps=N] [--dump=FILE] [--threads=N]"
+			     << " [--benchmark] [--seed=N] [--group-size=N] [--neighbours=tiles|grid]"
+			     << " [--radius=R] [--stiffness=K] [--grid-sweep] [--rate=HZ] [--max-substeps=N]"
+			     << " [--batch=N] [--readback=sync|async] [--export=FILE] [--record=FILE]"
+			     << " [--record-every=K] [--record-half] [--record-compress] [--replay=FILE --at=STEP]"
+			     << " [--checkpoint=FILE] [--resume=FILE] [--emitters] [--systems=N]"
+			     << " [--integrator=euler|symplectic|verlet|rk4] [--energy] [--time-step=DT] [--stats]"
+			     << " [--precision=fp32|fp16|packed] [--collide=FILE.obj] [--sdf-resolution=N]"
+			     << " [--sprites[=soft]] [--softness=D] [--unsorted]" << endl;
+			return 1;
+		}
+
+	}
+
+	if (numParticles == 0) {
+		cerr << "[Error] Need at least one particle" << endl;
+		return 1;
+	}
+
+	if (maxSubsteps == 0 || batchSteps == 0) {
+		cerr << "[Error] Need at least one step per frame and per batch" << endl;
+		return 1;
+	}
+
+	if (!seedGiven)
+		seed = benchmark ? 1 : time(NULL);
+
+	if (replayFile)
+		return runReplay();
+
+	if (recordFile) {
+
+		if (recordInterval == 0) {
+			cerr << "[Error] Need at least one step between snapshots" << endl;
+			return 1;
+		}
+
+		if (!recorder.open(recordFile, recordInterval, recordHalf, recordCompress)) {
+			cerr << "[Error] Cannot write " << recordFile << endl;
+			return 1;
+		}
+
+	}
+
+	computeEngine.set_neighbours(neighbours);
+	computeEngine.set_neighbour_params(radius, stiffness);
+
+	if (useEmitters) {
+
+		if (cpuBackend || gridSweep) {
+			cerr << "[Error] The emitters run on the compute engine" << endl;
+			return 1;
+		}
+
+		for (int k = 0; k < numEngines; ++k)
+			if (engines[k] == &computeEngine)
+				currEngine = k;
+		engine = &computeEngine;
+		setupEmitters();
+
+	}
+
+	if (numSystems) {
+
+		if (cpuBackend || gridSweep || useEmitters || neighbours != particleCompute::NEIGHBOURS_NONE) {
+			cerr << "[Error] The systems run on the compute engine, without emitters or collisions" << endl;
+			return 1;
+		}
+
+		for (int k = 0; k < numEngines; ++k)
+			if (engines[k] == &computeEngine)
+				currEngine = k;
+		engine = &computeEngine;
+		setupSystems();
+
+	}
+
+	computeEngine.set_integrator(integrator);
+	computeEngine.set_energy_check(energyCheck);
+
+	computeOnly = useEmitters || numSystems || integrator != particleCompute::INTEGRATOR_SYMPLECTIC || energyCheck;
+
+	if (computeOnly && !useEmitters && !numSystems) {
+
+		if (cpuBackend || gridSweep || (engineGiven && engine != &computeEngine)) {
+			cerr << "[Error] The integrators and the energy check run on the compute engine" << endl;
+			return 1;
+		}
+
+		for (int k = 0; k < numEngines; ++k)
+			if (engines[k] == &computeEngine)
+				currEngine = k;
+		engine = &computeEngine;
+
+	}
+
+	textureEngine.set_precision(precision);
+
+	if (precision != particleTexture::PRECISION_FLOAT32) {
+
+		if (cpuBackend || gridSweep || computeOnly || engine != &textureEngine) {
+			cerr << "[Error] The reduced precision state is kept by the texture engine" << endl;
+			return 1;
+		}
+
+	}
+
+	if (collideFile) {
+
+		if (cpuBackend || gridSweep) {
+			cerr << "[Error] The mesh collisions run on the GPU engines" << endl;
+			return 1;
+		}
+
+		if (sdfResolution == 0) {
+			cerr << "[Error] Need at least one sample of the distance field" << endl;
+			return 1;
+		}
+
+		if (!collider.load_obj(collideFile)) {
+			cerr << "[Error] Cannot read the triangles of " << collideFile << endl;
+			return 1;
+		}
+
+		/// on the floor, half the box wide, under the fountain
+		const GLfloat lo[3] = { -0.5, -1.0, -0.5 }, hi[3] = { 0.5, -0.5, 0.5 };
+		collider.fit(lo, hi);
+
+		for (int k = 0; k < numEngines; ++k)
+			engines[k]->set_sdf(&collider);
+		referenceEngine.set_sdf(&collider);
+
+	}
+
+	if (cpuBackend) {
+
+		if (neighbours == particleCompute::NEIGHBOURS_TILES) {
+			cerr << "[Error] The CPU backend finds neighbours with --neighbours=grid" << endl;
+			return 1;
+		}
+
+		return gridSweep ? runGridSweepCPU() : runCPU();
+
+	}
+
+	readback.add_consumer(keepPositions);
+	if (exportFile)
+		readback.add_consumer(exportPositions);
+	recordReadback.add_consumer(recordSnapshot);
+
+	if (benchmark) {
+
+		if( !setupBenchmarkContext(&argc, argv) ) {
+			cerr << "[Error] No offscreen OpenGL context" << endl;
+			return 1;
+		}
+
+		if( !setupShaders() ) return 1;
+
+		if (asyncReadback && !particleReadback::supported()) {
+			cerr << "[Error] No fences or buffer copies for --readback=async" << endl;
+			return 1;
+		}
+
+		int status;
+
+		if (gridSweep)
+			status = runGridSweepGPU();
+		else {
+
+			if (collideFile)
+				setupCollider();
+
+			setupParticles();
+
+			status = runBenchmark();
+
+		}
+
+		releaseBenchmarkContext();
+
+		return status;
+
+	}
+
 	cout << "[Init] Starting GLUT... " << flush;
 
 	glutInit(&argc, argv);
@@ -605,14 +2310,20 @@ int main( int argc, char** argv ) {
 	cout << "done!\n[Init] Setting OpenGL up... " << flush;
 
 	setupGL();
-	setupTextures();
 
 	cout << "done!\n[Init] Setup Shaders:" << endl;
 
 	if( !setupShaders() ) return 1;
 
+	if (collideFile)
+		setupCollider();
+
+	setupParticles();
+
 	cout << "Finish!" << endl;
 
+	lastFrame = std::chrono::high_resolution_clock::now();
+
 	glutMainLoop();
 
 	return 0;
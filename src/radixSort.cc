@@ -0,0 +1,135 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  radixSort.cc -- Key/value radix sort of storage buffers
+ *
+ **/
+
+#include "radixSort.h"
+
+#include <assert.h>
+
+/// Storage buffer bindings of radixsort.comp
+enum { BINDING_KEYS_IN = 0, BINDING_VALUES_IN = 1, BINDING_KEYS_OUT = 2, BINDING_VALUES_OUT = 3,
+       BINDING_COUNTS = 4 };
+
+/// Bits of a digit and keys per block, as in radixsort.comp
+static const GLuint RADIX_BITS = 4, RADIX = 1 << RADIX_BITS, ITEMS = 64;
+
+radixSort::radixSort () : groupSize(256), ssbo_keys(0), ssbo_values(0), ssbo_counts(0), capacity(0) {
+
+}
+
+void radixSort::install (bool debug, GLuint group_size) {
+
+	groupSize = group_size;
+
+	for (int k = 0; k < NUM_PASSES; ++k) {
+
+		passes[k].set_define("GROUP_SIZE", groupSize);
+		passes[k].set_define("ITEMS", ITEMS);
+		passes[k].set_define("PASS", k);
+		passes[k].compute_source("radixsort.comp");
+		passes[k].install(debug);
+
+	}
+
+}
+
+void radixSort::clear (void) {
+
+	if (!capacity)
+		return;
+
+	glDeleteBuffers(1, &ssbo_keys);
+	glDeleteBuffers(1, &ssbo_values);
+	glDeleteBuffers(1, &ssbo_counts);
+
+	capacity = 0;
+
+}
+
+/// The digits are sorted in pairs of passes, the second one of each pair
+/// writing back to the buffers given; a last digit above bits is all
+/// zeros and keeps the order
+
+void radixSort::sort (GLuint keys, GLuint values, GLuint n, GLuint bits) {
+
+	if (n < 2)
+		return;
+
+	GLuint numBlocks = (n + ITEMS - 1) / ITEMS;
+	GLuint numGroups = (numBlocks + groupSize - 1) / groupSize;
+
+	GLint max_groups = 0;
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max_groups);
+	assert( numGroups <= (GLuint)max_groups );
+
+	/// buffers only grow, as in the neighbour grid
+	if (n > capacity) {
+
+		clear();
+
+		capacity = n;
+
+		GLuint *buffers[] = { &ssbo_keys, &ssbo_values, &ssbo_counts };
+		GLuint sizes[] = { capacity, capacity, RADIX*((capacity + ITEMS - 1) / ITEMS) };
+
+		for (int k = 0; k < 3; ++k) {
+			glGenBuffers(1, buffers[k]);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, *buffers[k]);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizes[k]*sizeof(GLuint), 0, GL_DYNAMIC_COPY);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	}
+
+	GLuint digits = (bits + RADIX_BITS - 1) / RADIX_BITS;
+	digits += digits % 2;
+
+	GLuint from[2] = { keys, values }, to[2] = { ssbo_keys, ssbo_values };
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_COUNTS, ssbo_counts);
+
+	for (GLuint d = 0; d < digits; ++d) {
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_KEYS_IN, from[0]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_VALUES_IN, from[1]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_KEYS_OUT, to[0]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING_VALUES_OUT, to[1]);
+
+		passes[PASS_COUNT].use();
+		passes[PASS_COUNT].set_uniform("n", (GLint)n);
+		passes[PASS_COUNT].set_uniform("numBlocks", (GLint)numBlocks);
+		passes[PASS_COUNT].set_uniform("shift", (GLint)(d*RADIX_BITS));
+		glDispatchCompute(numGroups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		passes[PASS_SCAN].use();
+		passes[PASS_SCAN].set_uniform("numBlocks", (GLint)numBlocks);
+		glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		passes[PASS_SCATTER].use();
+		passes[PASS_SCATTER].set_uniform("n", (GLint)n);
+		passes[PASS_SCATTER].set_uniform("numBlocks", (GLint)numBlocks);
+		passes[PASS_SCATTER].set_uniform("shift", (GLint)(d*RADIX_BITS));
+		glDispatchCompute(numGroups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+				GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		for (int k = 0; k < 2; ++k) {
+			GLuint t = from[k];
+			from[k] = to[k];
+			to[k] = t;
+		}
+
+	}
+
+	passes[PASS_SCATTER].use(0);
+
+	for (int b = BINDING_KEYS_IN; b <= BINDING_COUNTS; ++b)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, 0);
+
+}
@@ -15,6 +15,8 @@
 
 #include "materials.h" // color materials constants
 
+#include "meshCache.h" // models kept in buffer objects
+
 #ifdef __WIN32__
 #define GLUT_DISABLE_ATEXIT_HACK // for compiling with Mingw
 #endif
@@ -62,6 +64,14 @@ static int buttonPressed = -1; ///< Button state
 
 static int modelId = 1; ///< Current model to be drawn
 static const int NUM_MODELS = 3;
+static const char modelName[NUM_MODELS][255] = { "Sphere", "GLUT Teapot", "Quad" };
+
+static meshCache meshes; ///< Models tessellated once into buffer objects
+static bool cachedMeshes = true; ///< Draw the cached models (true) or through immediate mode (false)
+static double drawTime = 0.; ///< Milliseconds of the last model draw
+static bool timerOK = false; ///< Timer query support flag
+static GLuint drawQuery[2]; ///< Timer queries of the last two model draws
+static int drawQueryCount = 0; ///< Number of draws issued with a query
 
 static bool showInfo = true, showHelp = false; ///< Show information or help flags
 
@@ -143,9 +153,13 @@ void showIH( void ) {
 
 		char str[256];
 
-		sprintf(str, "Model: GLUT Teapot" );
+		sprintf(str, "Model: %s", modelName[modelId] );
 		glWrite(-0.9, 0.7, str);
 
+		if( timerOK ) sprintf(str, "Draw: %.2f ms (%s)", drawTime, (cachedMeshes)?"cached":"immediate" );
+		else sprintf(str, "Draw: %s", (cachedMeshes)?"cached":"immediate" );
+		glWrite(-0.9, 0.6, str);
+
 		if( !gsOK ) {
 			sprintf(str, "!!No Geometry Shader!!" );
 			glWrite(-0.9, 0.8, str);
@@ -202,6 +216,7 @@ void showIH( void ) {
 		glWrite(-0.12, -0.3, "(r) change to ruby material");
 		glWrite(-0.12, -0.4, "(0-7) change shader tiers");
 		glWrite(-0.12, -0.5, "(v|g|f) on/off vertex/geometry/fragment shader");
+		glWrite(-0.12, -0.6, "(m) switch cached/immediate meshes");
 		glWrite(-0.12, -0.7, "(q|esc) close application");
 
 	} else if( showInfo ) {
@@ -238,10 +253,17 @@ inline vec rotate_y( vec v, float sin_ang, float cos_ang ) {
 
 /// Renders the currently selected model
 /// to insert a new model remember to increment the NUM_MODEL const
+/// (and to add it to the meshCache)
 
 void drawModel ( int m ) {
 
-	if( m == 0 ) {
+	if( cachedMeshes ) {
+
+		if( m == 1 && wireframe ) glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+		meshes.draw(m);
+		if( m == 1 && wireframe ) glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+	} else if( m == 0 ) {
 
 		GLUquadric *qobj = gluNewQuadric();
 		gluQuadricTexture(qobj,GL_TRUE);
@@ -319,13 +341,13 @@ void display( void ) {
 
 		glEnable(GL_TEXTURE_2D);
 
-		shTier[5].set_uniform("envMapTex", 0);
+		shTier[5].bind_texture("envMapTex", tex_envmap);
 
 	} else if( currTier == 7 && fsON ) {
 
 		glEnable(GL_TEXTURE_2D);
 
-		shTier[6].set_uniform("normalMapTex", 2);
+		shTier[6].bind_texture("normalMapTex", tex_normalmap);
 		shTier[6].set_uniform("applyTex", applyTex);
 
 	}
@@ -334,7 +356,25 @@ void display( void ) {
 	  //shTier[8].set_uniform("viewport", (float)winWidth, (float)winHeight);
 	}
 
+	if( timerOK ) glBeginQuery(GL_TIME_ELAPSED_EXT, drawQuery[drawQueryCount%2]);
+
 	drawModel(modelId);
+
+	if( timerOK ) {
+
+		glEndQuery(GL_TIME_ELAPSED_EXT);
+		++drawQueryCount;
+
+		// the query of the previous frame is usually done by now
+		GLuint prev = drawQuery[drawQueryCount%2], ns = 0;
+		GLint available = 0;
+		if( drawQueryCount > 1 ) glGetQueryObjectiv(prev, GL_QUERY_RESULT_AVAILABLE, &available);
+		if( available ) {
+			glGetQueryObjectuiv(prev, GL_QUERY_RESULT, &ns);
+			drawTime = ns*1e-6;
+		}
+
+	}
 	
 	if( currTier > 0 ) shTier[currTier-1].use(false);
 
@@ -541,6 +581,9 @@ void keyboard( unsigned char key, int x, int y ) {
 	case 't': case 'T': // ruby material
 		applyTex = !applyTex;
 		break;
+	case 'm': case 'M': // cached/immediate meshes
+		cachedMeshes = !cachedMeshes;
+		break;
 	case 'h': case 'H': case '?': // show help
 		showHelp = !showHelp;
 		break;
@@ -566,6 +609,7 @@ void keyboard( unsigned char key, int x, int y ) {
 		setupTexture(textureId);
 		break;		
 	case 'q': case 'Q': case 27: // quit application
+		glsl_release_context();
 		glutDestroyWindow( glutGetWindow() );
 		return;
 	case '+':
@@ -658,7 +702,7 @@ void motion( int x, int y ) {
 /// @arg name texture file name PPM
 /// @arg texId returned texture id
 
-void readTextureFile(  char* name , GLuint texId) {
+void readTextureFile(  char* name , GLuint& texId) {
 	string x;
 	ifstream inFile;
 
@@ -700,13 +744,19 @@ void readTextureFile(  char* name , GLuint texId) {
 
 	inFile.close();
 
+	glsl_reset_texture_cache(); // texture bound outside the kernels
+
 }
 
 /// Setup texture
 
 void setupTexture ( int t ) {
 
-	glActiveTexture(GL_TEXTURE2);
+	if( tex_normalmap ) {
+		glsl_release_texture(tex_normalmap);
+		glDeleteTextures(1, &tex_normalmap);
+	}
+
 	readTextureFile((char*)textureFile[t], tex_normalmap);
 }
 
@@ -759,11 +809,15 @@ void setupGL( void ) {
 		arot[i] = aang[i] = 0.;
 	zoom = 1.;
 
-	glActiveTexture(GL_TEXTURE0);
 	readTextureFile((char*)"envmap.ppm", tex_envmap);
 
 	setupTexture(textureId);	
 
+	meshes.build();
+
+	timerOK = timer_query_support();
+	if( timerOK ) glGenQueries(2, drawQuery);
+
 }
 
 /// Setup GLSL Shaders
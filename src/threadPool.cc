@@ -0,0 +1,102 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  threadPool.cc -- Fixed set of worker threads splitting index ranges
+ *
+ **/
+
+#include "threadPool.h"
+
+threadPool::threadPool( unsigned threads ) : job(0), jobSize(0), jobAlign(1),
+	generation(0), pending(0), quit(false) {
+
+	numThreads = threads ? threads : std::thread::hardware_concurrency();
+	if (numThreads == 0)
+		numThreads = 1;
+
+	for (unsigned k = 1; k < numThreads; ++k)
+		workers.push_back( std::thread(&threadPool::worker, this, k) );
+
+}
+
+threadPool::~threadPool() {
+
+	{
+		std::lock_guard< std::mutex > guard(lock);
+		quit = true;
+	}
+	start.notify_all();
+
+	for (size_t k = 0; k < workers.size(); ++k)
+		workers[k].join();
+
+}
+
+void threadPool::chunk( unsigned k, size_t& begin, size_t& end ) const {
+
+	size_t blocks = (jobSize + jobAlign - 1) / jobAlign;
+	size_t per = (blocks + numThreads - 1) / numThreads;
+
+	begin = k * per * jobAlign;
+	end = begin + per * jobAlign;
+	if (begin > jobSize) begin = jobSize;
+	if (end > jobSize) end = jobSize;
+
+}
+
+void threadPool::run( size_t n, const rangeFunction& fn, size_t align ) {
+
+	if (numThreads == 1 || n <= align) {
+		fn(0, n);
+		return;
+	}
+
+	{
+		std::lock_guard< std::mutex > guard(lock);
+		job = &fn;
+		jobSize = n;
+		jobAlign = align ? align : 1;
+		pending = numThreads - 1;
+		++generation;
+	}
+	start.notify_all();
+
+	size_t begin, end;
+	chunk(0, begin, end);
+	if (begin < end)
+		fn(begin, end);
+
+	std::unique_lock< std::mutex > guard(lock);
+	done.wait(guard, [this] { return pending == 0; });
+	job = 0;
+
+}
+
+void threadPool::worker( unsigned k ) {
+
+	unsigned seen = 0;
+
+	for (;;) {
+
+		std::unique_lock< std::mutex > guard(lock);
+		start.wait(guard, [&] { return quit || generation != seen; });
+		if (quit)
+			return;
+		seen = generation;
+
+		const rangeFunction& fn = *job;
+		size_t begin, end;
+		chunk(k, begin, end);
+		guard.unlock();
+
+		if (begin < end)
+			fn(begin, end);
+
+		guard.lock();
+		if (--pending == 0)
+			done.notify_one();
+
+	}
+
+}
@@ -0,0 +1,632 @@
+/**
+ *
+ *    Introduction to GPU Programming with GLSL
+ *
+ *  trajectory.cc -- Particle trajectories recorded to a chunked binary file
+ *
+ **/
+
+#include "trajectory.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace trajectory;
+
+/// Values recorded per particle: position then velocity xyz
+static const unsigned VALUES = 6;
+
+/// Chunks start on 8 byte boundaries, so mapped headers are aligned
+static const size_t ALIGN = 8;
+
+static size_t padded( size_t n ) { return (n + ALIGN - 1) & ~(ALIGN - 1); }
+
+/// ------------------------------------   ENCODING   --------------------------------------
+
+/// Rounds a float to the nearest half, ties to even
+/// @arg f value
+/// @return half bits
+
+static uint16_t to_half( float f ) {
+
+	uint32_t x;
+	memcpy(&x, &f, sizeof(x));
+
+	uint32_t sign = (x >> 16) & 0x8000, mant = x & 0x7fffff;
+	int exp = (int)((x >> 23) & 0xff) - 127 + 15;
+
+	if (((x >> 23) & 0xff) == 0xff) // inf and nan
+		return sign | 0x7c00 | (mant ? 0x200 : 0);
+	if (exp >= 31) // overflow
+		return sign | 0x7c00;
+
+	if (exp <= 0) { // subnormal or zero
+
+		if (exp < -10)
+			return sign;
+
+		mant |= 0x800000;
+		uint32_t shift = 14 - exp, h = mant >> shift;
+		uint32_t rest = mant & ((1u << shift) - 1), tie = 1u << (shift - 1);
+		if (rest > tie || (rest == tie && (h & 1)))
+			++h;
+		return sign | h;
+
+	}
+
+	// a carry out of the mantissa rounds into the exponent
+	uint32_t h = sign | (exp << 10) | (mant >> 13), rest = mant & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+		++h;
+	return h;
+
+}
+
+/// Widens a half to a float
+/// @arg h half bits
+/// @return value
+
+static float from_half( uint16_t h ) {
+
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16, exp = (h >> 10) & 0x1f, mant = h & 0x3ff, x;
+
+	if (exp == 0) {
+
+		if (!mant)
+			x = sign;
+		else { // normalize the subnormal
+			exp = 127 - 15 + 1;
+			while (!(mant & 0x400)) {
+				mant <<= 1;
+				--exp;
+			}
+			x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+		}
+
+	} else if (exp == 31)
+		x = sign | 0x7f800000 | (mant << 13);
+	else
+		x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+
+	float f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
+
+}
+
+/// Groups byte k of every element together: the exponent bytes of close
+/// values repeat, which is what the compressor finds
+/// @arg in, out n elements of size bytes
+/// @arg n, size number and size of the elements
+
+static void shuffle( const unsigned char *in, unsigned char *out, size_t n, size_t size ) {
+
+	for (size_t i = 0; i < n; ++i)
+		for (size_t k = 0; k < size; ++k)
+			out[k*n + i] = in[i*size + k];
+
+}
+
+/// Inverse of shuffle
+
+static void unshuffle( const unsigned char *in, unsigned char *out, size_t n, size_t size ) {
+
+	for (size_t i = 0; i < n; ++i)
+		for (size_t k = 0; k < size; ++k)
+			out[i*size + k] = in[k*n + i];
+
+}
+
+/// ------------------------------------   COMPRESSION   -----------------------------------
+
+/// Byte-oriented LZ77 in the manner of an LZ4 block: each sequence is a
+/// token (literal run and match length, 4 bits each, 15 continuing in
+/// bytes of up to 255), the literals, and the 16 bit offset and the rest
+/// of the length of a match of at least 4 bytes. The last sequence has
+/// literals only
+
+static const size_t MIN_MATCH = 4;
+static const size_t MAX_OFFSET = 65535;
+static const unsigned HASH_BITS = 12;
+
+/// Worst case compressed size of n bytes
+static size_t lz_bound( size_t n ) { return n + n/255 + 16; }
+
+static unsigned char* put_length( unsigned char *out, size_t n ) {
+
+	for (; n >= 255; n -= 255)
+		*out++ = 255;
+	*out++ = (unsigned char)n;
+	return out;
+
+}
+
+static unsigned char* put_sequence( unsigned char *out, const unsigned char *literals, size_t num_literals,
+				    size_t offset, size_t match ) {
+
+	unsigned char *token = out++;
+	size_t m = match ? match - MIN_MATCH : 0;
+
+	*token = (unsigned char)(((num_literals < 15 ? num_literals : 15) << 4) | (m < 15 ? m : 15));
+
+	if (num_literals >= 15)
+		out = put_length(out, num_literals - 15);
+	memcpy(out, literals, num_literals);
+	out += num_literals;
+
+	if (match) {
+		*out++ = offset & 0xff;
+		*out++ = offset >> 8;
+		if (m >= 15)
+			out = put_length(out, m - 15);
+	}
+
+	return out;
+
+}
+
+/// Compresses n bytes
+/// @arg in input
+/// @arg out output of at least lz_bound(n) bytes
+/// @return compressed size
+
+static size_t lz_compress( const unsigned char *in, size_t n, unsigned char *out ) {
+
+	std::vector< uint32_t > table(1u << HASH_BITS, ~0u);
+	unsigned char *o = out;
+	size_t anchor = 0, i = 0;
+
+	while (i + MIN_MATCH <= n) {
+
+		uint32_t v;
+		memcpy(&v, in + i, sizeof(v));
+		uint32_t h = (v * 2654435761u) >> (32 - HASH_BITS);
+		uint32_t cand = table[h];
+		table[h] = (uint32_t)i;
+
+		if (cand == ~0u || i - cand > MAX_OFFSET || memcmp(in + cand, in + i, MIN_MATCH) != 0) {
+			++i;
+			continue;
+		}
+
+		size_t len = MIN_MATCH;
+		while (i + len < n && in[cand + len] == in[i + len])
+			++len;
+
+		o = put_sequence(o, in + anchor, i - anchor, i - cand, len);
+		i += len;
+		anchor = i;
+
+	}
+
+	o = put_sequence(o, in + anchor, n - anchor, 0, 0);
+
+	return o - out;
+
+}
+
+/// Decompresses into exactly n bytes
+/// @arg in, size compressed input
+/// @arg out output of n bytes
+/// @return false if the input is corrupt
+
+static bool lz_decompress( const unsigned char *in, size_t size, unsigned char *out, size_t n ) {
+
+	const unsigned char *end = in + size;
+	size_t o = 0;
+
+	while (in < end) {
+
+		unsigned token = *in++;
+
+		size_t num_literals = token >> 4;
+		if (num_literals == 15)
+			do { if (in >= end) return false; num_literals += *in; } while (*in++ == 255);
+
+		if (num_literals > (size_t)(end - in) || o + num_literals > n)
+			return false;
+		memcpy(out + o, in, num_literals);
+		in += num_literals;
+		o += num_literals;
+
+		if (in == end)
+			break;
+
+		if (end - in < 2)
+			return false;
+		size_t offset = in[0] | (in[1] << 8);
+		in += 2;
+
+		size_t match = (token & 15);
+		if (match == 15)
+			do { if (in >= end) return false; match += *in; } while (*in++ == 255);
+		match += MIN_MATCH;
+
+		if (offset == 0 || offset > o || o + match > n)
+			return false;
+
+		// byte by byte, the match may overlap what it writes
+		for (size_t k = 0; k < match; ++k, ++o)
+			out[o] = out[o - offset];
+
+	}
+
+	return o == n;
+
+}
+
+/// ------------------------------------   RECORDER   --------------------------------------
+
+trajectoryRecorder::trajectoryRecorder( void ) : file(0), every(1), flags(0), quit(false), failed(false), offset(0) {
+
+}
+
+trajectoryRecorder::~trajectoryRecorder() {
+
+	close();
+
+}
+
+bool trajectoryRecorder::open( const char *filename, unsigned interval, bool half, bool compress ) {
+
+	close();
+
+	assert( interval > 0 );
+
+	file = fopen(filename, "wb");
+	if (!file)
+		return false;
+
+	every = interval;
+	flags = (half ? FLAG_HALF : 0) | (compress ? FLAG_COMPRESSED : 0);
+
+	fileHeader h = { {'P', 'T', 'R', 'J'}, 1, flags, every };
+	if (fwrite(&h, sizeof(h), 1, file) != 1) {
+		fclose(file);
+		file = 0;
+		return false;
+	}
+	offset = sizeof(h);
+
+	index.clear();
+	quit = failed = false;
+	thread = std::thread(&trajectoryRecorder::writer, this);
+
+	return true;
+
+}
+
+void trajectoryRecorder::record( uint64_t step, unsigned n, const float *pos, const float *vel, unsigned stride ) {
+
+	assert( is_open() );
+
+	snapshot s;
+	s.step = step;
+	s.count = n;
+	s.values.resize(VALUES*n);
+
+	for (unsigned i = 0; i < n; ++i)
+		for (int c = 0; c < 3; ++c) {
+			s.values[VALUES*i + c] = pos[stride*i + c];
+			s.values[VALUES*i + 3 + c] = vel[stride*i + c];
+		}
+
+	{
+		std::unique_lock< std::mutex > guard(lock);
+		space.wait(guard, [this] { return failed || queue.size() < MAX_QUEUED; });
+		if (failed)
+			return;
+		queue.push_back(std::move(s));
+	}
+	ready.notify_one();
+
+}
+
+void trajectoryRecorder::writer( void ) {
+
+	for (;;) {
+
+		std::unique_lock< std::mutex > guard(lock);
+		ready.wait(guard, [this] { return quit || failed || !queue.empty(); });
+		if (failed || queue.empty())
+			return;
+
+		snapshot s = std::move(queue.front());
+		queue.pop_front();
+		guard.unlock();
+		space.notify_one();
+
+		if (!write_chunk(s)) {
+			guard.lock();
+			failed = true;
+			queue.clear();
+			guard.unlock();
+			space.notify_all();
+			return;
+		}
+
+	}
+
+}
+
+/// The payload is quantized, shuffled by byte and compressed; it is
+/// stored as is when compression does not make it smaller
+
+bool trajectoryRecorder::write_chunk( const snapshot& s ) {
+
+	size_t num_values = s.values.size();
+	size_t size = (flags & FLAG_HALF) ? sizeof(uint16_t) : sizeof(float);
+	size_t raw_size = num_values*size;
+
+	raw.resize(raw_size);
+	packed.resize(lz_bound(raw_size));
+
+	if (flags & FLAG_HALF) {
+		std::vector< uint16_t > halves(num_values);
+		for (size_t k = 0; k < num_values; ++k)
+			halves[k] = to_half(s.values[k]);
+		shuffle((const unsigned char*)&halves[0], &raw[0], num_values, size);
+	} else if (num_values)
+		shuffle((const unsigned char*)&s.values[0], &raw[0], num_values, size);
+
+	uint32_t chunk_flags = flags & FLAG_HALF;
+	const unsigned char *payload = raw.empty() ? 0 : &raw[0];
+	size_t stored_size = raw_size;
+
+	if (flags & FLAG_COMPRESSED) {
+		size_t z = lz_compress(payload, raw_size, &packed[0]);
+		if (z < raw_size) {
+			chunk_flags |= FLAG_COMPRESSED;
+			payload = &packed[0];
+			stored_size = z;
+		}
+	}
+
+	chunkHeader h = { {'P', 'C', 'H', 'K'}, chunk_flags, s.step, s.count,
+			  (uint32_t)raw_size, (uint32_t)stored_size, 0 };
+
+	static const unsigned char zeros[ALIGN] = { 0 };
+
+	size_t pad = padded(stored_size) - stored_size;
+
+	if (fwrite(&h, sizeof(h), 1, file) != 1 ||
+	    (stored_size && fwrite(payload, 1, stored_size, file) != stored_size) ||
+	    fwrite(zeros, 1, pad, file) != pad)
+		return false;
+
+	indexEntry e = { s.step, offset };
+	index.push_back(e);
+
+	offset += sizeof(h) + padded(stored_size);
+
+	return true;
+
+}
+
+/// The index is only written after whole chunks, a file cut short
+/// being left without it
+
+bool trajectoryRecorder::close( void ) {
+
+	if (!file)
+		return true;
+
+	{
+		std::lock_guard< std::mutex > guard(lock);
+		quit = true;
+	}
+	ready.notify_one();
+	thread.join();
+
+	fileFooter f = { {'P', 'I', 'D', 'X'}, (uint32_t)index.size(), offset };
+
+	if (!failed)
+		failed = (!index.empty() && fwrite(&index[0], sizeof(indexEntry), index.size(), file) != index.size()) ||
+			 fwrite(&f, sizeof(f), 1, file) != 1;
+
+	if (!failed)
+		offset += index.size()*sizeof(indexEntry) + sizeof(f);
+
+	failed = (fclose(file) != 0) || failed;
+	file = 0;
+
+	return !failed;
+
+}
+
+/// ------------------------------------   READER   ----------------------------------------
+
+bool trajectoryReader::open( const char *filename ) {
+
+	close();
+
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(fileHeader)) {
+		::close(fd);
+		return false;
+	}
+
+	void *p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+
+	if (p == MAP_FAILED)
+		return false;
+
+	data = (const unsigned char*)p;
+	length = st.st_size;
+
+	const fileHeader& h = *(const fileHeader*)data;
+	if (memcmp(h.magic, "PTRJ", 4) != 0 || h.version != 1) {
+		close();
+		return false;
+	}
+	every = h.interval;
+
+	// the index of a closed file, otherwise walk the chunks
+	const fileFooter *f = (const fileFooter*)(data + length - sizeof(fileFooter));
+
+	if (length >= sizeof(fileHeader) + sizeof(fileFooter) && memcmp(f->magic, "PIDX", 4) == 0 &&
+	    f->indexOffset <= length - sizeof(fileFooter) &&
+	    f->numChunks == (length - sizeof(fileFooter) - f->indexOffset) / sizeof(indexEntry) &&
+	    f->indexOffset + f->numChunks*sizeof(indexEntry) + sizeof(fileFooter) == length) {
+
+		const indexEntry *e = (const indexEntry*)(data + f->indexOffset);
+		index.assign(e, e + f->numChunks);
+
+		// the entries are trusted no more than the chunks they point at
+		bool ok = true;
+		for (size_t k = 0; k < index.size() && ok; ++k)
+			ok = valid(index[k].offset, f->indexOffset) && header(k).step == index[k].step;
+
+		if (!ok) {
+			close();
+			return false;
+		}
+
+	} else
+		scan();
+
+	return true;
+
+}
+
+void trajectoryReader::scan( void ) {
+
+	index.clear();
+
+	size_t at = sizeof(fileHeader);
+
+	while (at + sizeof(chunkHeader) <= length) {
+
+		if (!valid(at, length))
+			break; // a chunk cut short by the end of the recording
+
+		const chunkHeader& h = *(const chunkHeader*)(data + at);
+
+		indexEntry e = { h.step, at };
+		index.push_back(e);
+
+		at += sizeof(h) + padded(h.storedSize);
+
+	}
+
+}
+
+/// The payload sizes must match the particles of the chunk, and the
+/// payload end before the index or the end of the file
+
+bool trajectoryReader::valid( uint64_t at, uint64_t end ) const {
+
+	if (at % ALIGN != 0 || at < sizeof(fileHeader) || at > end || end - at < sizeof(chunkHeader))
+		return false;
+
+	const chunkHeader& h = *(const chunkHeader*)(data + at);
+	uint64_t size = (h.flags & FLAG_HALF) ? sizeof(uint16_t) : sizeof(float);
+
+	return memcmp(h.magic, "PCHK", 4) == 0 && h.rawSize == (uint64_t)VALUES*h.count*size &&
+	       ((h.flags & FLAG_COMPRESSED) || h.storedSize == h.rawSize) &&
+	       padded(h.storedSize) <= end - at - sizeof(chunkHeader);
+
+}
+
+void trajectoryReader::close( void ) {
+
+	if (data)
+		munmap((void*)data, length);
+
+	data = 0;
+	length = 0;
+	index.clear();
+
+}
+
+/// Snapshots are every interval steps from the first one, so the chunk
+/// is computed; a recording with gaps falls back to a binary search
+
+size_t trajectoryReader::find( uint64_t step ) const {
+
+	if (index.empty() || step < index[0].step)
+		return index.size();
+
+	size_t k = every ? (step - index[0].step) / every : 0;
+	if (k >= index.size())
+		k = index.size() - 1;
+
+	if (index[k].step <= step && (k + 1 == index.size() || index[k+1].step > step))
+		return k;
+
+	size_t lo = 0, hi = index.size();
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (index[mid].step <= step)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+
+}
+
+bool trajectoryReader::read( size_t chunk, float *pos, float *vel ) const {
+
+	if (chunk >= index.size())
+		return false;
+
+	const chunkHeader& h = header(chunk);
+	const unsigned char *payload = (const unsigned char*)(&h + 1);
+
+	size_t size = (h.flags & FLAG_HALF) ? sizeof(uint16_t) : sizeof(float);
+	size_t num_values = (size_t)VALUES*h.count;
+
+	std::vector< unsigned char > raw(h.rawSize), bytes(h.rawSize);
+
+	if (h.flags & FLAG_COMPRESSED) {
+		if (!lz_decompress(payload, h.storedSize, raw.empty() ? 0 : &raw[0], h.rawSize))
+			return false;
+	} else if (h.rawSize)
+		memcpy(&raw[0], payload, h.rawSize);
+
+	std::vector< float > values(num_values);
+
+	if (num_values) {
+
+		unshuffle(&raw[0], &bytes[0], num_values, size);
+
+		if (h.flags & FLAG_HALF) {
+			const uint16_t *halves = (const uint16_t*)&bytes[0];
+			for (size_t k = 0; k < num_values; ++k)
+				values[k] = from_half(halves[k]);
+		} else
+			memcpy(&values[0], &bytes[0], h.rawSize);
+
+	}
+
+	for (unsigned i = 0; i < h.count; ++i) {
+
+		if (pos) {
+			for (int c = 0; c < 3; ++c)
+				pos[4*i + c] = values[VALUES*i + c];
+			pos[4*i + 3] = i / (float)h.count;
+		}
+
+		if (vel) {
+			for (int c = 0; c < 3; ++c)
+				vel[4*i + c] = values[VALUES*i + 3 + c];
+			vel[4*i + 3] = 1.0f;
+		}
+
+	}
+
+	return true;
+
+}